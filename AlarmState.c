@@ -0,0 +1,77 @@
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "AlarmState.h"
+#include "PressureSensor.h"
+#include "HotPath.h"
+
+// The state is kept as a latch: two copies and a sequence number whose
+// low bit says which copy readers should use. A write updates copy 0 while
+// readers are pointed at copy 1 and then the other way round, so a reader
+// always has a complete copy to read and never waits on a writer. Readers
+// only retry if the sequence moved while they were copying, which can only
+// happen when a writer on the other core is active. Writers are serialized
+// by a hardware spin lock
+
+// Globals
+static volatile uint32_t Alarm_State_Sequence = 0;
+static AlarmStateType Alarm_State_Copies[2] = {
+    {.In_Alarm_Window = false, .Threshold = {[0 ... NUMBER_OF_ZONES - 1] = INITIAL_THRESHOLD}, .Scale_Sensitivity = {[0 ... NUMBER_OF_ZONES - 1] = INITIAL_SENSITIVITY}, .Zone_Mask = ZONES_ANY},
+    {.In_Alarm_Window = false, .Threshold = {[0 ... NUMBER_OF_ZONES - 1] = INITIAL_THRESHOLD}, .Scale_Sensitivity = {[0 ... NUMBER_OF_ZONES - 1] = INITIAL_SENSITIVITY}, .Zone_Mask = ZONES_ANY}
+};
+static spin_lock_t* Alarm_State_Lock;
+
+void InitializeAlarmState(){
+    Alarm_State_Lock = spin_lock_instance(spin_lock_claim_unused(true));
+}
+
+// Take a consistent snapshot of the state, safe from either core or any ISR
+void HOT_PATH_FUNC(ReadAlarmState)(AlarmStateType* state){
+    uint32_t sequence;
+    do {
+        sequence = Alarm_State_Sequence;
+        __dmb();
+        *state = Alarm_State_Copies[sequence & 0x01];
+        __dmb();
+    } while (sequence != Alarm_State_Sequence);
+}
+
+bool HOT_PATH_FUNC(InAlarmWindowQ)(){
+    AlarmStateType state;
+    ReadAlarmState(&state);
+    return state.In_Alarm_Window;
+}
+
+// Start a read-modify-write of the state. Blocks other writers (and 
+// interrupts on this core) until PublishAlarmState or UnlockAlarmState
+uint32_t LockAlarmState(AlarmStateType* state){
+    uint32_t saved_irq = spin_lock_blocking(Alarm_State_Lock);
+    *state = Alarm_State_Copies[Alarm_State_Sequence & 0x01];
+    return saved_irq;
+}
+
+// Make state the new shared state and release the writer lock
+void PublishAlarmState(const AlarmStateType* state, uint32_t saved_irq){
+    // Send readers to copy 1 while copy 0 is written
+    Alarm_State_Sequence++;
+    __dmb();
+    Alarm_State_Copies[0] = *state;
+    __dmb();
+    // Then back to copy 0 while copy 1 catches up
+    Alarm_State_Sequence++;
+    __dmb();
+    Alarm_State_Copies[1] = *state;
+    __dmb();
+    spin_unlock(Alarm_State_Lock, saved_irq);
+}
+
+// Release the writer lock without changing anything
+void UnlockAlarmState(uint32_t saved_irq){
+    spin_unlock(Alarm_State_Lock, saved_irq);
+}
+
+// Overwrite the whole state in one go
+void SetAlarmState(const AlarmStateType* state){
+    AlarmStateType current;
+    uint32_t saved_irq = LockAlarmState(&current);
+    PublishAlarmState(state, saved_irq);
+}
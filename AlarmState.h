@@ -0,0 +1,33 @@
+#ifndef ALARMSTATE_H
+#define ALARMSTATE_H
+
+#include "pico/stdlib.h"
+#include "pico/util/datetime.h"
+#include "PressureSensor.h"
+
+// Defines
+#define INITIAL_SENSITIVITY         50
+
+// Types
+// Everything the ISRs and the main loop share about the alarm.
+// Only ever accessed through the functions below
+typedef struct AlarmStateStruct {
+    bool        In_Alarm_Window;
+    uint16_t    Threshold[NUMBER_OF_ZONES];
+    uint8_t     Scale_Sensitivity[NUMBER_OF_ZONES];
+    uint16_t    Hysteresis[NUMBER_OF_ZONES];    // How far below its trip point an occupied zone has to drop to count as empty
+    uint8_t     Zone_Mask;          // ZONE_BIT()s of the zones that count as in bed
+    datetime_t  Alarm_Window_Start;
+    datetime_t  Alarm_Window_Stop;
+} AlarmStateType;
+
+// Function Prototypes
+void InitializeAlarmState();
+void ReadAlarmState(AlarmStateType* state);
+bool InAlarmWindowQ();
+uint32_t LockAlarmState(AlarmStateType* state);
+void PublishAlarmState(const AlarmStateType* state, uint32_t saved_irq);
+void UnlockAlarmState(uint32_t saved_irq);
+void SetAlarmState(const AlarmStateType* state);
+
+#endif
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/rtc.h"
+#include "Boot.h"
+#include "Buzzer.h"
+#include "HC05.h"
+#include "PressureSensor.h"
+#include "Sensors.h"
+#include "Watchdog.h"
+#include "AlarmState.h"
+#include "Power.h"
+#include "Transport.h"
+#include "FwUpdate.h"
+#include "Motion.h"
+#include "TimerWheel.h"
+#include "Latency.h"
+
+// Globals
+uint32_t Boot_Steps_Started = 0;
+uint32_t Boot_Steps_Done = 0;
+uint64_t Boot_Step_Done_US[NUMBER_OF_BOOT_STEPS];
+uint64_t Boot_First_Sample_US = 0;
+
+// ======================= Boot Step Functions ======================= //
+
+void StartStdio(){
+    //Enable Printing
+    stdio_init_all();
+}
+
+void StartRTC(){
+    rtc_init(); // Real time clock
+}
+
+void StartRecover(){
+    // On a warm boot this restores the clock and settings, the Window step does the alarm window
+    RestoreRetainedState();
+}
+
+void StartADC(){
+    InitializeADC();
+}
+
+// The first decimated reading of every zone takes a few ms to come in
+bool ADCReadyQ(){
+    if (!ZoneReadingsQ()) return false;
+    Boot_First_Sample_US = time_us_64();
+    return true;
+}
+
+// Every step is listed here along with the steps it has to wait on.
+// Steps without dependencies are all started straight away, so slow
+// ones (like holding the HC05 off) overlap with the rest of the boot
+BootStepType BootSteps[NUMBER_OF_BOOT_STEPS] = {
+    // Name         // Start                    // Ready                // Depends on
+    {"Firmware",    &CheckFirmwareInstall,      NULL,                   0},
+    {"State",       &InitializeAlarmState,      NULL,                   0},
+    {"Timers",      &InitializeTimers,          NULL,                   0},
+    {"RTC",         &StartRTC,                  NULL,                   0},
+    {"Recover",     &StartRecover,              NULL,                   BOOT_STEP_BIT(BOOT_STATE) | BOOT_STEP_BIT(BOOT_RTC) | BOOT_STEP_BIT(BOOT_TIMERS)},
+    {"Watchdog",    &InitializeWatchdog,        NULL,                   BOOT_STEP_BIT(BOOT_TIMERS)},
+    {"Power",       &InitializePower,           NULL,                   0},
+    {"BT Power",    &InitializeBluetooth,       &BluetoothPoweredQ,     BOOT_STEP_BIT(BOOT_POWER) | BOOT_STEP_BIT(BOOT_TIMERS)},
+    {"Stdio",       &StartStdio,                NULL,                   BOOT_STEP_BIT(BOOT_POWER)},
+    {"Buzzer",      &InitializeBuzzer,          NULL,                   0},
+    {"ADC",         &StartADC,                  &ADCReadyQ,             0},
+    {"Scale",       &InitializeSensors,         NULL,                   0},
+    {"Motion",      &StartMotionCore,           NULL,                   0},
+    {"Latency",     &InitializeLatencyProbe,    NULL,                   BOOT_STEP_BIT(BOOT_STATE) | BOOT_STEP_BIT(BOOT_BUZZER)},
+    {"Window",      &ResumeAlarmWindow,         NULL,                   BOOT_STEP_BIT(BOOT_RECOVER) | BOOT_STEP_BIT(BOOT_POWER) | BOOT_STEP_BIT(BOOT_SCALE) | BOOT_STEP_BIT(BOOT_LATENCY)},
+    {"Commands",    &EnableCommands,            NULL,                   BOOT_STEP_BIT(BOOT_BT_POWER) | BOOT_STEP_BIT(BOOT_STDIO) | BOOT_STEP_BIT(BOOT_RTC) | BOOT_STEP_BIT(BOOT_ADC) | BOOT_STEP_BIT(BOOT_SCALE) | BOOT_STEP_BIT(BOOT_BUZZER) | BOOT_STEP_BIT(BOOT_WINDOW)}
+};
+
+// ======================= Boot Pipeline ======================= //
+
+// Start every step whose dependencies are done and collect the ones that
+// have finished since the last call. Never blocks, returns true once all
+// steps are done
+bool PollBoot(){
+    bool progress = true;
+    if (BootDoneQ()) return true;
+
+    // Keep going until a pass makes no progress, so chains of 
+    // instant steps all finish in a single call
+    while (progress){
+        progress = false;
+        for (uint8_t i = 0; i < NUMBER_OF_BOOT_STEPS; i++){
+            uint32_t step = BOOT_STEP_BIT(i);
+            // Start anything that is free to go
+            if (!(Boot_Steps_Started & step) && (BootSteps[i].Depends & Boot_Steps_Done) == BootSteps[i].Depends){
+                Boot_Steps_Started |= step;
+                BootSteps[i].Start();
+                progress = true;
+            }
+            // Mark anything that has finished
+            if ((Boot_Steps_Started & step) && !(Boot_Steps_Done & step)){
+                if (BootSteps[i].Ready == NULL || BootSteps[i].Ready()){
+                    Boot_Steps_Done |= step;
+                    Boot_Step_Done_US[i] = time_us_64();
+                    progress = true;
+                }
+            }
+        }
+    }
+
+    return BootDoneQ();
+}
+
+// Start the boot pipeline, this returns as soon as everything that can be
+// done without waiting is done. Call PollBoot() to finish the rest
+void StartBoot(){
+    PollBoot();
+}
+
+bool BootDoneQ(){
+    return Boot_Steps_Done == ALL_BOOT_STEPS;
+}
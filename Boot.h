@@ -0,0 +1,49 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include "pico/stdlib.h"
+
+// Boot steps, in the order they are listed in BootSteps
+typedef enum BootStepEnum {
+    BOOT_FIRMWARE,          // Checks (or finishes) a firmware install, only does anything right after one
+    BOOT_STATE,             // Shared alarm state lock
+    BOOT_TIMERS,            // Timer wheel's hardware alarm, before anything starts a timer
+    BOOT_RTC,
+    BOOT_RECOVER,           // Puts the clock, thresholds and rules back after a reset
+    BOOT_WATCHDOG,
+    BOOT_POWER,             // Clock setup, has to come before any UART
+    BOOT_BT_POWER,          // HC05 power-off hold, runs in the background
+    BOOT_STDIO,
+    BOOT_BUZZER,            // PIO program load
+    BOOT_ADC,               // Zone round robin and DMA, first reading of every zone
+    BOOT_SCALE,             // HX711 pins, its first conversion comes in the background
+    BOOT_MOTION,            // Core 1's breathing and movement detector
+    BOOT_LATENCY,           // Bed to buzzer latency probe, a second PIO program
+    BOOT_WINDOW,            // Picks an open alarm window back up after a reset, once all it starts is ready
+    BOOT_COMMANDS,          // Bluetooth UART interrupts and USB, commands are accepted from here on
+    NUMBER_OF_BOOT_STEPS
+} BootStepIdType;
+
+// Macros
+#define BOOT_STEP_BIT(STEP)         (0x01ul << (STEP))
+#define ALL_BOOT_STEPS              (BOOT_STEP_BIT(NUMBER_OF_BOOT_STEPS) - 1)
+
+// Types
+typedef struct BootStepStruct {
+    char*       Name;
+    void        (*Start)(void);     // Kicks the step off, must never block
+    bool        (*Ready)(void);     // NULL when the step is done as soon as Start returns
+    uint32_t    Depends;            // BOOT_STEP_BIT()s of the steps that have to be done first
+} BootStepType;
+
+// Globals
+extern BootStepType BootSteps[NUMBER_OF_BOOT_STEPS];
+extern uint64_t Boot_Step_Done_US[NUMBER_OF_BOOT_STEPS];
+extern uint64_t Boot_First_Sample_US;
+
+// Function Prototypes
+void StartBoot();
+bool PollBoot();
+bool BootDoneQ();
+
+#endif
@@ -1,44 +1,77 @@
 #include "pico/stdlib.h"
 #include "Buzzer.h"
 #include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
 #include "build/Buzzer.pio.h"
+#include "TimerWheel.h"
+#include "Nights.h"
+#include "HotPath.h"
 
 //Globals
 repeating_timer_t BuzzerTimer;
-repeating_timer_t BuzzerPIOTimer;
+TimerType BuzzerPIOTimer;
 bool PIO_Buzzing = false;
 uint16_t BuzzerCallCount = 0;
 uint8_t PIOBuzzerState = 0;
 PIO pio;
 uint sm;
+volatile uint32_t Buzzer_Tone_Word = 0;
+TimerType BuzzerSweepTimer;
+BuzzerSweepType Buzzer_Sweep;
+uint64_t Buzzer_Sweep_Start_US;
+bool Buzzer_Sweeping = false;
+bool PIO_Escalated = false;
 
 
-// Write `period` to the input shift register
-//This sets the period of the PIO buzzer
-void pio_pwm_set_period(PIO pio, uint sm, uint32_t period) {
-    pio_sm_set_enabled(pio, sm, false);
-    pio_sm_put_blocking(pio, sm, period);
-    pio_sm_exec(pio, sm, pio_encode_pull(false, false));
-    pio_sm_exec(pio, sm, pio_encode_out(pio_isr, 32));
-    pio_sm_set_enabled(pio, sm, true);
+// Pack a tone into the word the PIO program reads every cycle. The duty 
+// (out of 256) splits each period between high and low, 0 or anything too
+// short to time gives silence
+uint32_t HOT_PATH_FUNC(BuzzerToneWord)(uint32_t frequency_hz, uint8_t duty){
+    if (frequency_hz == 0 || duty == 0) return 0;
+    uint32_t period = BUZZER_PIO_HZ / frequency_hz;
+    uint32_t high = (period * duty) >> 8;
+    uint32_t low = period - high;
+    if (high <= BUZZER_HIGH_OVERHEAD || low <= BUZZER_LOW_OVERHEAD) return 0;
+    high = MIN(high - BUZZER_HIGH_OVERHEAD, BUZZER_MAX_LOOPS);
+    low = MIN(low - BUZZER_LOW_OVERHEAD, BUZZER_MAX_LOOPS);
+    return (low << 16) | high;
 }
 
-// Write 1 to TX FIFO. State machine will copy this into X.
+// Hand the state machine a new word without stopping it. Anything still in 
+// the FIFO is thrown away so this word is the one picked up at the start of
+// the next cycle, less than one tone period from now
+static void HOT_PATH_FUNC(PushToneWord)(uint32_t word){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    pio_sm_clear_fifos(pio, sm);
+    pio_sm_put(pio, sm, word);
+    restore_interrupts(saved_irq);
+}
+
+// Retune the buzzer. If it's sounding the new tone takes over at the end of
+// the current cycle, so there's no gap or click. Safe to call from an ISR
+void HOT_PATH_FUNC(SetBuzzerTone)(uint32_t frequency_hz, uint8_t duty){
+    Buzzer_Tone_Word = BuzzerToneWord(frequency_hz, duty);
+    if (PIOBuzzerState == 1) PushToneWord(Buzzer_Tone_Word);
+}
+
+// Write the current tone to TX FIFO. State machine will copy this into X.
 // This generates a square wave on pin PIO_BUZZER_PIN 
-void TurnOnPIOBuzzer(){
-    pio_sm_put_blocking(pio, sm, 1);
+void HOT_PATH_FUNC(TurnOnPIOBuzzer)(){
     PIOBuzzerState = 1;
+    PushToneWord(Buzzer_Tone_Word);
 }
 // Write 0 to TX FIFO. State machine will copy this into X.
 // This stops generating a square wave on pin PIO_BUZZER_PIN 
-void TurnOffPIOBuzzer(){
-    pio_sm_put_blocking(pio, sm, 0);
+// once the cycle it's in is done
+void HOT_PATH_FUNC(TurnOffPIOBuzzer)(){
     PIOBuzzerState = 0;
+    PushToneWord(0);
 }
 // Write 0/1 to TX FIFO. State machine will copy this into X.
 // This stops/starts generating a square wave on pin PIO_BUZZER_PIN 
 // depending on the current state of the PIOBuzzerState global
-bool TogglePIOBuzzer(struct repeating_timer *t){
+void HOT_PATH_FUNC(TogglePIOBuzzer)(TimerType* timer){
     if(PIOBuzzerState == 0){
         TurnOnPIOBuzzer();
     }else if(PIOBuzzerState == 1){
@@ -59,14 +92,57 @@ void InitializeBuzzer(){
     //Find a free state machine on our chosen PIO
     sm = pio_claim_unused_sm(pio, true);
     
-    //Configure pwm PIO state
-    pwm_program_init(pio, sm, offset, PIO_BUZZER_PIN);
-    pio_pwm_set_period(pio, sm, PIO_BUZZER_HALF_PERIOD);
+    //Configure pwm PIO state, clocked so tones don't depend on clk_sys. 
+    //Only true at full speed, the buzzer is never on at low power
+    pwm_program_init(pio, sm, offset, PIO_BUZZER_PIN, (float) clock_get_hz(clk_sys) / BUZZER_PIO_HZ);
+    SetBuzzerTone(BUZZER_TONE_HZ, BUZZER_FULL_DUTY);
     TurnOffPIOBuzzer();
 }
 
+//Function called by the sweep timer, moves the tone along the sweep
+void HOT_PATH_FUNC(BuzzerSweepCallback)(TimerType* timer){
+    int64_t duration_us = Buzzer_Sweep.Duration_MS * 1000ll;
+    int64_t elapsed = TimerNowUs() - Buzzer_Sweep_Start_US;
+    if (elapsed >= duration_us){
+        if (!Buzzer_Sweep.Repeat){
+            //Hold the end tone
+            SetBuzzerTone(Buzzer_Sweep.End_Hz, Buzzer_Sweep.End_Duty);
+            StopBuzzerSweep();
+            return;
+        }
+        elapsed %= duration_us;
+        Buzzer_Sweep_Start_US = TimerNowUs() - elapsed;
+    }
+    int64_t hz = Buzzer_Sweep.Start_Hz + ((int64_t) Buzzer_Sweep.End_Hz - Buzzer_Sweep.Start_Hz) * elapsed / duration_us;
+    int64_t duty = Buzzer_Sweep.Start_Duty + ((int64_t) Buzzer_Sweep.End_Duty - Buzzer_Sweep.Start_Duty) * elapsed / duration_us;
+    SetBuzzerTone(hz, duty);
+}
+
+//Sweep the tone every BUZZER_SWEEP_STEP_US from one frequency and duty to 
+//another. This only sets the tone, the buzzer still has to be turned on
+void HOT_PATH_FUNC(StartBuzzerSweep)(const BuzzerSweepType* sweep){
+    StopBuzzerSweep();
+    Buzzer_Sweep = *sweep;
+    if (Buzzer_Sweep.Duration_MS == 0){
+        SetBuzzerTone(Buzzer_Sweep.End_Hz, Buzzer_Sweep.End_Duty);
+        return;
+    }
+    Buzzer_Sweep_Start_US = TimerNowUs();
+    SetBuzzerTone(Buzzer_Sweep.Start_Hz, Buzzer_Sweep.Start_Duty);
+    Buzzer_Sweeping = true;
+    StartTimerUs(&BuzzerSweepTimer, BUZZER_SWEEP_STEP_US, BUZZER_SWEEP_STEP_US, &BuzzerSweepCallback, NULL);
+}
+
+//Stop a sweep where it is, the tone it got to is kept
+void HOT_PATH_FUNC(StopBuzzerSweep)(){
+    if (Buzzer_Sweeping){
+        CancelTimer(&BuzzerSweepTimer);
+        Buzzer_Sweeping = false;
+    }
+}
+
 //Function called by the buzzer IQR timer
-bool BuzzerCallback(struct repeating_timer *t){
+bool HOT_PATH_FUNC(BuzzerCallback)(struct repeating_timer *t){
     //See if we should be buzzing or not
     if(BuzzerCallCount < BUZZER_BEEP_HALF_PERIOD){
         //Toggle GPIO pin connected to the buzzer to make it buzz
@@ -85,29 +161,54 @@ bool BuzzerCallback(struct repeating_timer *t){
 }
 
 //Set up a repeating timer which toggles the BUZZER_PIN GPIO pin every BUZZER_HALF_US_PERIOD microseconds
+//The tone itself is too fine for the timer wheel's 64us ticks, so this one stays on an SDK timer
 void TurnOnBuzzer(){
     add_repeating_timer_us(-BUZZER_HALF_US_PERIOD, BuzzerCallback, NULL, &BuzzerTimer);
 }
 
 //Set turn on/off the PIO buzzer with a period of 2*BUZZER_HALF_US_PERIOD 
-void StartBeepingPIOBuzzer(){
+void HOT_PATH_FUNC(StartBeepingPIOBuzzer)(){
     if(!PIO_Buzzing){
         PIO_Buzzing = true;
-        add_repeating_timer_ms(-BUZZER_PIO_BEEP_HALF_PERIOD, TogglePIOBuzzer, NULL, &BuzzerPIOTimer);
+        NightBuzzer(true);
+        uint32_t half_period = PIO_Escalated ? BUZZER_ESCALATED_HALF_PERIOD : BUZZER_PIO_BEEP_HALF_PERIOD;
+        StartTimerMs(&BuzzerPIOTimer, half_period, half_period, &TogglePIOBuzzer, NULL);
     }
     return;
 }
 //Stop toggling the PIO buzzer with a period of 2*BUZZER_HALF_US_PERIOD 
-void StopBeepingPIOBuzzer(){
+//and go back to the normal alarm
+void HOT_PATH_FUNC(StopBeepingPIOBuzzer)(){
     if(PIO_Buzzing){
-        cancel_repeating_timer(&BuzzerPIOTimer);
+        CancelTimer(&BuzzerPIOTimer);
         //Make sure last state of the buzzer is off
         TurnOffPIOBuzzer();
         PIO_Buzzing = false;
+        NightBuzzer(false);
     }
+    EscalatePIOBuzzer(false);
     return;
 }
 
+//Switch between the normal alarm and the escalated one, which beeps faster
+//with a repeating chirp instead of a steady tone
+void HOT_PATH_FUNC(EscalatePIOBuzzer)(bool escalate){
+    static const BuzzerSweepType HOT_PATH_DATA chirp = {BUZZER_ESCALATED_LOW_HZ, BUZZER_ESCALATED_HIGH_HZ, BUZZER_FULL_DUTY, BUZZER_FULL_DUTY, BUZZER_ESCALATED_HALF_PERIOD, true};
+    if(escalate == PIO_Escalated) return;
+    PIO_Escalated = escalate;
+    if(escalate){
+        StartBuzzerSweep(&chirp);
+    }else{
+        StopBuzzerSweep();
+        SetBuzzerTone(BUZZER_TONE_HZ, BUZZER_FULL_DUTY);
+    }
+    //Pick the beeping back up at the new rate
+    if(PIO_Buzzing){
+        uint32_t half_period = escalate ? BUZZER_ESCALATED_HALF_PERIOD : BUZZER_PIO_BEEP_HALF_PERIOD;
+        StartTimerMs(&BuzzerPIOTimer, half_period, half_period, &TogglePIOBuzzer, NULL);
+    }
+}
+
 //Cancel the repeating timer which toggles the BUZZER_PIN GPIO pin every BUZZER_HALF_US_PERIOD microseconds
 void TurnOffBuzzer(){
     cancel_repeating_timer(&BuzzerTimer);
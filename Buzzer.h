@@ -4,26 +4,53 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "build/Buzzer.pio.h"
+#include "TimerWheel.h"
+#include "BuzzerTiming.h"
 
 //Defines
 #define BUZZER_PIN                   22
 #define PIO_BUZZER_PIN               21      //Should not be the same as BUZZER_PIN
 #define BUZZER_HALF_US_PERIOD        159     // 318.00 us Period -> 3.1447 kHz frequency
 #define BUZZER_BEEP_HALF_PERIOD      2359    //Desiered period in ms (750) times 10^3 / 2*BUZZER_HALF_US_PERIOD
-#define BUZZER_PIO_BEEP_HALF_PERIOD  500     //Desiered beep period in ms
-#define PIO_BUZZER_HALF_PERIOD       19870   //PIO Clock Cycles to wait
+#define BUZZER_PIO_HZ                10000000    //PIO buzzer clock, 0.1us steps and tones down to about 80Hz
+#define BUZZER_TONE_HZ               3145    //Alarm tone, same 3.1447 kHz as the software buzzer
+#define BUZZER_FULL_DUTY             128     //Duty is out of 256, a 50% square wave is the loudest
+#define BUZZER_HIGH_OVERHEAD         2       //PIO cycles each half of a tone cycle takes on top of its loop count
+#define BUZZER_LOW_OVERHEAD          5
+#define BUZZER_MAX_LOOPS             0xFFFF
+#define BUZZER_SWEEP_STEP_US         1000    //How often a sweep retunes the tone
+#define BUZZER_ESCALATED_LOW_HZ      2500    //and chirp from here
+#define BUZZER_ESCALATED_HIGH_HZ     4000    //to here
+
+//Types
+//Linear sweep of the tone's frequency (chirps) and duty (volume ramps), 
+//either end can be the same to only sweep the other
+typedef struct BuzzerSweepStruct {
+    uint32_t    Start_Hz;
+    uint32_t    End_Hz;
+    uint8_t     Start_Duty;         // Out of 256
+    uint8_t     End_Duty;
+    uint32_t    Duration_MS;
+    bool        Repeat;             // Start over at the end instead of holding the end tone
+} BuzzerSweepType;
 
 //Function Prototypes
 
-void pio_pwm_set_period(PIO pio, uint sm, uint32_t period);
+uint32_t BuzzerToneWord(uint32_t frequency_hz, uint8_t duty);
+void SetBuzzerTone(uint32_t frequency_hz, uint8_t duty);
+void StartBuzzerSweep(const BuzzerSweepType* sweep);
+void StopBuzzerSweep();
+void BuzzerSweepCallback(TimerType* timer);
 void TurnOnPIOBuzzer();
 void TurnOffPIOBuzzer();
+void TogglePIOBuzzer(TimerType* timer);
 void InitializeBuzzer();
 bool BuzzerCallback(struct repeating_timer *t);
 void TurnOnBuzzer();
 void TurnOffBuzzer();
 void StartBeepingPIOBuzzer();
 void StopBeepingPIOBuzzer();
+void EscalatePIOBuzzer(bool escalate);
 void BuzzerTest(uint16_t ms_period);  
 
 
@@ -0,0 +1,11 @@
+#ifndef BUZZERTIMING_H
+#define BUZZERTIMING_H
+
+// The beep cadence on its own, away from Buzzer.h and its PIO program, so
+// tools/replay can beep at the same rate as the firmware
+
+//Defines
+#define BUZZER_PIO_BEEP_HALF_PERIOD  500     //Desiered beep period in ms
+#define BUZZER_ESCALATED_HALF_PERIOD 150     //Escalated beeps are this many ms on and off
+
+#endif
@@ -0,0 +1,126 @@
+#include "pico/stdlib.h"
+#include "Calibration.h"
+#include "AlarmState.h"
+#include "Sensors.h"
+#include "LoadCellADC.h"
+#include "Power.h"
+#include "Watchdog.h"
+
+// Globals
+RunningStatsType Empty_Stats[NUMBER_OF_ZONES];
+RunningStatsType Full_Stats[NUMBER_OF_ZONES];
+RunningStatsType Tare_Stats;
+CalibrationResultType Zone_Calibration[NUMBER_OF_ZONES];
+CalibrationResultType Tare_Result = CAL_NOT_RUN;
+static volatile CalibrationPhaseType Calibration_Phase = CAL_IDLE;
+static bool Empty_Learned = false;
+static bool Full_Learned = false;
+static uint32_t Calibration_Readings;                   // Zone reading count we last took a sample at
+
+// Kick off learning one distribution (or the tare), the main loop does
+// the sampling through CalibrationStep(). Returns false if one is running
+bool StartCalibration(CalibrationPhaseType phase){
+    if (Calibration_Phase != CAL_IDLE) return false;
+    // 16 buckets across the whole reading range
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (phase == CAL_EMPTY) ResetStats(&Empty_Stats[i], 0, ZONE_READING_BITS - 4);
+        if (phase == CAL_FULL) ResetStats(&Full_Stats[i], 0, ZONE_READING_BITS - 4);
+    }
+    if (phase == CAL_EMPTY) Empty_Learned = false;
+    if (phase == CAL_FULL) Full_Learned = false;
+    // Buckets of 4 counts (~1lb) centred on the current zero
+    if (phase == CAL_TARE) ResetStats(&Tare_Stats, Scale_Zero_Offset - 8 * 4, 2);
+
+    // The zones are only sampled at full speed
+    EnterFullPower();
+    ZoneStatsType stats;
+    GetZoneStats(&stats);
+    Calibration_Readings = stats.Readings;
+    Calibration_Phase = phase;
+    return true;
+}
+
+bool CalibratingQ(){
+    return Calibration_Phase != CAL_IDLE;
+}
+
+// Put each fitted zone's threshold in the middle of the gap between its 
+// empty and occupied distributions, with a quarter of the gap as hysteresis.
+// Zones whose distributions overlap are left alone
+static void ApplyCalibration(){
+    AlarmStateType state;
+    uint32_t saved_irq = LockAlarmState(&state);
+    if (state.In_Alarm_Window){
+        UnlockAlarmState(saved_irq);
+        for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++) Zone_Calibration[i] = CAL_LOCKED;
+        return;
+    }
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (!(ZONES_FITTED & ZONE_BIT(i))) continue;
+        float empty_edge = Empty_Stats[i].Mean + CALIBRATE_SIGMAS * StatsDeviation(&Empty_Stats[i]);
+        float full_edge = Full_Stats[i].Mean - CALIBRATE_SIGMAS * StatsDeviation(&Full_Stats[i]);
+        if (full_edge <= empty_edge){
+            Zone_Calibration[i] = CAL_OVERLAP;
+            continue;
+        }
+        state.Threshold[i] = (empty_edge + full_edge) / 2;
+        state.Scale_Sensitivity[i] = 100;
+        state.Hysteresis[i] = (full_edge - empty_edge) / 4;
+        Zone_Calibration[i] = CAL_SET;
+    }
+    PublishAlarmState(&state, saved_irq);
+    Retained_State_Dirty = true;
+}
+
+// Feed whichever phase is running, called every pass of the main loop
+void CalibrationStep(){
+    switch (Calibration_Phase){
+        case CAL_EMPTY:
+        case CAL_FULL: {
+            // Only take each decimated reading once
+            ZoneStatsType stats;
+            GetZoneStats(&stats);
+            if (stats.Readings == Calibration_Readings) return;
+            Calibration_Readings = stats.Readings;
+
+            uint16_t zones[NUMBER_OF_ZONES];
+            ReadZones(zones);
+            RunningStatsType* learning = (Calibration_Phase == CAL_EMPTY) ? Empty_Stats : Full_Stats;
+            for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+                AddStatsSample(&learning[i], zones[i]);
+            }
+            if (learning[0].Count < CALIBRATE_READINGS) return;
+
+            if (Calibration_Phase == CAL_EMPTY) Empty_Learned = true;
+            else Full_Learned = true;
+            Calibration_Phase = CAL_IDLE;
+            // Once both are known the thresholds can be set
+            if (Empty_Learned && Full_Learned) ApplyCalibration();
+            break;
+        }
+        case CAL_TARE: {
+            if (!Sensors[SENSOR_SCALE].ReadyQ()) return;
+            int32_t sample = Sensors[SENSOR_SCALE].Sample();
+            if (!Sensors[SENSOR_SCALE].PlausibleQ(sample)){
+                Tare_Result = CAL_NOISY;
+                Calibration_Phase = CAL_IDLE;
+                return;
+            }
+            AddStatsSample(&Tare_Stats, sample);
+            if (Tare_Stats.Count < TARE_SAMPLES) return;
+
+            // Only take the new zero if the bed was still the whole time
+            float max_deviation = (float) TARE_MAX_DEVIATION_LBS * SCALE_LBS_FACTOR / SCALE_LBS_COEFFICIENT;
+            if (StatsDeviation(&Tare_Stats) <= max_deviation){
+                Scale_Zero_Offset = Tare_Stats.Mean + 0.5f;
+                Tare_Result = CAL_SET;
+            }else{
+                Tare_Result = CAL_NOISY;
+            }
+            Calibration_Phase = CAL_IDLE;
+            break;
+        }
+        default:
+            break;
+    }
+}
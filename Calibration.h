@@ -0,0 +1,31 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include "pico/stdlib.h"
+#include "Stats.h"
+#include "PressureSensor.h"
+
+// Defines
+#define CALIBRATE_SECONDS           3           // How long to learn each of empty and occupied for
+#define CALIBRATE_READINGS          (CALIBRATE_SECONDS * ZONE_READING_HZ)
+#define CALIBRATE_SIGMAS            3           // Each distribution's edge is this many deviations from its mean
+#define TARE_SAMPLES                32          // ~3s of HX711 samples at 10 SPS
+#define TARE_MAX_DEVIATION_LBS      5           // Any noisier than this and someone is on the bed
+
+// Types
+typedef enum CalibrationPhaseEnum {CAL_IDLE, CAL_EMPTY, CAL_FULL, CAL_TARE} CalibrationPhaseType;
+typedef enum CalibrationResultEnum {CAL_NOT_RUN, CAL_SET, CAL_OVERLAP, CAL_NOISY, CAL_LOCKED} CalibrationResultType;
+
+// Globals
+extern RunningStatsType Empty_Stats[NUMBER_OF_ZONES];
+extern RunningStatsType Full_Stats[NUMBER_OF_ZONES];
+extern RunningStatsType Tare_Stats;
+extern CalibrationResultType Zone_Calibration[NUMBER_OF_ZONES];
+extern CalibrationResultType Tare_Result;
+
+// Function Prototypes
+bool StartCalibration(CalibrationPhaseType phase);
+bool CalibratingQ();
+void CalibrationStep();
+
+#endif
@@ -2,24 +2,45 @@
 #define COMMANDLIST_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include "pico/stdlib.h"
 #include "HC05.h"
 #include "hardware/rtc.h"
 #include <time.h>
 #include "pico/util/datetime.h"
 #include "PressureSensor.h"
-
-// Globals
-extern uint16_t Scale_Threshold;
-extern uint8_t Scale_Sensitivity;
-extern bool In_Alarm_Window;
-extern datetime_t Alarm_Window_Start;
-extern datetime_t Alarm_Window_Stop;
+#include "Sensors.h"
+#include "Boot.h"
+#include "Watchdog.h"
+#include "AlarmState.h"
+#include "Power.h"
+#include "Calibration.h"
+#include "LoadCellADC.h"
+#include "Trace.h"
+#include "Transport.h"
+#include "FwUpdate.h"
+#include "Rules.h"
+#include "Motion.h"
+#include "TimerWheel.h"
+#include "Timebase.h"
+#include "Latency.h"
+#include "ScaleFilter.h"
+#include "Jitter.h"
+#include "Nights.h"
+#include "HotPath.h"
+#include "hardware/clocks.h"
 
 
 // Defines 
-#define NUMBER_OF_COMMANDS          10
+#define NUMBER_OF_COMMANDS          27
 #define COMMAND_LENGTH              8              // in bytes 
+#define CMD_QUEUE_DEPTH             8              // Max commands accepted in one message
+#define CMD_RESPONSE_SIZE           2048           // Bytes buffered for one combined response
+#define CMD_HEADER_SIZE             48             // Room for one "#<index> <name> <status code> <status>" line
+#define CMD_TOO_MANY                "Too many commands in one message, the rest were ignored\n"
+#define CMD_SEPARATOR_Q(C)          ((C) == ';' || (C) == '\n' || (C) == '\r')
+#define CMD_SEND(DATA)              CommandRespond(DATA)
 
 // ==================== Application specific stuff ==================== 
 
@@ -50,6 +71,20 @@ typedef struct WindowStruct{
     SetClockType    EndTime;
 } WindowType;
 
+// Read 2*count hex digits from str into bytes, returns false if there aren't enough
+bool ParseHexBytes(const char* str, uint8_t* bytes, size_t count){
+    for (size_t i = 0; i < 2*count; i++){
+        char c = str[i] | 0x20;     // Lower case, digits are unchanged
+        int value;
+        if (c >= '0' && c <= '9') value = c - '0';
+        else if (c >= 'a' && c <= 'f') value = c - 'a' + 10;
+        else return false;
+        if (i % 2 == 0) bytes[i/2] = value << 4;
+        else bytes[i/2] |= value;
+    }
+    return true;
+}
+
 int str2int(const char* str, int len){
     int i;
     int ret = 0;
@@ -122,25 +157,56 @@ void TimeDifference(datetime_t t1, datetime_t t2, long* days_hours_minutes_secon
 // ====================================================================
 
 // Types
+// Status reported back for every command in a message
+typedef enum CMDStatusEnum {CMD_OK, CMD_UNKNOWN, CMD_BAD_ARGS, CMD_LOCKED, CMD_FAILED} CMDStatusType;
+const char* CMDStatusNames[] = {"OK", "UNKNOWN", "BAD_ARGS", "LOCKED", "FAILED"};
+
+// Callbacks get everything after the command name (including the
+// leading space) and the number of bytes in that argument string
 typedef struct CMD_Struct {
     char* CmdName;
-    void (*Callback)(void);
+    CMDStatusType (*Callback)(uint8_t* args, size_t len);
     char* Usage;
 } CMD_Type;
 
+// A single command found in a message, queued until the message is run
+typedef struct CMDQueueStruct {
+    uint8_t*    Start;
+    size_t      Length;
+} CMDQueueType;
+
 // Callback Function Declerations
-void Help_Callback(void);
-void Set_Clock_Callback(void);
-void Get_Clock_Callback(void);
-void Zero_Scale_Callback(void);
-void Get_Weight_Callback(void);
-void Set_Scale_Threshold(void);
-void Set_Scale_Sensitivity(void);
-void Set_Alarm_Callback(void);
-void Get_Alarm_Callback(void);
-void Clear_Alarm_Callback(void);
+CMDStatusType Help_Callback(uint8_t* args, size_t len);
+CMDStatusType Set_Clock_Callback(uint8_t* args, size_t len);
+CMDStatusType Get_Clock_Callback(uint8_t* args, size_t len);
+CMDStatusType Zero_Scale_Callback(uint8_t* args, size_t len);
+CMDStatusType Get_Weight_Callback(uint8_t* args, size_t len);
+CMDStatusType Set_Scale_Threshold(uint8_t* args, size_t len);
+CMDStatusType Set_Scale_Sensitivity(uint8_t* args, size_t len);
+CMDStatusType Set_Alarm_Callback(uint8_t* args, size_t len);
+CMDStatusType Get_Alarm_Callback(uint8_t* args, size_t len);
+CMDStatusType Clear_Alarm_Callback(uint8_t* args, size_t len);
+CMDStatusType Boot_Time_Callback(uint8_t* args, size_t len);
+CMDStatusType Power_Stats_Callback(uint8_t* args, size_t len);
+CMDStatusType Sensor_Status_Callback(uint8_t* args, size_t len);
+CMDStatusType Set_Zones_Callback(uint8_t* args, size_t len);
+CMDStatusType ADC_Stats_Callback(uint8_t* args, size_t len);
+CMDStatusType Calibrate_Callback(uint8_t* args, size_t len);
+CMDStatusType Trace_Callback(uint8_t* args, size_t len);
+CMDStatusType Trace_Dump_Callback(uint8_t* args, size_t len);
+CMDStatusType Fw_Update_Callback(uint8_t* args, size_t len);
+CMDStatusType Wake_Rule_Callback(uint8_t* args, size_t len);
+CMDStatusType Motion_Callback(uint8_t* args, size_t len);
+CMDStatusType Timers_Callback(uint8_t* args, size_t len);
+CMDStatusType Sync_Time_Callback(uint8_t* args, size_t len);
+CMDStatusType Latency_Callback(uint8_t* args, size_t len);
+CMDStatusType Jitter_Callback(uint8_t* args, size_t len);
+CMDStatusType Nights_Callback(uint8_t* args, size_t len);
+CMDStatusType BT_Idle_Callback(uint8_t* args, size_t len);
+void ClearAlarmWindow(void);
 void Enter_Alarm_Window(void);
 void Exit_Alarm_Window(void);
+void ScheduleAlarmWindow(void);
 
 // Command definitions 
 CMD_Type CommandLookup[NUMBER_OF_COMMANDS] = {
@@ -148,57 +214,197 @@ CMD_Type CommandLookup[NUMBER_OF_COMMANDS] = {
     {"HelpInfo",        &Help_Callback,                  "HelpInfo <Parameter_1>\n\nCalling HelpInfo with no parameters will list all available commands\n\nCalling HelpInfo with <Parameter_1> equal to the name of another function will give the usagae information for that function\n"},
     {"SetClock",        &Set_Clock_Callback,             "SetClock <Year> <Month> <Day> <Day of Week> <Hour> <Min> <Sec>\n\nEx: “SetClock 2023 01 14 6 15 45 00” sets the time to 3:45:00pm on Sat 14, Jan 2023\n"},
     {"GetClock",        &Get_Clock_Callback,             "GetClock\n\nReturns the current time the pi is set to.\n"},
-    //{"LoadZero",        &Zero_Scale_Callback,            "LoadZero\n\nZeros the scale by setting current value to a global offset.\n"},
-    {"SetUpper",        &Set_Scale_Threshold,            "SetUpper\n\nSets the upper bound for weight allowed during alarm period.\n"},
-    {"SetTolTo",        &Set_Scale_Sensitivity,          "SetTolTo\n\nSets the sensitivity of the weight detection during alarm period. The alarm will trigger when the current weight equals tol % of the weight set by SetUpper.\n\n <Tol> = a percentage between 0 and 99.\n"},
-    {"WeighNow",        &Get_Weight_Callback,            "WeighNow\n\n Measures and returns the current weight being read by the load cells.\n"},
+    {"LoadZero",        &Zero_Scale_Callback,            "LoadZero\n\nZeros the load cell by averaging it for a few seconds while the bed is empty. Calibrate with no parameters shows how it went.\n"},
+    {"SetUpper",        &Set_Scale_Threshold,            "SetUpper <Zone>\n\nSets the upper bound for weight allowed during alarm period to the zone's current weight. Without <Zone> every zone that counts (see SetZones) is set.\n"},
+    {"SetTolTo",        &Set_Scale_Sensitivity,          "SetTolTo <Tol> <Zone>\n\nSets the sensitivity of the weight detection during alarm period. The alarm will trigger when the current weight equals tol % of the weight set by SetUpper.\n\n <Tol> = a percentage between 0 and 99.\n <Zone> = the zone to set, leave it off to set every zone that counts.\n"},
+    {"WeighNow",        &Get_Weight_Callback,            "WeighNow\n\n Measures and returns the current weight being read in each zone.\n"},
+    {"SetZones",        &Set_Zones_Callback,             "SetZones <Zone>\n\nSets which zone has to be pressed to count as in bed. Use \"any\" (or leave <Zone> off) for any zone with a sensor fitted.\n"},
     {"SetAlarm",        &Set_Alarm_Callback,             "SetAlarm <Year1> <Month1> <Day1> <Day of Week 1> <Hour1> <Min1> <Sec1> <Year2> <Month2> <Day2> <Day of Week 2> <Hour2> <Min2> <Sec2>\n\nEx: “SetAlarm 2023 01 14 6 15 45 00 2023 01 14 6 15 30” sets an alarm to start at 3:45:00pm on Sat 14, Jan 2023 and end 30 seconds later\n"},
     {"GetAlarm",        &Get_Alarm_Callback,             "GetAlarm\n\nReturns information about any alarms that are set.\n"},
-    {"ClrAlarm",        &Clear_Alarm_Callback,           "ClrAlarm\n\nClears any alarms that may be set\n"}
+    {"ClrAlarm",        &Clear_Alarm_Callback,           "ClrAlarm\n\nClears any alarms that may be set\n"},
+    {"BootTime",        &Boot_Time_Callback,             "BootTime\n\nReturns how long after reset each startup step finished, including the first weight sample and commands being accepted.\n"},
+    {"PwrStats",        &Power_Stats_Callback,           "PwrStats\n\nReturns the time spent at full and low clock speed (and how much of it asleep) and how long waking back up to full speed takes.\n"},
+    {"SensStat",        &Sensor_Status_Callback,         "SensStat\n\nReturns the last reading, occupancy confidence (0-255) and health of each bed sensor, the fused confidence the alarm uses and the worst time each sensor took to read.\n"},
+    {"ADCStats",        &ADC_Stats_Callback,             "ADCStats\n\nReturns the zone ADC's sample and reading rates and how much of the CPU decimating the samples takes, including the worst case per block and any samples dropped.\n"},
+    {"Calibrate",       &Calibrate_Callback,             "Calibrate <Phase>\n\nLearns what each zone reads with the bed empty (<Phase> = empty) and occupied (<Phase> = full) over a few seconds each. Once both are learned every zone's threshold is set in the middle of the gap between them, with hysteresis so it doesn't flicker. With no <Phase> returns what has been learned so far.\n"},
+    {"Trace",           &Trace_Callback,                 "Trace <on/off>\n\nStarts (throwing away the last one) or stops recording a trace of the sensor readings, settings, alarm windows and received messages for tools/replay. Holds about a night.\n"},
+    {"TraceDump",       &Trace_Dump_Callback,            "TraceDump <Index>\n\nReturns the trace, one record per line, starting at record <Index> (0 if left off). Over USB, outside the alarm window, the whole rest of the trace is streamed back as the link takes it. Ends with #NEXT <Index> when there is more to fetch or #DONE <Records> <Dropped>. Stop the trace first.\n"},
+    {"FwUpdate",        &Fw_Update_Callback,             "FwUpdate <Action>\n\nStreams a new firmware image in over this link and installs it. Refused while the alarm window is open.\n\n begin <Bytes> <SHA-256 hex> erases room for the image, send blocks once FwUpdate says receiving.\n block <Index> <CRC-32 hex> <Base64> sends 256 bytes of the image, answered with ACK, BUSY (send it again), BAD (CRC) or NEXT <Index>. Up to 8 blocks can be in flight.\n end checks the whole image's hash, installs it and restarts.\n abort gives up.\n\nWith no <Action> returns the update's progress and throughput.\n"},
+    {"WakeRule",        &Wake_Rule_Callback,             "WakeRule <Action> <Condition>\n\nAdds a rule for when the alarm goes off, checked every time the sensors are read in the alarm window. The first rule added replaces the default \"beep inbed\". Up to 8 rules, the strongest action that holds wins.\n\n <Action> = beep or escalate (faster beeps with a chirp).\n <Condition> = inbed, human (breathing or moving, see Motion), zone <Zone>|any, weight > <Lbs>, weight < <Lbs>, confidence > <0-255> or after <Seconds> into the window, joined with and, or, not and ( ). Follow any of them with for <Seconds> to need it to hold that long.\n\nEx: \"WakeRule escalate inbed for 60\" or \"WakeRule beep zone any and after 300\"\n\nWakeRule clear goes back to the default. With no parameters lists the rules and how much work they take per reading.\n"},
+    {"Motion",          &Motion_Callback,                "Motion <bench>\n\nReturns what core 1's breathing and movement detector made of the last ~17s of the bed sensor: how much it changed, the share in the breathing band (0.1-0.5Hz) and the breathing rate, whether anyone is moving, and the presence score the human wake rule condition reads. Also how many cycles each analysis takes on core 1 against its budget.\n\nMotion bench times one analysis on core 0 with interrupts off.\n"},
+    {"Timers",          &Timers_Callback,                "Timers\n\nReturns how many timers (beeps, debounce, message gaps, window boundaries) are waiting on the timer wheel, how many have run, how often its hardware alarm went off and the latest any timer has run after it was due.\n"},
+    {"SyncTime",        &Sync_Time_Callback,             "SyncTime <T1> <T4>\n\nCorrects the clock NTP style, to the microsecond rather than SetClock's whole seconds. Times are microseconds since 1970-01-01 00:00:00 in the clock's time zone. <T1> is when the host sent this message and <T4> when the reply to its last SyncTime started coming back (0 or left off the first time). Use end for <T1> to finish without starting another exchange. Send a burst of a few, the quickest round trip in each burst is the one used, and bursts 10 min or more apart also correct the crystal's drift. Refused while the alarm window is open.\n\nWith no parameters returns the last exchange's offset and round trip, the drift and the clock to the microsecond.\n"},
+    {"Latency",         &Latency_Callback,               "Latency <Trigger>\n\nReturns the histogram of how long the buzzer took to start after the bed read occupied in the alarm window, timed by a PIO state machine from a rising edge on GPIO 16 to one on the buzzer pin.\n\n <Trigger> = adc (the default) raises GPIO 16 on the first zone reading over its trip point, gpio leaves GPIO 16 as an input for a test rig that drives it along with the bed sensor, reset clears the histogram.\n"},
+    {"Jitter",          &Jitter_Callback,                "Jitter\n\nTimes how many cycles the core takes to get into an interrupt handler in SRAM, one in flash and the timer wheel's own alarm handler (from wherever this build put it), with the flash cache warm and just flushed, and says whether this build runs its interrupt handlers and sensing loop from SRAM. Cold flash is what a handler left in flash can cost.\n"},
+    {"Nights",          &Nights_Callback,                "Nights\n\nReturns a summary of each of the last 14 alarm windows, newest first: when it opened, how long it was, time in bed, times out of bed, how long until the first time out, how long the alarm beeped and the longest time back in bed after getting out. Times are minutes:seconds. An open window is shown so far.\n"},
+    {"BTIdle",          &BT_Idle_Callback,               "BTIdle <Minutes>\n\nSets how long the Bluetooth module stays powered after the last connection or command, 0 keeps it on all the time. It still powers up for an advertising slot every 30 min, ahead of each alarm window and when the reset button is pressed. Kept across a watchdog reset. With no <Minutes> returns the current setting.\n"}
 };
 
+// ======================== Command Dispatching ======================== 
+
+char Command_Response[CMD_RESPONSE_SIZE];
+size_t Command_Response_Length = 0;
+TransportIdType Command_Transport = TRANSPORT_BT;      // Where the message being run came from
+bool Command_Streaming = false;
+
+// Append a string to the response for the message currently being run. On
+// bulk links a full buffer is sent on ahead rather than cutting the response off
+void CommandRespond(const char* str){
+    while(*str){
+        if (Command_Response_Length >= CMD_RESPONSE_SIZE - 1){
+            if (!Command_Streaming) return;
+            Command_Response[Command_Response_Length] = '\0';
+            // Stop streaming if the other end stops reading
+            Command_Streaming = TransportSendAll(Command_Transport, Command_Response);
+            Command_Response_Length = 0;
+        }
+        Command_Response[Command_Response_Length++] = *str++;
+    }
+}
+
+// Returns true iff the len bytes in str are exactly the command name
+bool CommandNameMatch(const uint8_t* str, size_t len, const char* name){
+    size_t name_length = strlen(name);
+    if (len != name_length) return false;
+    return strncmp((const char*) str, name, name_length) == 0;
+}
+
+// Find the command named by the first word of cmd and run it,
+// returning the status the callback reports
+CMDStatusType RunCommand(uint8_t* cmd, size_t len, const char** name){
+    // The name runs until the first space (or the end of the command)
+    size_t name_length = 0;
+    while (name_length < len && cmd[name_length] != ' ') name_length++;
+
+    for (uint8_t i = 0; i < NUMBER_OF_COMMANDS; i++){
+        if (CommandNameMatch(cmd, name_length, CommandLookup[i].CmdName)){
+            *name = CommandLookup[i].CmdName;
+            // Hand everything after the name (leading space included) to the callback
+            return CommandLookup[i].Callback(cmd + name_length, len - name_length);
+        }
+    }
+    *name = "?";
+    CMD_SEND("Unknown command, for a list of commands type HelpInfo\n");
+    return CMD_UNKNOWN;
+}
+
+// Split a message into its ';' or new line separated commands, queue them,
+// run them in order and send back one combined response. When the message
+// holds more than one command each command's output is preceded by a
+// "#<index> <name> <status code> <status>" line and followed by "#END <count>".
+// A message starting with '#' (from a program like tools/snooze rather than a
+// person) gets them even for a single command, so the end of its response can
+// always be found. The response goes back out on the transport the message came in on
+void RunCommandMessage(uint8_t* msg, size_t len, TransportIdType transport){
+    CMDQueueType queue[CMD_QUEUE_DEPTH];
+    uint8_t queued = 0;
+    bool framed = (len > 0 && msg[0] == '#');
+    size_t i = framed ? 1 : 0;
+
+    // Keep a copy for tools/replay before it gets split up
+    TraceMessage(msg, len);
+
+    // Queue up every non-empty command in the message
+    while (i < len && queued < CMD_QUEUE_DEPTH){
+        // Skip separators and any spaces before the command name
+        while (i < len && (CMD_SEPARATOR_Q(msg[i]) || msg[i] == ' ')) i++;
+        if (i >= len) break;
+        queue[queued].Start = &msg[i];
+        while (i < len && !CMD_SEPARATOR_Q(msg[i])) i++;
+        queue[queued].Length = &msg[i] - queue[queued].Start;
+        // Terminate each command so callbacks can treat their args as strings
+        if (i < len) msg[i++] = '\0';
+        queued++;
+    }
+    // A full queue followed by nothing but separators isn't too many
+    while (i < len && (CMD_SEPARATOR_Q(msg[i]) || msg[i] == ' ')) i++;
+    bool too_many = (i < len);
+
+    Command_Response_Length = 0;
+    Command_Transport = transport;
+    framed = framed || queued > 1;
+    // The headers are slotted in after each command runs, so only lone unframed
+    // commands can stream. Never in the alarm window, sending blocks the main
+    // loop until the link takes it so a long reply is cut short there instead
+    Command_Streaming = !framed && (queued == 1) && Transports[transport].Bulk && !InAlarmWindowQ();
+    char header[CMD_HEADER_SIZE];
+    for (uint8_t q = 0; q < queued; q++){
+        const char* name;
+        if (framed){
+            // Reserve the header's spot now and fill it in once the status is known
+            size_t header_index = Command_Response_Length;
+            CMDStatusType status = RunCommand(queue[q].Start, queue[q].Length, &name);
+            snprintf(header, sizeof(header), "#%d %s %d %s\n", q + 1, name, status, CMDStatusNames[status]);
+            size_t header_length = strlen(header);
+            // Cut the output short if it has to be so this header, the ones
+            // still to come and the end of the response always fit
+            size_t reserve = (queued - q) * CMD_HEADER_SIZE + sizeof(CMD_TOO_MANY);
+            Command_Response_Length = MIN(Command_Response_Length, CMD_RESPONSE_SIZE - 1 - header_length - reserve);
+            memmove(&Command_Response[header_index + header_length], &Command_Response[header_index], Command_Response_Length - header_index);
+            memcpy(&Command_Response[header_index], header, header_length);
+            Command_Response_Length += header_length;
+        }else{
+            RunCommand(queue[q].Start, queue[q].Length, &name);
+        }
+    }
+    // Room for both was kept back above, the warning goes inside the frame
+    if (too_many){
+        CMD_SEND(CMD_TOO_MANY);
+    }
+    if (framed){
+        snprintf(header, sizeof(header), "#END %d\n", queued);
+        CMD_SEND(header);
+    }
+
+    // Commands may have changed the alarm state, have the main loop mirror it
+    Retained_State_Dirty = true;
+
+    // Send everything back in one go
+    Command_Response[Command_Response_Length] = '\0';
+    if (Command_Streaming) TransportSendAll(transport, Command_Response);
+    else TransportSend(transport, Command_Response);
+    Command_Response_Length = 0;
+    Command_Streaming = false;
+}
+
 // Callback Functions
-void Help_Callback(void){
-    uint8_t bufferarray[COMMAND_LENGTH];
-    uint8_t* readbuffer = &bufferarray[0];
-    // Read BT_CMD_LENGTH bytes from the FIFO
-    uart_read_blocking_within_us(BLUETOOTH, readbuffer, 1+COMMAND_LENGTH, BT_READ_TIMEOUT_US, UART_BYTE_DELAY);
-    //Scrap first byte, assumed to be a space between the words
-    readbuffer++;
-    // See if first (COMMAND_LENGTH) bytes of the RX data correspond
-    // to a command in the CommandLookup table and send the cmd info text
-    for (uint8_t i; i < NUMBER_OF_COMMANDS; i++){
-        if (strncmp((char*) readbuffer, CommandLookup[i].CmdName, COMMAND_LENGTH) == 0){
-            BLUETOOTH_SEND(CommandLookup[i].Usage);
-            return;
+CMDStatusType Help_Callback(uint8_t* args, size_t len){
+    // Scrap first byte, assumed to be a space between the words
+    if (len > 1){
+        // See if the parameter corresponds to a command in the 
+        // CommandLookup table and send the cmd info text
+        for (uint8_t i = 0; i < NUMBER_OF_COMMANDS; i++){
+            if (CommandNameMatch(args + 1, len - 1, CommandLookup[i].CmdName)){
+                CMD_SEND(CommandLookup[i].Usage);
+                return CMD_OK;
+            }
         }
     }
     // If none of the commands matched print out all commands
-    BLUETOOTH_SEND("Available Commands:\n");
-    for (uint8_t i; i < NUMBER_OF_COMMANDS; i++){
-        BLUETOOTH_SEND("    ");
-        BLUETOOTH_SEND(CommandLookup[i].CmdName);
-        BLUETOOTH_SEND("\n");
+    CMD_SEND("Available Commands:\n");
+    for (uint8_t i = 0; i < NUMBER_OF_COMMANDS; i++){
+        CMD_SEND("    ");
+        CMD_SEND(CommandLookup[i].CmdName);
+        CMD_SEND("\n");
     }
+    CMD_SEND("Separate commands with ';' or new lines to send several at once\n");
 
-    return;
+    return CMD_OK;
 }
 
-void Set_Clock_Callback(void){
+CMDStatusType Set_Clock_Callback(uint8_t* args, size_t len){
     // First make sure we're not currently in an alarm window
-    if (In_Alarm_Window){
-        BLUETOOTH_SEND("Unable to change clock time while in alarm window\n");
-        return;
+    if (InAlarmWindowQ()){
+        CMD_SEND("Unable to change clock time while in alarm window\n");
+        return CMD_LOCKED;
+    }
+    if (len < sizeof(SetClockType)){
+        CMD_SEND("Clock not set\n");
+        return CMD_BAD_ARGS;
     }
-
-    uint16_t buffer_size = 24;
-    uint8_t bufferarray[buffer_size];
-    uint8_t* readbuffer = &bufferarray[0];
-    // Read from FIFO until we hit the first new line char or time out or fill buffer
-    size_t last_index = uart_read_until_within_us(BLUETOOTH, readbuffer, 10, 1, buffer_size, BT_READ_TIMEOUT_US, UART_BYTE_DELAY);
 
     // Use a struture to split up the bytes into meaningfull chunks
-    SetClockType* extracted_bytes = (SetClockType*) (readbuffer);
+    SetClockType* extracted_bytes = (SetClockType*) (args);
 
     // Next build a proper datetime_t struct from the structure of bytes
     datetime_t time_struct = {
@@ -211,18 +417,23 @@ void Set_Clock_Callback(void){
             .sec   = str2int((char*) &(extracted_bytes->sec),2)
     };
 
-    // Finally set the RTC using the info in the time structure
-    rtc_set_datetime(&time_struct);
+    // Finally set the RTC and timebase using the info in the time structure
+    if (!SetTimebase(&time_struct)){
+        CMD_SEND("Clock not set\n");
+        return CMD_BAD_ARGS;
+    }
     // and give the clock time to update
     busy_wait_us(64);
+    // The window boundaries just moved relative to the timer
+    ScheduleAlarmWindow();
     // Send back clock value
-    BLUETOOTH_SEND("Clock time is now: ");
-    Get_Clock_Callback();
+    CMD_SEND("Clock time is now: ");
+    Get_Clock_Callback(NULL, 0);
 
-    return;
+    return CMD_OK;
 }
 
-void Get_Clock_Callback(void){
+CMDStatusType Get_Clock_Callback(uint8_t* args, size_t len){
     // Declare a time structure and string
     datetime_t time_struct = {
             .year  = 0,
@@ -240,103 +451,214 @@ void Get_Clock_Callback(void){
     // Populate the string from the time_struct
     datetime_to_str(datetime_str, sizeof(datetime_buf), &time_struct);
     // Finally send back the string
-    BLUETOOTH_SEND(datetime_str);
-    BLUETOOTH_SEND("\n");
-    return;
+    CMD_SEND(datetime_str);
+    CMD_SEND("\n");
+    return CMD_OK;
 }
 
-void Zero_Scale_Callback(void){
-    return;
+CMDStatusType Zero_Scale_Callback(uint8_t* args, size_t len){
+    if (InAlarmWindowQ()){
+        CMD_SEND("Unable to zero the scale in alarm window\n");
+        return CMD_LOCKED;
+    }
+    if (!StartCalibration(CAL_TARE)){
+        CMD_SEND("Calibration already running, try again in a few seconds\n");
+        return CMD_FAILED;
+    }
+    CMD_SEND("Zeroing, keep the bed empty for a few seconds\n");
+    return CMD_OK;
 }
 
-// Sends raw scale value back over bluetooth
-void Get_Weight_Callback(void){
-    BLUETOOTH_SEND("Measuring weight, please wait...\n");
-    // Grab the current value on the ADC
-    uint16_t Weight = adc_read();
+// Reads an optional zone number from the args. No zone gives default_mask,
+// otherwise the zone's bit. Returns false if it isn't a fitted zone
+bool ParseZone(const uint8_t* args, size_t len, uint8_t default_mask, uint8_t* mask){
+    if (len == 0){
+        *mask = default_mask;
+        return true;
+    }
+    if (len != 1 || args[0] < '0' || args[0] >= '0' + NUMBER_OF_ZONES) return false;
+    *mask = ZONE_BIT(args[0] - '0');
+    return (*mask & ZONES_FITTED) != 0;
+}
 
-    // Convert the output back to a string we can send over BT
-    char sendbuffer[12];
-    sprintf(sendbuffer, "%d", Weight);
+// Sends raw zone values back over bluetooth
+CMDStatusType Get_Weight_Callback(uint8_t* args, size_t len){
+    CMD_SEND("Measuring weight, please wait...\n");
+    // Grab a fresh value for every zone
+    uint16_t Weight[NUMBER_OF_ZONES];
+    if (!MeasureZones(Weight)){
+        CMD_SEND("The zone ADC isn't producing readings\n");
+        return CMD_FAILED;
+    }
 
-    // Send value back over BT
-    BLUETOOTH_SEND("The current weight value is: ");
-    BLUETOOTH_SEND(sendbuffer);
-    BLUETOOTH_SEND(" out of 4096\n");
-    return;
+    // Send each fitted zone's value back over BT
+    char sendbuffer[80];
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (!(ZONES_FITTED & ZONE_BIT(i))) continue;
+        snprintf(sendbuffer, sizeof(sendbuffer), "Zone %d weight value is: %d out of %lu\n", i, Weight[i], ZONE_READING_MAX + 1);
+        CMD_SEND(sendbuffer);
+    }
+    // The load cell's filter is fed whenever the main loop finds a sample
+    // ready, which between windows is only as often as something wakes it,
+    // so say how old the newest sample in it is
+    if (ScaleFilterReadyQ()){
+        int32_t centilbs = Scale_Filter.Weight_Centilbs;
+        uint64_t age_ms = (time_us_64() - Sensor_Status[SENSOR_SCALE].Last_Sample_US) / 1000;
+        snprintf(sendbuffer, sizeof(sendbuffer), "Load cell: %s%ld.%02ld lbs, zero %ld (tracked %+ld), %llu ms old\n", (centilbs < 0) ? "-" : "", labs(centilbs) / 100, labs(centilbs) % 100, Scale_Filter.Zero, Scale_Filter.Tracked, age_ms);
+        CMD_SEND(sendbuffer);
+    }
+    return CMD_OK;
 }
 
-void Set_Scale_Threshold(void){
-    // First make sure we're not currently in an alarm window
-    if (In_Alarm_Window){
-        BLUETOOTH_SEND("Unable to change alarm weight threshold while in alarm window\n");
-        return;
+CMDStatusType Set_Scale_Threshold(uint8_t* args, size_t len){
+    CMD_SEND("Measuring weight, please wait...\n");
+    uint16_t Weight[NUMBER_OF_ZONES];
+    if (!MeasureZones(Weight)){
+        CMD_SEND("Threshold not set, the zone ADC isn't producing readings\n");
+        return CMD_FAILED;
     }
 
-    BLUETOOTH_SEND("Measuring weight, please wait...\n");
-    uint16_t Weight = adc_read();
+    // Make sure we're not currently in an alarm window, 
+    // holding the lock so the window can't open on us
+    AlarmStateType state;
+    uint32_t saved_irq = LockAlarmState(&state);
+    if (state.In_Alarm_Window){
+        UnlockAlarmState(saved_irq);
+        CMD_SEND("Unable to change alarm weight threshold while in alarm window\n");
+        return CMD_LOCKED;
+    }
+    // Scrap the space in front of the zone
+    uint8_t mask;
+    if (!ParseZone(args + 1, (len > 0) ? len - 1 : 0, state.Zone_Mask, &mask)){
+        UnlockAlarmState(saved_irq);
+        CMD_SEND("Threshold not set, no such zone\n");
+        return CMD_BAD_ARGS;
+    }
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (mask & ZONE_BIT(i)) state.Threshold[i] = Weight[i];
+    }
+    PublishAlarmState(&state, saved_irq);
 
-    Threshold = Weight;
     // Tell user everything went fine (We're optimists here)
-    BLUETOOTH_SEND("Threshold set\n");
-    return;
+    CMD_SEND("Threshold set\n");
+    return CMD_OK;
 }
 
-void Set_Scale_Sensitivity(void){
-    // First make sure we're not currently in an alarm window
-    if (In_Alarm_Window){
-        BLUETOOTH_SEND("Unable to change alarm tolerance in alarm window\n");
-        return;
+CMDStatusType Set_Scale_Sensitivity(uint8_t* args, size_t len){
+    // Scrap first value in the args as it's assumed to be a space 
+    // and expect one or two digits after it, then maybe a zone
+    size_t digits = 0;
+    while (1 + digits < len && args[1 + digits] != ' ') digits++;
+    if (digits < 1 || digits > 2){
+        CMD_SEND("Tolerance not set\n");
+        return CMD_BAD_ARGS;
     }
+    size_t zone_start = (1 + digits < len) ? 2 + digits : len;
 
-    uint16_t buffer_size = 4;
-    uint8_t readbuffer[buffer_size];
-    // Read from FIFO until we hit the first \n char or time out or fill buffer
-    size_t last_index = uart_read_until_within_us(BLUETOOTH,(char*) &readbuffer, 10, 1, buffer_size, BT_READ_TIMEOUT_US, UART_BYTE_DELAY);
-    // Scrap first value in read buffer as it's assumed to be a space 
-    // and set tolerance global to value we read
-    Scale_Sensitivity = 100 - str2int((char*) (&readbuffer + 1), last_index - 2);
+    // Make sure we're not currently in an alarm window
+    AlarmStateType state;
+    uint32_t saved_irq = LockAlarmState(&state);
+    if (state.In_Alarm_Window){
+        UnlockAlarmState(saved_irq);
+        CMD_SEND("Unable to change alarm tolerance in alarm window\n");
+        return CMD_LOCKED;
+    }
+    uint8_t mask;
+    if (!ParseZone(args + zone_start, len - zone_start, state.Zone_Mask, &mask)){
+        UnlockAlarmState(saved_irq);
+        CMD_SEND("Tolerance not set, no such zone\n");
+        return CMD_BAD_ARGS;
+    }
+    // Set tolerance to value we read
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (mask & ZONE_BIT(i)) state.Scale_Sensitivity[i] = 100 - str2int((char*) (args + 1), digits);
+    }
+    PublishAlarmState(&state, saved_irq);
 
-    BLUETOOTH_SEND("Tolerance set\n");
+    CMD_SEND("Tolerance set\n");
 
-    return;
+    return CMD_OK;
+}
+
+TimerType Window_Timer;     // Opens and closes the alarm window
+
+// Timer callback for both window boundaries. If the clock was stepped
+// back since the timer was set it's just set again
+// Runs from the timer wheel's interrupt but stays in flash, it's twice a
+// night and the clock speed and bookkeeping it gets into are too (see HotPath.h)
+void Window_Timer_Callback(TimerType* timer){
+    AlarmStateType state;
+    ReadAlarmState(&state);
+    int64_t now = WallClockUs();
+    if (!state.In_Alarm_Window && now >= DatetimeToWallUs(&state.Alarm_Window_Start)){
+        Enter_Alarm_Window();
+    }else if (state.In_Alarm_Window && now >= DatetimeToWallUs(&state.Alarm_Window_Stop)){
+        Exit_Alarm_Window();
+    }else{
+        ScheduleAlarmWindow();
+    }
+}
+
+// Set the window timer for whichever boundary comes next, the start or (once
+// it's open) the stop. Called whenever the window or the clock changes
+void ScheduleAlarmWindow(void){
+    AlarmStateType state;
+    ReadAlarmState(&state);
+    datetime_t* boundary = state.In_Alarm_Window ? &state.Alarm_Window_Stop : &state.Alarm_Window_Start;
+    if (boundary->year == 0){
+        CancelTimer(&Window_Timer);
+        return;
+    }
+    // To the microsecond on the timebase, not the RTC's whole seconds
+    StartTimerAt(&Window_Timer, LocalUsAt(DatetimeToWallUs(boundary)), 0, &Window_Timer_Callback, NULL);
 }
 
 void Enter_Alarm_Window(void){
-    // Set alarm window global
-    In_Alarm_Window = true;
-    // Set up new alarm to close window later
-    rtc_set_alarm(&Alarm_Window_Stop, &Exit_Alarm_Window);
+    // Get back to full speed before anything else
+    EnterFullPower();
+    // Open the alarm window
+    AlarmStateType state;
+    uint32_t saved_irq = LockAlarmState(&state);
+    state.In_Alarm_Window = true;
+    PublishAlarmState(&state, saved_irq);
+    Retained_State_Dirty = true;
+    // Set the window timer to close the window later
+    ScheduleAlarmWindow();
+    // The sensing loop starts fast, not from last window's pace
+    SensorsWindowOpened();
+    // Crossings from here on are timed to the buzzer
+    LatencyWindow(true);
+    // Start tonight's summary
+    NightStart();
     return;
 }
 void Exit_Alarm_Window(void){
-    // Clear alarm window global
-    In_Alarm_Window = false;
-    Clear_Alarm_Callback();
+    LatencyWindow(false);
+    NightEnd();
+    // Close the alarm window and clear it
+    ClearAlarmWindow();
+    Retained_State_Dirty = true;
     return;
 }
 
-void Set_Alarm_Callback(void){
+CMDStatusType Set_Alarm_Callback(uint8_t* args, size_t len){
     // First make sure we're not currently in an alarm window
-    if (In_Alarm_Window){
-        BLUETOOTH_SEND("Unable to change alarm while in alarm window\n");
-        return;
+    if (InAlarmWindowQ()){
+        CMD_SEND("Unable to change alarm while in alarm window\n");
+        return CMD_LOCKED;
+    }
+    if (len < sizeof(WindowType)){
+        CMD_SEND("Alarm not set\n");
+        return CMD_BAD_ARGS;
     }
-
-    // Store old alarm values incase we need to revert
-    datetime_t Alarm_Window_Start_old = Alarm_Window_Start;
-    datetime_t Alarm_Window_Stop_old = Alarm_Window_Stop;
-
-    uint16_t buffer_size = 48;
-    uint8_t bufferarray[buffer_size];
-    uint8_t* readbuffer = &bufferarray[0];
-    // Read from FIFO until we hit the first new line char or time out or fill buffer
-    size_t last_index = uart_read_until_within_us(BLUETOOTH, readbuffer, 10, 1, buffer_size, BT_READ_TIMEOUT_US, UART_BYTE_DELAY);
 
     // Use a struture to split up the bytes into meaningfull chunks
-    WindowType* extracted_bytes = (WindowType*) (readbuffer);
+    WindowType* extracted_bytes = (WindowType*) (args);
 
-    // Next build a proper datetime_t structs from the structures of bytes
+    // Next build proper datetime_t structs from the structures of bytes,
+    // nothing is shared until they have been checked
+    datetime_t Alarm_Window_Start;
+    datetime_t Alarm_Window_Stop;
     Alarm_Window_Start.year  = str2int((char*) &(extracted_bytes->StartTime.year),4);
     Alarm_Window_Start.month = str2int((char*) &(extracted_bytes->StartTime.month),2);
     Alarm_Window_Start.day   = str2int((char*) &(extracted_bytes->StartTime.day),2);
@@ -365,47 +687,59 @@ void Set_Alarm_Callback(void){
     };
     rtc_get_datetime(&current_time);
     if(!TimeCompare(current_time,Alarm_Window_Start)){
-        // If not then revert times back, alert, and return
-        Alarm_Window_Start = Alarm_Window_Start_old;
-        Alarm_Window_Stop = Alarm_Window_Stop_old;
-        BLUETOOTH_SEND("Alarm not set\n");
-        BLUETOOTH_SEND("Start time must be after current time\n");
-        return;
+        // If not then alert and return
+        CMD_SEND("Alarm not set\n");
+        CMD_SEND("Start time must be after current time\n");
+        return CMD_BAD_ARGS;
     }
     // Make sure end time is greater than start time
      if(!TimeCompare(Alarm_Window_Start,Alarm_Window_Stop)){
-        // If not then revert times back, alert, and return
-        Alarm_Window_Start = Alarm_Window_Start_old;
-        Alarm_Window_Stop = Alarm_Window_Stop_old;
-        BLUETOOTH_SEND("Alarm not set\n");
-        BLUETOOTH_SEND("End time must be after start time\n");
-        return;
+        // If not then alert and return
+        CMD_SEND("Alarm not set\n");
+        CMD_SEND("End time must be after start time\n");
+        return CMD_BAD_ARGS;
     }
     // Prevent setting a window that is greater than MAX_ALARM_WINDOW
     if(TimeDifferenceSec(Alarm_Window_Start,Alarm_Window_Stop) > MAX_ALARM_WINDOW){
-        // If not then revert times back, alert, and return
-        Alarm_Window_Start = Alarm_Window_Start_old;
-        Alarm_Window_Stop = Alarm_Window_Stop_old;
-        BLUETOOTH_SEND("Alarm not set\n");
-        BLUETOOTH_SEND(MAX_ALARM_MESSAGE);
-        return;
+        // If not then alert and return
+        CMD_SEND("Alarm not set\n");
+        CMD_SEND(MAX_ALARM_MESSAGE);
+        return CMD_BAD_ARGS;
+    }
+
+    // Store the new window, unless it opened while we were checking
+    AlarmStateType state;
+    uint32_t saved_irq = LockAlarmState(&state);
+    if (state.In_Alarm_Window){
+        UnlockAlarmState(saved_irq);
+        CMD_SEND("Unable to change alarm while in alarm window\n");
+        return CMD_LOCKED;
     }
+    state.Alarm_Window_Start = Alarm_Window_Start;
+    state.Alarm_Window_Stop = Alarm_Window_Stop;
+    PublishAlarmState(&state, saved_irq);
 
-    // Set an alarm to fire when we hit start time
-    // the call back will then set a new alarm for stop time when it is called
-    rtc_set_alarm(&Alarm_Window_Start, &Enter_Alarm_Window);
+    // Set the window timer for the start time,
+    // it's set again for the stop time once the window opens
+    ScheduleAlarmWindow();
 
     // Tell em it worked 
-    BLUETOOTH_SEND("Alarm set successfully\n");
+    CMD_SEND("Alarm set successfully\n");
 
-    return;
+    return CMD_OK;
 }
 
-void Get_Alarm_Callback(void){
+CMDStatusType Get_Alarm_Callback(uint8_t* args, size_t len){
+    // Take one consistent look at the alarm
+    AlarmStateType state;
+    ReadAlarmState(&state);
+    datetime_t Alarm_Window_Start = state.Alarm_Window_Start;
+    datetime_t Alarm_Window_Stop = state.Alarm_Window_Stop;
+
     // See if an alarm has been set
     if (Alarm_Window_Start.year  == 0 && Alarm_Window_Start.month == 0 && Alarm_Window_Start.day   == 0 && Alarm_Window_Start.dotw  == 0 && Alarm_Window_Start.hour  == 0 && Alarm_Window_Start.min   == 0 && Alarm_Window_Start.sec   == 0){
-        BLUETOOTH_SEND("There are currently no alarms set\n");
-        return;
+        CMD_SEND("There are currently no alarms set\n");
+        return CMD_OK;
     }
 
     // Get current time
@@ -434,7 +768,7 @@ void Get_Alarm_Callback(void){
     char datetime_buf[256];
     char *datetime_str = &datetime_buf[0];
     // Give different info if we're in the alarm window yet or not
-    if(!In_Alarm_Window){
+    if(!state.In_Alarm_Window){
         // Convert alarm start time to string
         datetime_to_str(datetime_str, sizeof(datetime_buf), &Alarm_Window_Start);
         // Find time until alarm goes off
@@ -445,17 +779,17 @@ void Get_Alarm_Callback(void){
         sprintf(minutes_str,"%ld",*minutes);
         sprintf(seconds_str,"%ld",*seconds);
         // Send info back over BT
-        BLUETOOTH_SEND("There is an alarm set for:\n");
-        BLUETOOTH_SEND(datetime_str);
-        BLUETOOTH_SEND("\n\nThe alarm will go off in:\n");
-        BLUETOOTH_SEND(days_str);
-        BLUETOOTH_SEND(" days\n");
-        BLUETOOTH_SEND(hours_str);
-        BLUETOOTH_SEND(" hours\n");
-        BLUETOOTH_SEND(minutes_str);
-        BLUETOOTH_SEND(" minutes\n");
-        BLUETOOTH_SEND(seconds_str);
-        BLUETOOTH_SEND(" seconds \n");
+        CMD_SEND("There is an alarm set for:\n");
+        CMD_SEND(datetime_str);
+        CMD_SEND("\n\nThe alarm will go off in:\n");
+        CMD_SEND(days_str);
+        CMD_SEND(" days\n");
+        CMD_SEND(hours_str);
+        CMD_SEND(" hours\n");
+        CMD_SEND(minutes_str);
+        CMD_SEND(" minutes\n");
+        CMD_SEND(seconds_str);
+        CMD_SEND(" seconds \n");
     }else{
         // Convert alarm stop time to string
         datetime_to_str(datetime_str, sizeof(datetime_buf), &Alarm_Window_Stop);
@@ -467,51 +801,656 @@ void Get_Alarm_Callback(void){
         sprintf(minutes_str,"%ld",*minutes);
         sprintf(seconds_str,"%ld",*seconds);
         // Send info back over BT
-        BLUETOOTH_SEND("The current alarm is set to end at:\n");
-        BLUETOOTH_SEND(datetime_str);
-        BLUETOOTH_SEND("\n\nThe alarm window will end in:\n");
-        BLUETOOTH_SEND(days_str);
-        BLUETOOTH_SEND(" days\n");
-        BLUETOOTH_SEND(hours_str);
-        BLUETOOTH_SEND(" hours\n");
-        BLUETOOTH_SEND(minutes_str);
-        BLUETOOTH_SEND(" minutes\n");
-        BLUETOOTH_SEND(seconds_str);
-        BLUETOOTH_SEND(" seconds \n");
+        CMD_SEND("The current alarm is set to end at:\n");
+        CMD_SEND(datetime_str);
+        CMD_SEND("\n\nThe alarm window will end in:\n");
+        CMD_SEND(days_str);
+        CMD_SEND(" days\n");
+        CMD_SEND(hours_str);
+        CMD_SEND(" hours\n");
+        CMD_SEND(minutes_str);
+        CMD_SEND(" minutes\n");
+        CMD_SEND(seconds_str);
+        CMD_SEND(" seconds \n");
     }
 
-    return;
+    return CMD_OK;
 }
 
-void Clear_Alarm_Callback(void){
+CMDStatusType Clear_Alarm_Callback(uint8_t* args, size_t len){
     // First make sure we're not currently in an alarm window
-    if (In_Alarm_Window){
-        BLUETOOTH_SEND("Unable to change alarm while in alarm window\n");
-        return;
+    if (InAlarmWindowQ()){
+        CMD_SEND("Unable to change alarm while in alarm window\n");
+        return CMD_LOCKED;
     }
 
-    // Disable the alarm
-    rtc_disable_alarm();
+    ClearAlarmWindow();
+    CMD_SEND("Alarm was cleared\n");
+
+    return CMD_OK;
+}
+
+// Cancel the window timer, close the window and reset it, shared by 
+// the ClrAlarm command and the window timer that closes the window
+void ClearAlarmWindow(void){
+    // Cancel the window timer
+    CancelTimer(&Window_Timer);
     // Set alarm times back to default values
-    Alarm_Window_Start.year  = 0;
-    Alarm_Window_Start.month = 0;
-    Alarm_Window_Start.day   = 0;
-    Alarm_Window_Start.dotw  = 0;
-    Alarm_Window_Start.hour  = 0;
-    Alarm_Window_Start.min   = 0;
-    Alarm_Window_Start.sec   = 0;
-
-    Alarm_Window_Stop.year  = 0;
-    Alarm_Window_Stop.month = 0;
-    Alarm_Window_Stop.day   = 0;
-    Alarm_Window_Stop.dotw  = 0;
-    Alarm_Window_Stop.hour  = 0;
-    Alarm_Window_Stop.min   = 0;
-    Alarm_Window_Stop.sec   = 0;
-
-    BLUETOOTH_SEND("Alarm was cleared\n");
+    AlarmStateType state;
+    uint32_t saved_irq = LockAlarmState(&state);
+    state.In_Alarm_Window = false;
+    state.Alarm_Window_Start.year  = 0;
+    state.Alarm_Window_Start.month = 0;
+    state.Alarm_Window_Start.day   = 0;
+    state.Alarm_Window_Start.dotw  = 0;
+    state.Alarm_Window_Start.hour  = 0;
+    state.Alarm_Window_Start.min   = 0;
+    state.Alarm_Window_Start.sec   = 0;
+
+    state.Alarm_Window_Stop.year  = 0;
+    state.Alarm_Window_Stop.month = 0;
+    state.Alarm_Window_Stop.day   = 0;
+    state.Alarm_Window_Stop.dotw  = 0;
+    state.Alarm_Window_Stop.hour  = 0;
+    state.Alarm_Window_Stop.min   = 0;
+    state.Alarm_Window_Stop.sec   = 0;
+    PublishAlarmState(&state, saved_irq);
 
     return;
 }
 
-#endif
\ No newline at end of file
+// Sends back how many microseconds after reset each boot step finished
+CMDStatusType Boot_Time_Callback(uint8_t* args, size_t len){
+    char sendbuffer[64];
+
+    snprintf(sendbuffer, sizeof(sendbuffer), "First sample: %llu us\n", Boot_First_Sample_US);
+    CMD_SEND(sendbuffer);
+    for (uint8_t i = 0; i < NUMBER_OF_BOOT_STEPS; i++){
+        snprintf(sendbuffer, sizeof(sendbuffer), "%s: %llu us\n", BootSteps[i].Name, Boot_Step_Done_US[i]);
+        CMD_SEND(sendbuffer);
+    }
+    return CMD_OK;
+}
+
+// Sends back the time spent in each power state and the wake up latency
+CMDStatusType Power_Stats_Callback(uint8_t* args, size_t len){
+    const char* state_names[NUMBER_OF_POWER_STATES] = {"Full", "Low"};
+    char sendbuffer[96];
+    PowerStatsType stats;
+    GetPowerStats(&stats);
+
+    for (uint8_t i = 0; i < NUMBER_OF_POWER_STATES; i++){
+        snprintf(sendbuffer, sizeof(sendbuffer), "%s: %llu ms (%llu ms asleep)\n", state_names[i], stats.State_US[i]/1000, stats.Sleep_US[i]/1000);
+        CMD_SEND(sendbuffer);
+    }
+    snprintf(sendbuffer, sizeof(sendbuffer), "Transitions: %lu\n", stats.Transitions);
+    CMD_SEND(sendbuffer);
+    snprintf(sendbuffer, sizeof(sendbuffer), "Wake to full speed: last %lu us, worst %lu us, budget %d us, %lu over budget\n", stats.Last_Wake_US, stats.Worst_Wake_US, POWER_WAKE_BUDGET_US, stats.Wakes_Over_Budget);
+    CMD_SEND(sendbuffer);
+    return (stats.Wakes_Over_Budget == 0) ? CMD_OK : CMD_FAILED;
+}
+
+// Sends back how busy the timer wheel is and how promptly it runs timers
+CMDStatusType Timers_Callback(uint8_t* args, size_t len){
+    char sendbuffer[128];
+    TimerStatsType stats;
+    GetTimerStats(&stats);
+
+    snprintf(sendbuffer, sizeof(sendbuffer), "Pending: %lu, run: %lu, cascaded down a level: %lu\n", stats.Pending, stats.Fired, stats.Cascaded);
+    CMD_SEND(sendbuffer);
+    snprintf(sendbuffer, sizeof(sendbuffer), "Alarm interrupts: %lu, latest run after due: %lu us (tick %lu us)\n", stats.Interrupts, stats.Worst_Late_US, TIMER_TICK_US);
+    CMD_SEND(sendbuffer);
+    uint64_t next = NextTimerUs();
+    if (next != TIMER_NEVER){
+        int64_t until = next - time_us_64();
+        snprintf(sendbuffer, sizeof(sendbuffer), "Next alarm in %lld us\n", until > 0 ? until : 0);
+        CMD_SEND(sendbuffer);
+    }
+    return CMD_OK;
+}
+
+// NTP style clock correction, see the usage. Each SyncTime finishes the last
+// exchange with the host's receive time and starts the next with its send time
+CMDStatusType Sync_Time_Callback(uint8_t* args, size_t len){
+    char sendbuffer[128];
+    SyncSampleType sample;
+
+    if (len <= 1){
+        SyncStatsType stats;
+        GetSyncStats(&stats);
+        datetime_t now;
+        int64_t wall = WallClockUs();
+        WallUsToDatetime(wall, &now);
+        snprintf(sendbuffer, sizeof(sendbuffer), "Clock: %04d-%02d-%02d %02d:%02d:%02d.%06lld, %s\n", now.year, now.month, now.day, now.hour, now.min, now.sec, wall % 1000000, Timebase.Synced ? "synced" : (Timebase.Set ? "set by hand" : "not set"));
+        CMD_SEND(sendbuffer);
+        snprintf(sendbuffer, sizeof(sendbuffer), "Exchanges: %lu, %lu rejected\n", stats.Samples, stats.Rejected);
+        CMD_SEND(sendbuffer);
+        if (stats.Samples > 0){
+            snprintf(sendbuffer, sizeof(sendbuffer), "Last: offset %lld us, round trip %lld us%s\n", stats.Last.Offset_US, stats.Last.Delay_US, stats.Last.Applied ? ", applied" : "");
+            CMD_SEND(sendbuffer);
+        }
+        if (Timebase.Synced){
+            snprintf(sendbuffer, sizeof(sendbuffer), "Stepped %lld us this burst, last synced %llu s ago\n", stats.Burst_Step_US, (time_us_64() - stats.Last_Sync_US) / 1000000);
+            CMD_SEND(sendbuffer);
+        }
+        snprintf(sendbuffer, sizeof(sendbuffer), "Drift: %ld ppb\n", Timebase.Drift_PPB);
+        CMD_SEND(sendbuffer);
+        return CMD_OK;
+    }
+    if (InAlarmWindowQ()){
+        CMD_SEND("Unable to sync clock while in alarm window\n");
+        return CMD_LOCKED;
+    }
+
+    // Scrap the space in front of T1, the args end in a '\0'
+    const char* text = (const char*) args + 1;
+    char* end;
+    bool finish_only = strncmp(text, "end", 3) == 0;
+    int64_t t1 = finish_only ? 0 : strtoll(text, &end, 10);
+    if (finish_only) end = (char*) text + 3;
+    if (!finish_only && (end == text || t1 <= 0)){
+        CMD_SEND("Needs the time this was sent\n");
+        return CMD_BAD_ARGS;
+    }
+    int64_t t4 = strtoll(end, &end, 10);
+
+    CMDStatusType status = CMD_OK;
+    if (t4 > 0){
+        if (SyncFinish(t4, &sample)){
+            snprintf(sendbuffer, sizeof(sendbuffer), "Offset %lld us, round trip %lld us%s\n", sample.Offset_US, sample.Delay_US, sample.Applied ? ", applied" : "");
+            CMD_SEND(sendbuffer);
+            // The window boundaries just moved relative to the timer
+            if (sample.Applied) ScheduleAlarmWindow();
+        }else{
+            CMD_SEND("No exchange to finish\n");
+            status = CMD_BAD_ARGS;
+        }
+    }
+    // Stamped last so the time it takes to finish the last exchange doesn't count
+    if (!finish_only) SyncStart(t1, Transports[Command_Transport].Message_RX_US);
+    return status;
+}
+
+// Sends back what each bed sensor last read and how much the fusion trusts it
+CMDStatusType Sensor_Status_Callback(uint8_t* args, size_t len){
+    char sendbuffer[128];
+    bool over_budget = false;
+
+    for (uint8_t i = 0; i < NUMBER_OF_SENSORS; i++){
+        SensorStatusType* status = &Sensor_Status[i];
+        snprintf(sendbuffer, sizeof(sendbuffer), "%s: %ld confidence %u %s, %lu samples, worst read %lu us (budget %lu us)\n", Sensors[i].Name, status->Last_Sample, status->Confidence, status->Healthy ? "healthy" : "FAILED", status->Samples, status->Worst_Sample_US, Sensors[i].Max_Sample_US);
+        CMD_SEND(sendbuffer);
+        if (status->Worst_Sample_US > Sensors[i].Max_Sample_US) over_budget = true;
+    }
+    AlarmStateType state;
+    ReadAlarmState(&state);
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (!(ZONES_FITTED & ZONE_BIT(i))) continue;
+        snprintf(sendbuffer, sizeof(sendbuffer), "  Zone %d: %u confidence %u%s\n", i, FSR_Zones[i], ZoneConfidence(i, FSR_Zones[i], &state), (state.Zone_Mask & ZONE_BIT(i)) ? "" : " (ignored)");
+        CMD_SEND(sendbuffer);
+    }
+    snprintf(sendbuffer, sizeof(sendbuffer), "Fused confidence: %u, occupied at %d\n", Fused_Confidence, OCCUPIED_CONFIDENCE);
+    CMD_SEND(sendbuffer);
+    // The latency bound only holds if no pass was ever later than the slowest rate
+    snprintf(sendbuffer, sizeof(sendbuffer), "Sampling every %lu us, longest gap %lu us of %d us, worst case latency %lu us\n", Sample_Interval_US, Worst_Sample_Gap_US, SAMPLE_INTERVAL_MAX_US, SENSE_WORST_LATENCY_US);
+    CMD_SEND(sendbuffer);
+    if (Worst_Sample_Gap_US > SAMPLE_INTERVAL_MAX_US + SAMPLE_INTERVAL_MIN_US) over_budget = true;
+    return over_budget ? CMD_FAILED : CMD_OK;
+}
+
+// Picks whether any fitted zone or one particular zone counts as in bed
+CMDStatusType Set_Zones_Callback(uint8_t* args, size_t len){
+    // Scrap the space in front of the zone
+    args++;
+    len = (len > 0) ? len - 1 : 0;
+    if (len == 3 && strncmp((const char*) args, "any", 3) == 0) len = 0;
+
+    uint8_t mask;
+    if (!ParseZone(args, len, ZONES_ANY, &mask)){
+        CMD_SEND("Zones not set, no such zone\n");
+        return CMD_BAD_ARGS;
+    }
+    AlarmStateType state;
+    uint32_t saved_irq = LockAlarmState(&state);
+    if (state.In_Alarm_Window){
+        UnlockAlarmState(saved_irq);
+        CMD_SEND("Unable to change zones in alarm window\n");
+        return CMD_LOCKED;
+    }
+    state.Zone_Mask = mask;
+    PublishAlarmState(&state, saved_irq);
+
+    CMD_SEND("Zones set\n");
+    return CMD_OK;
+}
+
+// Sends back how hard the zone ADC is working the CPU
+CMDStatusType ADC_Stats_Callback(uint8_t* args, size_t len){
+    char sendbuffer[96];
+    ZoneStatsType stats;
+    GetZoneStats(&stats);
+
+    snprintf(sendbuffer, sizeof(sendbuffer), "%d zones at %d sps each, %d bit readings at %d Hz\n", NUMBER_OF_ZONES, 1000000 / (ADC_CONVERSION_US * NUMBER_OF_ZONES), ZONE_READING_BITS, ZONE_READING_HZ);
+    CMD_SEND(sendbuffer);
+    // Every block is ZONE_BLOCK_US of sampling, so that's the time the load is out of
+    uint64_t sampling_us = (uint64_t) stats.Blocks * ZONE_BLOCK_US;
+    uint32_t load_permille = (sampling_us > 0) ? (1000 * stats.Busy_US) / sampling_us : 0;
+    snprintf(sendbuffer, sizeof(sendbuffer), "Decimator load: %lu.%lu%% over %lu blocks\n", load_permille / 10, load_permille % 10, stats.Blocks);
+    CMD_SEND(sendbuffer);
+    snprintf(sendbuffer, sizeof(sendbuffer), "Worst block: %lu us of %d us, %lu overruns\n", stats.Worst_Block_US, ZONE_BLOCK_US, stats.Overruns);
+    CMD_SEND(sendbuffer);
+    return (stats.Overruns == 0 && stats.Worst_Block_US < ZONE_BLOCK_US) ? CMD_OK : CMD_FAILED;
+}
+
+// Sends back one line of running stats, histogram counts included
+void SendStats(const char* name, const RunningStatsType* stats){
+    char sendbuffer[96];
+    snprintf(sendbuffer, sizeof(sendbuffer), "  %s: %lu samples mean %ld sd %ld min %ld max %ld\n    ", name, stats->Count, (int32_t) stats->Mean, (int32_t) StatsDeviation(stats), stats->Min, stats->Max);
+    CMD_SEND(sendbuffer);
+    for (uint8_t i = 0; i < STATS_BUCKETS; i++){
+        snprintf(sendbuffer, sizeof(sendbuffer), "%u ", stats->Histogram[i]);
+        CMD_SEND(sendbuffer);
+    }
+    CMD_SEND("\n");
+}
+
+// Sets where the latency probe's start edge comes from, or sends back its histogram
+CMDStatusType Latency_Callback(uint8_t* args, size_t len){
+    char sendbuffer[112];
+
+    // Scrap the space in front of the trigger
+    if (len > 1){
+        if (len == 6 && strncmp((const char*) args + 1, "reset", 5) == 0){
+            ResetLatencyStats();
+            CMD_SEND("Latency histogram cleared\n");
+            return CMD_OK;
+        }
+        for (uint8_t i = 0; i < NUMBER_OF_LATENCY_TRIGGERS; i++){
+            if (len - 1 == strlen(LatencyTriggerNames[i]) && strncmp((const char*) args + 1, LatencyTriggerNames[i], len - 1) == 0){
+                SetLatencyTrigger(i);
+                ResetLatencyStats();
+                snprintf(sendbuffer, sizeof(sendbuffer), "Latency trigger set to %s\n", LatencyTriggerNames[i]);
+                CMD_SEND(sendbuffer);
+                return CMD_OK;
+            }
+        }
+        CMD_SEND("Trigger has to be adc, gpio or reset\n");
+        return CMD_BAD_ARGS;
+    }
+
+    LatencyStatsType stats;
+    GetLatencyStats(&stats);
+    snprintf(sendbuffer, sizeof(sendbuffer), "Bed to buzzer, %s trigger on GPIO %d, %lu us buckets:\n", LatencyTriggerNames[GetLatencyTrigger()], LATENCY_TRIGGER_PIN, 1ul << LATENCY_LOG2_BUCKET_US);
+    CMD_SEND(sendbuffer);
+    SendStats("Latency us", &stats.Latency_US);
+    if (GetLatencyTrigger() == LATENCY_TRIGGER_ADC){
+        snprintf(sendbuffer, sizeof(sendbuffer), "%lu crossings, %lu abandoned (bed emptied or window closed first)\n", stats.Crossings, stats.Abandoned);
+    }else{
+        snprintf(sendbuffer, sizeof(sendbuffer), "%lu abandoned (window closed first)\n", stats.Abandoned);
+    }
+    CMD_SEND(sendbuffer);
+    return CMD_OK;
+}
+
+// Starts learning empty or full, or sends back what's been learned
+CMDStatusType Calibrate_Callback(uint8_t* args, size_t len){
+    const char* result_names[] = {"not run", "set", "distributions overlap, not set", "too noisy, not set", "alarm window open, not set"};
+    char sendbuffer[96];
+
+    // Scrap the space in front of the phase
+    if (len > 1){
+        CalibrationPhaseType phase;
+        if (len == 6 && strncmp((const char*) args + 1, "empty", 5) == 0) phase = CAL_EMPTY;
+        else if (len == 5 && strncmp((const char*) args + 1, "full", 4) == 0) phase = CAL_FULL;
+        else {
+            CMD_SEND("Phase has to be empty or full\n");
+            return CMD_BAD_ARGS;
+        }
+        if (InAlarmWindowQ()){
+            CMD_SEND("Unable to calibrate in alarm window\n");
+            return CMD_LOCKED;
+        }
+        if (!StartCalibration(phase)){
+            CMD_SEND("Calibration already running, try again in a few seconds\n");
+            return CMD_FAILED;
+        }
+        snprintf(sendbuffer, sizeof(sendbuffer), "Learning, keep the bed %s for %d seconds\n", (phase == CAL_EMPTY) ? "empty" : "occupied", CALIBRATE_SECONDS);
+        CMD_SEND(sendbuffer);
+        return CMD_OK;
+    }
+
+    AlarmStateType state;
+    ReadAlarmState(&state);
+    if (CalibratingQ()) CMD_SEND("Calibration running\n");
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (!(ZONES_FITTED & ZONE_BIT(i))) continue;
+        snprintf(sendbuffer, sizeof(sendbuffer), "Zone %d: %s, threshold %u hysteresis %u\n", i, result_names[Zone_Calibration[i]], state.Threshold[i], state.Hysteresis[i]);
+        CMD_SEND(sendbuffer);
+        SendStats("Empty", &Empty_Stats[i]);
+        SendStats("Full", &Full_Stats[i]);
+    }
+    snprintf(sendbuffer, sizeof(sendbuffer), "Scale zero: %s, offset %ld\n", result_names[Tare_Result], Scale_Zero_Offset);
+    CMD_SEND(sendbuffer);
+    SendStats("Zero", &Tare_Stats);
+    return CMD_OK;
+}
+
+// Starts or stops recording a trace
+CMDStatusType Trace_Callback(uint8_t* args, size_t len){
+    // Scrap the space in front of on/off
+    if (len == 3 && strncmp((const char*) args + 1, "on", 2) == 0){
+        StartTrace();
+        CMD_SEND("Tracing\n");
+        return CMD_OK;
+    }
+    if (len == 4 && strncmp((const char*) args + 1, "off", 3) == 0){
+        StopTrace();
+        CMD_SEND("Trace stopped\n");
+        return CMD_OK;
+    }
+    CMD_SEND("Trace has to be on or off\n");
+    return CMD_BAD_ARGS;
+}
+
+// Sends back the next TRACE_DUMP_LINES records of the trace, or all of them over USB
+static uint32_t Trace_Dump_Index;
+
+// Streams the rest of the trace from the main loop, only as much as the
+// link has room for each pass so sensing and the buzzer never wait on it
+static bool TraceDumpStream(TransportIdType id){
+    char sendbuffer[80];
+    uint32_t count = TraceRecordCount();
+
+    while (QueueFree(&Transports[id].TX) >= sizeof(sendbuffer)){
+        if (Trace_Dump_Index >= count){
+            snprintf(sendbuffer, sizeof(sendbuffer), "#DONE %lu %lu\n", count, TraceDroppedCount());
+            TransportSend(id, sendbuffer);
+            return false;
+        }
+        FormatTraceRecord(Trace_Dump_Index++, sendbuffer, sizeof(sendbuffer));
+        TransportSend(id, sendbuffer);
+    }
+    return true;
+}
+
+CMDStatusType Trace_Dump_Callback(uint8_t* args, size_t len){
+    char sendbuffer[80];
+    uint32_t index = (len > 1) ? str2int((char*) (args + 1), len - 1) : 0;
+    uint32_t count = TraceRecordCount();
+
+    // The window gets pages like Bluetooth does, a stream could still be
+    // going when the alarm needs the link's time
+    if (Command_Streaming && !InAlarmWindowQ()){
+        Trace_Dump_Index = index;
+        TransportStartStream(Command_Transport, &TraceDumpStream);
+        return CMD_OK;
+    }
+
+    for (uint32_t line = 0; line < TRACE_DUMP_LINES && index < count; line++, index++){
+        FormatTraceRecord(index, sendbuffer, sizeof(sendbuffer));
+        CMD_SEND(sendbuffer);
+    }
+    if (index < count) snprintf(sendbuffer, sizeof(sendbuffer), "#NEXT %lu\n", index);
+    else snprintf(sendbuffer, sizeof(sendbuffer), "#DONE %lu %lu\n", count, TraceDroppedCount());
+    CMD_SEND(sendbuffer);
+    return CMD_OK;
+}
+
+// Streams a new firmware image into the staging bank and installs it
+CMDStatusType Fw_Update_Callback(uint8_t* args, size_t len){
+    const char* state_names[] = {"idle", "erasing", "receiving", "verified, installing", "failed"};
+    char sendbuffer[128];
+    // Scrap the space in front of the action, the args end in a '\0'
+    const char* action = (const char*) args + 1;
+    char* end;
+
+    if (len <= 1){
+        snprintf(sendbuffer, sizeof(sendbuffer), "State: %s%s\n", state_names[Fw_Update.State], Fw_Update.Installed ? ", running a freshly installed image" : "");
+        CMD_SEND(sendbuffer);
+        if (Fw_Update.State == FW_IDLE){
+            snprintf(sendbuffer, sizeof(sendbuffer), "Staging bank: %u bytes\n", FW_BANK_SIZE);
+            CMD_SEND(sendbuffer);
+            return CMD_OK;
+        }
+        snprintf(sendbuffer, sizeof(sendbuffer), "Blocks: %lu received, %lu programmed of %lu, %lu bytes erased\n", Fw_Update.Blocks_Received, Fw_Update.Blocks_Written, FW_BLOCKS(Fw_Update.Length), Fw_Update.Erased);
+        CMD_SEND(sendbuffer);
+        uint64_t elapsed = Fw_Update.Last_Block_US - Fw_Update.First_Block_US;
+        if (Fw_Update.Blocks_Received > 1 && elapsed > 0){
+            // The first block's transfer isn't timed, so leave its bytes out too
+            uint64_t image = (uint64_t) MIN((Fw_Update.Blocks_Received - 1) * FW_BLOCK_SIZE, Fw_Update.Length) * 1000000 / elapsed;
+            uint64_t encoded = (uint64_t) Fw_Update.Wire_Bytes * (Fw_Update.Blocks_Received - 1) / Fw_Update.Blocks_Received * 1000000 / elapsed;
+            uint32_t max = Transports[Fw_Update.Transport].Max_Bytes_Per_S;
+            snprintf(sendbuffer, sizeof(sendbuffer), "Throughput: %llu B/s of image, %llu B/s encoded, %llu%% of %s's %lu B/s\n", image, encoded, encoded * 100 / max, Transports[Fw_Update.Transport].Name, max);
+            CMD_SEND(sendbuffer);
+        }
+        return CMD_OK;
+    }
+
+    if (strncmp(action, "abort", 5) == 0){
+        FwUpdateAbort();
+        CMD_SEND("Update aborted\n");
+        return CMD_OK;
+    }
+    if (InAlarmWindowQ()){
+        CMD_SEND("Unable to update in alarm window\n");
+        return CMD_LOCKED;
+    }
+
+    if (strncmp(action, "begin ", 6) == 0){
+        uint8_t hash[SHA256_SIZE];
+        uint32_t length = strtoul(action + 6, &end, 10);
+        while (*end == ' ') end++;
+        if (length == 0 || !ParseHexBytes(end, hash, SHA256_SIZE)){
+            CMD_SEND("Needs the image's length and SHA-256\n");
+            return CMD_BAD_ARGS;
+        }
+        if (!FwUpdateBegin(length, hash, Command_Transport)){
+            snprintf(sendbuffer, sizeof(sendbuffer), "Image too big, the staging bank holds %u bytes\n", FW_BANK_SIZE);
+            CMD_SEND(sendbuffer);
+            return CMD_FAILED;
+        }
+        snprintf(sendbuffer, sizeof(sendbuffer), "Erasing room for %lu blocks\n", FW_BLOCKS(length));
+        CMD_SEND(sendbuffer);
+        return CMD_OK;
+    }
+
+    if (strncmp(action, "block ", 6) == 0){
+        uint32_t index = strtoul(action + 6, &end, 10);
+        uint32_t crc = strtoul(end, &end, 16);
+        while (*end == ' ') end++;
+        switch (FwUpdateBlock(index, crc, end, len - ((uint8_t*) end - args))){
+            case FW_BLOCK_OK:
+                snprintf(sendbuffer, sizeof(sendbuffer), "ACK %lu\n", index);
+                CMD_SEND(sendbuffer);
+                return CMD_OK;
+            case FW_BLOCK_BUSY:
+                snprintf(sendbuffer, sizeof(sendbuffer), "BUSY %lu\n", index);
+                CMD_SEND(sendbuffer);
+                return CMD_FAILED;
+            case FW_BLOCK_BAD:
+                snprintf(sendbuffer, sizeof(sendbuffer), "BAD %lu\n", index);
+                CMD_SEND(sendbuffer);
+                return CMD_FAILED;
+            case FW_BLOCK_OUT_OF_ORDER:
+                snprintf(sendbuffer, sizeof(sendbuffer), "NEXT %lu\n", Fw_Update.Blocks_Received);
+                CMD_SEND(sendbuffer);
+                return CMD_BAD_ARGS;
+            default:
+                snprintf(sendbuffer, sizeof(sendbuffer), "Not taking blocks, state is %s\n", state_names[Fw_Update.State]);
+                CMD_SEND(sendbuffer);
+                return CMD_FAILED;
+        }
+    }
+
+    if (strncmp(action, "end", 3) == 0){
+        if (FwUpdateEnd()){
+            CMD_SEND("Image verified, installing and restarting\n");
+            return CMD_OK;
+        }
+        if (Fw_Update.State == FW_FAILED) CMD_SEND("Image doesn't match its SHA-256, not installed\n");
+        else CMD_SEND("Not every block has been received\n");
+        return CMD_FAILED;
+    }
+
+    CMD_SEND("Action has to be begin, block, end or abort\n");
+    return CMD_BAD_ARGS;
+}
+
+// Adds, clears or lists the wake rules
+CMDStatusType Wake_Rule_Callback(uint8_t* args, size_t len){
+    char sendbuffer[128];
+    // Scrap the space in front of the action, the args end in a '\0'
+    const char* action = (const char*) args + 1;
+
+    if (len <= 1){
+        for (uint8_t i = 0; i < Rule_Set.Count; i++){
+            snprintf(sendbuffer, sizeof(sendbuffer), "%u: %s %s\n", i, RuleActionNames[Rule_Set.Rules[i].Action], Rule_Set.Rules[i].Text);
+            CMD_SEND(sendbuffer);
+        }
+        snprintf(sendbuffer, sizeof(sendbuffer), "Ops per reading: %lu last, %lu worst, %u at most\n", Rule_Ops_Run, Rule_Worst_Ops, RULE_MAX_OPS);
+        CMD_SEND(sendbuffer);
+        return CMD_OK;
+    }
+    if (InAlarmWindowQ()){
+        CMD_SEND("Unable to change wake rules in alarm window\n");
+        return CMD_LOCKED;
+    }
+
+    if (strncmp(action, "clear", 5) == 0){
+        ClearRules();
+        Retained_State_Dirty = true;
+        CMD_SEND("Wake rules cleared, beeping while in bed\n");
+        return CMD_OK;
+    }
+
+    for (uint8_t i = RULE_BEEP; i < NUMBER_OF_RULE_ACTIONS; i++){
+        size_t name_length = strlen(RuleActionNames[i]);
+        if (strncmp(action, RuleActionNames[i], name_length) != 0 || action[name_length] != ' ') continue;
+        const char* error = AddRule(action + name_length + 1, i);
+        if (error){
+            snprintf(sendbuffer, sizeof(sendbuffer), "Rule not added: %s\n", error);
+            CMD_SEND(sendbuffer);
+            return CMD_BAD_ARGS;
+        }
+        Retained_State_Dirty = true;
+        snprintf(sendbuffer, sizeof(sendbuffer), "Rule %u added\n", Rule_Set.Count - 1);
+        CMD_SEND(sendbuffer);
+        return CMD_OK;
+    }
+
+    CMD_SEND("Action has to be beep, escalate or clear\n");
+    return CMD_BAD_ARGS;
+}
+
+// Reports core 1's breathing and movement detector, or benchmarks its kernel
+CMDStatusType Motion_Callback(uint8_t* args, size_t len){
+    char sendbuffer[128];
+    uint32_t mhz = clock_get_hz(clk_sys) / 1000000;
+    MotionStatusType status;
+    ReadMotionStatus(&status);
+
+    if (len > 1 && strncmp((const char*) args + 1, "bench", 5) == 0){
+        uint32_t cycles = BenchmarkMotion();
+        snprintf(sendbuffer, sizeof(sendbuffer), "One analysis: %lu cycles, %lu us at %lu MHz, budget %u cycles\n", cycles, cycles / mhz, mhz, MOTION_CYCLE_BUDGET);
+        CMD_SEND(sendbuffer);
+        return (cycles > MOTION_CYCLE_BUDGET) ? CMD_FAILED : CMD_OK;
+    }
+
+    if (!MotionCoreRunningQ() || status.Analyses == 0){
+        CMD_SEND("No window analysed yet, the bed sensor only runs in the alarm window\n");
+    }else{
+        // Bin k is k * MOTION_SAMPLE_MHZ / MOTION_WINDOW mHz, in hundredths of a breath a minute
+        uint32_t rate = (uint32_t) status.Spectrum.Peak_Bin * MOTION_SAMPLE_MHZ * 6 / MOTION_WINDOW;
+        snprintf(sendbuffer, sizeof(sendbuffer), "Window: mean %lu, RMS change %lu, %u/256 drift, %u/256 breathing band peaking at %lu.%02lu a minute\n", status.Spectrum.Mean, (uint32_t) sqrtf(status.Spectrum.Mean_Square), status.Spectrum.Drift_Share, status.Spectrum.Breath_Share, rate / 100, rate % 100);
+        CMD_SEND(sendbuffer);
+        snprintf(sendbuffer, sizeof(sendbuffer), "Presence: %u, %s, %s\n", status.Presence, status.Breathing ? "breathing" : "no breathing", status.Moving ? "moving" : "still");
+        CMD_SEND(sendbuffer);
+    }
+    snprintf(sendbuffer, sizeof(sendbuffer), "Core 1: %lu analyses, %lu cycles last, %lu worst of a %u budget, %lu samples dropped\n", status.Analyses, status.Last_Cycles, status.Worst_Cycles, MOTION_CYCLE_BUDGET, status.Dropped);
+    CMD_SEND(sendbuffer);
+    return (status.Worst_Cycles > MOTION_CYCLE_BUDGET) ? CMD_FAILED : CMD_OK;
+}
+
+// Runs the interrupt entry benchmark, see Jitter.c
+CMDStatusType Jitter_Callback(uint8_t* args, size_t len){
+    char sendbuffer[112];
+    static JitterStatsType stats;
+    uint32_t mhz = clock_get_hz(clk_sys) / 1000000;
+
+    if (!RunJitterBench(&stats)){
+        CMD_SEND("No spare interrupt to time with\n");
+        return CMD_FAILED;
+    }
+    snprintf(sendbuffer, sizeof(sendbuffer), "Hot path runs from %s (SNOOZE_RAM_HOT_PATH %s), entry cycles at %lu MHz:\n", HOT_PATH_RAM ? "SRAM" : "flash", HOT_PATH_RAM ? "on" : "off", mhz);
+    CMD_SEND(sendbuffer);
+    for (uint8_t p = 0; p < NUMBER_OF_JITTER_PLACEMENTS; p++){
+        for (uint8_t c = 0; c < NUMBER_OF_JITTER_CACHES; c++){
+            snprintf(sendbuffer, sizeof(sendbuffer), "%s %s", JitterPlacementNames[p], JitterCacheNames[c]);
+            SendStats(sendbuffer, &stats.Entry_Cycles[p][c]);
+        }
+    }
+    int32_t sram_worst = stats.Entry_Cycles[JITTER_SRAM][JITTER_COLD].Max;
+    int32_t flash_worst = stats.Entry_Cycles[JITTER_FLASH][JITTER_COLD].Max;
+    int32_t timer_worst = stats.Entry_Cycles[JITTER_TIMER_WHEEL][JITTER_COLD].Max;
+    snprintf(sendbuffer, sizeof(sendbuffer), "Worst case: SRAM %ld ns, flash %ld ns, timer wheel %ld ns, %lu shots missed\n", sram_worst * 1000 / (int32_t) mhz, flash_worst * 1000 / (int32_t) mhz, timer_worst * 1000 / (int32_t) mhz, stats.Missed);
+    CMD_SEND(sendbuffer);
+    return stats.Missed ? CMD_FAILED : CMD_OK;
+}
+
+// One night on a line, durations as minutes:seconds
+static void SendNight(const NightType* night){
+    char sendbuffer[128];
+    char first_exit[12] = "-";
+    datetime_t start;
+    WallUsToDatetime(night->Start_S * 1000000ll, &start);
+    if (night->First_Exit_S != NIGHT_NEVER) snprintf(first_exit, sizeof(first_exit), "%lu:%02lu", night->First_Exit_S / 60, night->First_Exit_S % 60);
+    snprintf(sendbuffer, sizeof(sendbuffer), "%04d-%02d-%02d %02d:%02d window %lu:%02lu, in bed %lu:%02lu, out %ux, first out %s, beeped %lu:%02lu, longest back %lu:%02lu\n",
+        start.year, start.month, start.day, start.hour, start.min, night->Window_S / 60, night->Window_S % 60, night->In_Bed_S / 60, night->In_Bed_S % 60,
+        night->Exits, first_exit, night->Buzzer_S / 60, night->Buzzer_S % 60, night->Longest_Return_S / 60, night->Longest_Return_S % 60);
+    CMD_SEND(sendbuffer);
+}
+
+// Sends back the nightly summaries, newest first
+CMDStatusType Nights_Callback(uint8_t* args, size_t len){
+    static NightType nights[NIGHTS_KEPT];
+    NightType tonight;
+
+    if (NightSoFar(&tonight)){
+        CMD_SEND("So far: ");
+        SendNight(&tonight);
+    }
+    uint8_t count = GetNights(nights);
+    if (count == 0){
+        CMD_SEND("No alarm windows have closed yet\n");
+    }
+    for (uint8_t i = 0; i < count; i++) SendNight(&nights[i]);
+    return CMD_OK;
+}
+
+// Sets or sends back how long the HC05 is left on once it goes idle
+CMDStatusType BT_Idle_Callback(uint8_t* args, size_t len){
+    char sendbuffer[64];
+
+    // Scrap the space in front of the minutes, the args end in a '\0'
+    if (len > 1){
+        const char* text = (const char*) args + 1;
+        char* end;
+        uint32_t minutes = strtoul(text, &end, 10);
+        if (end == text || minutes > BT_IDLE_OFF_MAX_MIN){
+            snprintf(sendbuffer, sizeof(sendbuffer), "Minutes has to be 0 to %d\n", BT_IDLE_OFF_MAX_MIN);
+            CMD_SEND(sendbuffer);
+            return CMD_BAD_ARGS;
+        }
+        BT_Idle_Off_MS = minutes * 60000;
+        Retained_State_Dirty = true;
+    }
+    if (BT_Idle_Off_MS == 0){
+        CMD_SEND("Bluetooth stays on\n");
+    }else{
+        snprintf(sendbuffer, sizeof(sendbuffer), "Bluetooth powers off after %lu min idle\n", BT_Idle_Off_MS / 60000);
+        CMD_SEND(sendbuffer);
+    }
+    return CMD_OK;
+}
+
+#endif
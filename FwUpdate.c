@@ -0,0 +1,226 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
+#include "pico/multicore.h"
+#include "FwUpdate.h"
+#include "AlarmState.h"
+#include "PressureSensor.h"
+#include "Motion.h"
+
+// A new image is streamed into the staging bank one CRC checked page at a
+// time. Blocks are acknowledged as soon as they're buffered and programmed
+// from the main loop while the next ones are still coming in. Once the whole
+// image hashes right the install is recorded and we reset into the loader
+// (Loader.c), which copies it over this one from code that's never erased
+
+// Globals
+FwUpdateType Fw_Update = {.State = FW_IDLE};
+static uint8_t Fw_Pipeline[FW_PIPELINE_BLOCKS][FW_BLOCK_SIZE];
+
+// Standard (zlib) CRC-32, bit at a time since a block is only 256 bytes
+uint32_t Crc32(const uint8_t* data, size_t len){
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--){
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// Returns the number of bytes decoded or -1 if text isn't base64 or doesn't fit
+static int DecodeBase64(const char* text, size_t len, uint8_t* out, size_t size){
+    uint32_t bits = 0;
+    uint8_t count = 0;
+    size_t decoded = 0;
+    for (size_t i = 0; i < len && text[i] != '='; i++){
+        char c = text[i];
+        int value;
+        if (c >= 'A' && c <= 'Z') value = c - 'A';
+        else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') value = c - '0' + 52;
+        else if (c == '+') value = 62;
+        else if (c == '/') value = 63;
+        else return -1;
+        bits = (bits << 6) | value;
+        if (++count == 4){
+            if (decoded + 3 > size) return -1;
+            out[decoded++] = bits >> 16;
+            out[decoded++] = bits >> 8;
+            out[decoded++] = bits;
+            bits = 0;
+            count = 0;
+        }
+    }
+    // 2 or 3 leftover characters hold 1 or 2 bytes
+    if (count == 1) return -1;
+    if (count > 1 && decoded + count - 1 > size) return -1;
+    if (count >= 2) out[decoded++] = bits >> (count == 2 ? 4 : 10);
+    if (count == 3) out[decoded++] = bits >> 2;
+    return decoded;
+}
+
+// Nothing can run from flash while it's being written, so core 1 is parked
+// in RAM (once it's running) as well as interrupts being held off. Holding
+// them off for ~1ms is too long for the zone DMA, so the ADC is paused
+// around every write, whatever the power state did to it in between
+static bool Fw_Zones_Were_Paused;
+
+static uint32_t StartFlashWrite(){
+    Fw_Zones_Were_Paused = ZoneSamplingPausedQ();
+    PauseZoneSampling();
+    if (MotionCoreRunningQ()) multicore_lockout_start_blocking();
+    return save_and_disable_interrupts();
+}
+
+static void EndFlashWrite(uint32_t saved_irq){
+    restore_interrupts(saved_irq);
+    if (MotionCoreRunningQ()) multicore_lockout_end_blocking();
+    if (!Fw_Zones_Were_Paused) ResumeZoneSampling();
+}
+
+static void SetFlashRecord(const FwRecordType* record){
+    static uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, record, sizeof(FwRecordType));
+    uint32_t saved_irq = StartFlashWrite();
+    flash_range_erase(FW_RECORD_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(FW_RECORD_OFFSET, page, FLASH_PAGE_SIZE);
+    EndFlashWrite(saved_irq);
+}
+
+static void HashFlash(uint32_t offset, uint32_t length, uint8_t* hash){
+    Sha256Type sha;
+    Sha256Start(&sha);
+    Sha256Add(&sha, (const uint8_t*) (XIP_BASE + offset), length);
+    Sha256Finish(&sha, hash);
+}
+
+// Record the install and reset, the loader does the copy on the way back up.
+// Losing power from here on just means the loader starts the copy again
+static void Install(){
+    FwRecordType record = {FW_RECORD_MAGIC, FW_RECORD_INSTALLING, Fw_Update.Length};
+    memcpy(record.Hash, Fw_Update.Hash, SHA256_SIZE);
+    SetFlashRecord(&record);
+    watchdog_hw->ctrl = WATCHDOG_CTRL_TRIGGER_BITS;
+    while (1) tight_loop_contents();
+}
+
+// Boot step. After an install the new image hashes itself against the
+// record and marks it done. If it doesn't match the loader had nothing good
+// to copy and left the old image running, so the install is given up on
+// rather than checked again every boot
+void CheckFirmwareInstall(){
+    FwRecordType record;
+    memcpy(&record, (const void*) (XIP_BASE + FW_RECORD_OFFSET), sizeof(record));
+    if (record.Magic != FW_RECORD_MAGIC || record.State != FW_RECORD_INSTALLING || record.Length > FW_BANK_SIZE) return;
+
+    uint8_t hash[SHA256_SIZE];
+    HashFlash(FW_APP_OFFSET, record.Length, hash);
+    bool installed = memcmp(hash, record.Hash, SHA256_SIZE) == 0;
+    record.State = installed ? FW_RECORD_INSTALLED : FW_RECORD_FAILED;
+    SetFlashRecord(&record);
+    Fw_Update.Installed = installed;
+}
+
+// Start taking a new image of length bytes that should hash to hash. The
+// staging bank is erased from the main loop first, blocks are refused until
+// it's done. Returns false if the image won't fit
+bool FwUpdateBegin(uint32_t length, const uint8_t* hash, TransportIdType transport){
+    if (length == 0 || length > FW_BANK_SIZE) return false;
+    memset(&Fw_Update, 0, sizeof(Fw_Update));
+    Fw_Update.Length = length;
+    memcpy(Fw_Update.Hash, hash, SHA256_SIZE);
+    Fw_Update.Transport = transport;
+    Fw_Update.State = FW_ERASING;
+    return true;
+}
+
+// Take block index of the image, base64 encoded in text. It's buffered right
+// away and programmed from the main loop. Blocks have to come in order, but
+// a block that was already taken is acknowledged again in case the ack got lost
+FwBlockResultType FwUpdateBlock(uint32_t index, uint32_t crc, const char* text, size_t len){
+    if (Fw_Update.State != FW_RECEIVING) return FW_BLOCK_NOT_READY;
+    if (index < Fw_Update.Blocks_Received) return FW_BLOCK_OK;
+    if (index != Fw_Update.Blocks_Received || index >= FW_BLOCKS(Fw_Update.Length)) return FW_BLOCK_OUT_OF_ORDER;
+    if (Fw_Update.Blocks_Received - Fw_Update.Blocks_Written >= FW_PIPELINE_BLOCKS) return FW_BLOCK_BUSY;
+
+    // The last block is padded out with erased flash
+    uint8_t* block = Fw_Pipeline[index % FW_PIPELINE_BLOCKS];
+    size_t expected = MIN(FW_BLOCK_SIZE, Fw_Update.Length - index * FW_BLOCK_SIZE);
+    memset(block, 0xFF, FW_BLOCK_SIZE);
+    if (DecodeBase64(text, len, block, FW_BLOCK_SIZE) != (int) expected || Crc32(block, expected) != crc) return FW_BLOCK_BAD;
+
+    uint64_t now = time_us_64();
+    if (index == 0) Fw_Update.First_Block_US = now;
+    Fw_Update.Last_Block_US = now;
+    Fw_Update.Wire_Bytes += len;
+    Fw_Update.Blocks_Received++;
+    return FW_BLOCK_OK;
+}
+
+// Program every block that's been buffered
+static void ProgramBlocks(){
+    while (Fw_Update.Blocks_Written < Fw_Update.Blocks_Received){
+        uint32_t index = Fw_Update.Blocks_Written;
+        uint32_t saved_irq = StartFlashWrite();
+        flash_range_program(FW_BANK_OFFSET + index * FW_BLOCK_SIZE, Fw_Pipeline[index % FW_PIPELINE_BLOCKS], FW_BLOCK_SIZE);
+        EndFlashWrite(saved_irq);
+        Fw_Update.Blocks_Written++;
+    }
+}
+
+// Once every block is in, program the last of them and hash the whole staging
+// bank. Returns true if it matches, the install follows FW_INSTALL_DELAY_MS later
+bool FwUpdateEnd(){
+    if (Fw_Update.State != FW_RECEIVING || Fw_Update.Blocks_Received != FW_BLOCKS(Fw_Update.Length)) return false;
+    ProgramBlocks();
+    uint8_t hash[SHA256_SIZE];
+    HashFlash(FW_BANK_OFFSET, Fw_Update.Length, hash);
+    if (memcmp(hash, Fw_Update.Hash, SHA256_SIZE) != 0){
+        Fw_Update.State = FW_FAILED;
+        return false;
+    }
+    Fw_Update.State = FW_VERIFIED;
+    Fw_Update.Install_At_US = time_us_64() + FW_INSTALL_DELAY_MS * 1000ull;
+    return true;
+}
+
+void FwUpdateAbort(){
+    Fw_Update.State = FW_IDLE;
+}
+
+bool FwUpdatingQ(){
+    return Fw_Update.State == FW_ERASING || Fw_Update.State == FW_RECEIVING || Fw_Update.State == FW_VERIFIED;
+}
+
+// Called from the main loop outside the alarm window. Erases, programs the
+// blocks that have come in and installs once verified. Returns true while
+// there's erasing left, so the main loop doesn't sleep in between
+bool FwUpdateStep(){
+    if (InAlarmWindowQ()) return false;
+    switch (Fw_Update.State){
+        case FW_ERASING: {
+            uint32_t start = time_us_32();
+            uint32_t length = FW_BLOCKS(Fw_Update.Length) * FW_BLOCK_SIZE;
+            while (Fw_Update.Erased < length && time_us_32() - start < FW_ERASE_BUDGET_US){
+                uint32_t saved_irq = StartFlashWrite();
+                flash_range_erase(FW_BANK_OFFSET + Fw_Update.Erased, FLASH_SECTOR_SIZE);
+                EndFlashWrite(saved_irq);
+                Fw_Update.Erased += FLASH_SECTOR_SIZE;
+            }
+            if (Fw_Update.Erased < length) return true;
+            Fw_Update.State = FW_RECEIVING;
+            return false;
+        }
+        case FW_RECEIVING:
+            ProgramBlocks();
+            return false;
+        case FW_VERIFIED:
+            if (time_us_64() >= Fw_Update.Install_At_US) Install();
+            return false;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef FWUPDATE_H
+#define FWUPDATE_H
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "Sha256.h"
+#include "Transport.h"
+
+// Flash layout: the loader (Loader.c, never rewritten) then Main in the
+// first half, the staging bank the new Main is streamed into in the second
+// and the install record at the end. CMakeLists.txt links both to match
+#ifndef FW_LOADER_SIZE
+#define FW_LOADER_SIZE              (32 * 1024)
+#endif
+#define FW_APP_OFFSET               FW_LOADER_SIZE
+#define FW_APP_VECTORS              (FW_APP_OFFSET + 256)   // Main keeps the SDK's boot2 in front of its vector table, only the loader's is run
+#define FW_BANK_OFFSET              (PICO_FLASH_SIZE_BYTES / 2)
+#define FW_BANK_SIZE                (FW_BANK_OFFSET - FW_APP_OFFSET)    // No bigger than where it's going
+#define FW_RECORD_OFFSET            (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define FW_RECORD_MAGIC             0x46575550  // "FWUP"
+
+// Defines
+#define FW_BLOCK_SIZE               FLASH_PAGE_SIZE     // One flash page per block
+#define FW_BLOCK_TEXT_SIZE          (4 * ((FW_BLOCK_SIZE + 2) / 3))     // Base64, fits in one TRANSPORT_MESSAGE_SIZE message
+#define FW_PIPELINE_BLOCKS          8           // Blocks acknowledged but not programmed yet
+#define FW_ERASE_BUDGET_US          100000      // Erase time per main loop pass, a sector takes ~45ms
+#define FW_INSTALL_DELAY_MS         500         // Time for the last reply to get out before installing
+#define FW_BLOCKS(LENGTH)           (((LENGTH) + FW_BLOCK_SIZE - 1) / FW_BLOCK_SIZE)
+
+// Types
+typedef enum FwUpdateStateEnum {
+    FW_IDLE,
+    FW_ERASING,             // Clearing the staging bank, blocks aren't taken yet
+    FW_RECEIVING,           // Taking blocks, programming them as the next ones come in
+    FW_VERIFIED,            // The whole image hashed right, installs once FW_INSTALL_DELAY_MS is up
+    FW_FAILED
+} FwUpdateStateType;
+
+typedef enum FwBlockResultEnum {FW_BLOCK_OK, FW_BLOCK_BUSY, FW_BLOCK_BAD, FW_BLOCK_OUT_OF_ORDER, FW_BLOCK_NOT_READY} FwBlockResultType;
+
+typedef enum FwRecordStateEnum {
+    FW_RECORD_INSTALLING = 0x494E5354,  // Set before resetting into the loader, which does the copy
+    FW_RECORD_INSTALLED = 0x444F4E45,   // Set by the new image once it has checked itself
+    FW_RECORD_FAILED = 0x4641494C       // Nothing good to copy, the old image carried on
+} FwRecordStateType;
+
+// Written to the last flash sector for the loader to act on at the next boot
+typedef struct FwRecordStruct {
+    uint32_t    Magic;
+    uint32_t    State;
+    uint32_t    Length;
+    uint8_t     Hash[SHA256_SIZE];
+} FwRecordType;
+
+typedef struct FwUpdateStruct {
+    FwUpdateStateType   State;
+    uint32_t            Length;                 // Image bytes
+    uint8_t             Hash[SHA256_SIZE];      // What the whole image has to hash to
+    uint32_t            Erased;                 // Bytes of the staging bank cleared so far
+    uint32_t            Blocks_Received;        // Also the next block expected
+    uint32_t            Blocks_Written;
+    uint32_t            Wire_Bytes;             // Message bytes the blocks took, encoding included
+    uint64_t            First_Block_US;
+    uint64_t            Last_Block_US;
+    TransportIdType     Transport;              // Link the blocks came in on
+    uint64_t            Install_At_US;
+    bool                Installed;              // This boot is the first of a freshly installed image
+} FwUpdateType;
+
+// Globals
+extern FwUpdateType Fw_Update;
+
+// Function Prototypes
+bool FwUpdateBegin(uint32_t length, const uint8_t* hash, TransportIdType transport);
+FwBlockResultType FwUpdateBlock(uint32_t index, uint32_t crc, const char* text, size_t len);
+bool FwUpdateEnd();
+void FwUpdateAbort();
+bool FwUpdateStep();
+bool FwUpdatingQ();
+void CheckFirmwareInstall();
+uint32_t Crc32(const uint8_t* data, size_t len);
+
+#endif
@@ -4,8 +4,10 @@
 #include "pico/stdlib.h"
 #include "hardware/uart.h"
 #include "hardware/gpio.h"
+#include "hardware/sync.h"
 #include "CommandList.h"
 #include "HC05.h"
+#include "HotPath.h"
 
 
 // ======================= Extra UART Functions ======================= //
@@ -81,14 +83,36 @@ static inline void uart_read(uart_inst_t *uart, uint8_t *dst, size_t len) {
 
 // ======================= HC05 Functions ======================= //
 
-// This function initializes the HC05 bluetooth module
+// Globals
+volatile bool BT_Powered = false;
+volatile BTResetStateType BT_Reset_State = BT_RESET_IDLE;
+volatile uint32_t BT_Last_Activity_MS = 0;
+static volatile bool BT_Received = false;          // Set by the UART interrupt, the main loop turns it into BT_Last_Activity_MS
+uint32_t BT_Idle_Off_MS = BT_IDLE_OFF_MS;           // Set by BTIdle, 0 keeps the module on
+bool BT_Initialized = false;
+bool BT_Commands_Enabled = false;
+TimerType BT_Power_Timer;
+TimerType BT_Reset_Timer;
+
+// This function starts up the HC05 bluetooth module without blocking.
+// The module is held off for BT_BOOT_DELAY_MS in the background and 
+// BluetoothPoweredQ() reports when it has been powered back on.
+// Calling it again later just wakes the module back up
 void InitializeBluetooth(){
+    // Everything is already set up, skip the boot delays
+    if (BT_Initialized){
+        BluetoothWake();
+        return;
+    }
+    BT_Initialized = true;
+
     // Configure SET and EN pins as outputs
     gpio_init(BLUETOOTH_SET_PIN);
     gpio_set_dir(BLUETOOTH_SET_PIN, GPIO_OUT);
     gpio_init(BLUETOOTH_PWR_PIN);
     gpio_set_dir(BLUETOOTH_PWR_PIN, GPIO_OUT);
     POWER_OFF_BLUETOOTH;
+    BT_Powered = false;
     // Configure rising edge interupt on STATE Pin
     gpio_init(BT_CONNECT_STATE_PIN);
     gpio_set_dir(BT_CONNECT_STATE_PIN, GPIO_IN);
@@ -100,20 +124,9 @@ void InitializeBluetooth(){
     // Set datasheet for more information on function select
     gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
-    // Keep powered off long enough for any devices to disconnect
-    sleep_ms(BT_BOOT_DELAY_MS);
-    // Start up in cmd mode first
-    BLUETOOTH_SET_DATA;
-    POWER_ON_BLUETOOTH;
-
-    // Now configure the UART RX interupts:
-    // first set up and enable the interrupt handlers
-    irq_set_exclusive_handler(BT_IRQ, BT_Data_Received);
-    irq_set_enabled(BT_IRQ, true);
-    // Then clear the UART RX FIFO (this essentially clears the UARTINTR flag as well)
-    uart_clear_rx_fifo(BLUETOOTH, UART_BYTE_DELAY);
-    // Now enable the UART to send interrupts - RX only
-    uart_set_irq_enables(BLUETOOTH, true, false);
+    // Keep powered off long enough for any devices to disconnect,
+    // the rest of the system keeps booting in the meantime
+    StartTimerMs(&BT_Power_Timer, BT_BOOT_DELAY_MS, 0, &BT_Power_On_Callback, NULL);
 
     // Power cycle to fix power draw issue
     // POWER_OFF_BLUETOOTH;
@@ -128,48 +141,204 @@ void InitializeBluetooth(){
     gpio_set_irq_enabled(BT_RESET_BTN_PIN, GPIO_IRQ_EDGE_RISE, true);
 }
 
-// UART RX interrupt handler
-void BT_Data_Received() {
-    // Note: this ISR gets called twice every time data is recived
-    // I'm not sure why, but it doesn't cause any issues so ¯\_(ツ)_/¯
-    
-    printf("Start\n");
+// Timer callback that ends the power-off hold started by InitializeBluetooth
+void BT_Power_On_Callback(TimerType* timer){
+    // Start up in data mode
+    BLUETOOTH_SET_DATA;
+    POWER_ON_BLUETOOTH;
+    BT_Powered = true;
+    BT_Last_Activity_MS = to_ms_since_boot(get_absolute_time());
+}
 
-    if(!uart_is_readable(BLUETOOTH)) return;
+bool BluetoothPoweredQ(){
+    return BT_Powered;
+}
 
-    uint8_t readbuffer[COMMAND_LENGTH];
+// Start accepting commands from the HC05
+void EnableBluetoothCommands(){
+    // Now configure the UART interupts:
+    // first set up and enable the interrupt handlers
+    irq_set_exclusive_handler(BT_IRQ, BT_UART_Callback);
+    irq_set_enabled(BT_IRQ, true);
+    // Then clear the UART RX FIFO (this essentially clears the UARTINTR flag as well)
+    uart_clear_rx_fifo(BLUETOOTH, UART_BYTE_DELAY);
+    Transports[TRANSPORT_BT].Enabled = true;
+    BT_Commands_Enabled = true;
+    // Now enable the UART to send interrupts, RX and (if anything is
+    // already queued, like the welcome message) TX. This also sets the FIFO
+    // trigger levels, from here on the interrupt only flips the TX enable
+    uart_set_irq_enables(BLUETOOTH, true, false);
+    BluetoothKick();
+}
 
-    // Read BT_CMD_LENGTH bytes from the FIFO
-    uart_read_blocking_within_us(BLUETOOTH, readbuffer, COMMAND_LENGTH, BT_READ_TIMEOUT_US, UART_BYTE_DELAY);
+// Power the HC05 down and park the UART so the module isn't powered
+// through its RX pin while it's off. The duty cycle waits for the TX queue
+// to drain first, anything queued after that is held until the module wakes
+void BluetoothSleep(){
+    uart_set_irq_enables(BLUETOOTH, false, false);
+    gpio_set_function(UART_TX_PIN, GPIO_FUNC_SIO);
+    gpio_set_dir(UART_TX_PIN, GPIO_OUT);
+    gpio_put(UART_TX_PIN, 0);
+    POWER_OFF_BLUETOOTH;
+    BT_Powered = false;
+}
 
-    // See if first (COMMAND_LENGTH) bytes of the RX data correspond
-    // to a command in the CommandLookup table and call the appropriate 
-    // callback function if they do
-    uint8_t i;
-    for (i = 0; i < NUMBER_OF_COMMANDS; i++){
-        if (strncmp((char*) readbuffer, CommandLookup[i].CmdName, COMMAND_LENGTH) == 0){
-            CommandLookup[i].Callback();    // Call proper command function
-            break;                          // Stop looping when we find the right command
-        }
+// Power the HC05 straight back up and put the UART back the way 
+// InitializeBluetooth left it, no boot delays needed. Called from the
+// reset button's ISR as well as the main loop, so powering up is masked
+// and only ever happens once
+void BluetoothWake(){
+    BT_Last_Activity_MS = to_ms_since_boot(get_absolute_time());
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (BT_Powered){
+        restore_interrupts(saved_irq);
+        return;
+    }
+    uart_set_baudrate(BLUETOOTH, DATA_MODE_BAUD_RATE);
+    gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
+    BLUETOOTH_SET_DATA;
+    POWER_ON_BLUETOOTH;
+    BT_Powered = true;
+    restore_interrupts(saved_irq);
+    if (BT_Commands_Enabled){
+        // Throw away whatever the RX pin picked up while the module was off,
+        // with no delay between bytes since this can be the button's ISR
+        while (uart_is_readable(BLUETOOTH)) (void) uart_get_hw(BLUETOOTH)->dr;
+        uart_set_irq_enables(BLUETOOTH, true, false);
     }
+}
 
-    // Always finish by clearing the UART RX FIFO
-    uart_clear_rx_fifo(BLUETOOTH, UART_BYTE_DELAY);
-    CLEAR_UART_RX_FLAG(BLUETOOTH);
+// Returns true iff an alarm window opens within the next BT_WAKE_BEFORE_WINDOW_S seconds
+bool AlarmWindowSoonQ(){
+    AlarmStateType state;
+    ReadAlarmState(&state);
+    if (state.In_Alarm_Window || state.Alarm_Window_Start.year == 0) return false;
+    datetime_t current_time;
+    rtc_get_datetime(&current_time);
+    long seconds = TimeDifferenceSec(current_time, state.Alarm_Window_Start);
+    return seconds >= 0 && seconds <= BT_WAKE_BEFORE_WINDOW_S;
+}
+
+// A message (an alarm change, say) that hasn't been run yet, or a reply
+// that hasn't all gone out. Powering off now would lose it
+static bool BluetoothBusyQ(){
+    TransportType* transport = &Transports[TRANSPORT_BT];
+    return QueueUsed(&transport->RX) > 0 || TimerPendingQ(&transport->Gap_Timer) || QueueUsed(&transport->TX) > 0;
+}
+
+// Called from the main loop, decides whether the HC05 should be powered.
+// It stays on while someone is connected or has talked to us in the last 
+// BT_Idle_Off_MS, while a message or its reply is still going through,
+// during each advertising slot, and ahead of alarm windows
+void BluetoothDutyCycle(){
+    // The reset button's power cycle is in charge while it runs
+    if (BT_Reset_State != BT_RESET_IDLE) return;
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if (BT_Powered && gpio_get(BT_CONNECT_STATE_PIN)) BT_Last_Activity_MS = now;
+    if (BT_Received){
+        BT_Received = false;
+        BT_Last_Activity_MS = now;
+    }
+
+    bool want_on = BT_Idle_Off_MS == 0 || (now - BT_Last_Activity_MS) < BT_Idle_Off_MS;
+    want_on = want_on || BluetoothBusyQ();
+    want_on = want_on || (now % BT_ADVERTISE_PERIOD_MS) < BT_ADVERTISE_SLOT_MS;
+    want_on = want_on || AlarmWindowSoonQ();
+
+    if (want_on && !BT_Powered){
+        BluetoothWake();
+    }else if (!want_on && BT_Powered){
+        BluetoothSleep();
+    }
+}
 
-    printf("Stop\n");
+// Top the UART's TX FIFO up from the Bluetooth transport's queue and leave
+// the TX interrupt on only while there's more to send. Interrupts must be masked
+static void HOT_PATH_FUNC(BluetoothFillTX)(){
+    ByteQueueType* tx = &Transports[TRANSPORT_BT].TX;
+    uint8_t byte;
+    // Hold on to it while the module is off, but don't let the TX interrupt keep firing
+    if (!BT_Commands_Enabled || !BT_Powered){
+        hw_clear_bits(&uart_get_hw(BLUETOOTH)->imsc, UART_UARTIMSC_TXIM_BITS);
+        return;
+    }
+    while (uart_is_writable(BLUETOOTH) && QueueGet(tx, &byte)){
+        uart_get_hw(BLUETOOTH)->dr = byte;
+    }
+    // Straight to the register, uart_set_irq_enables() is in flash
+    if (QueueUsed(tx) > 0) hw_set_bits(&uart_get_hw(BLUETOOTH)->imsc, UART_UARTIMSC_TXIM_BITS);
+    else hw_clear_bits(&uart_get_hw(BLUETOOTH)->imsc, UART_UARTIMSC_TXIM_BITS);
+}
+
+// Start sending whatever has been queued. The UART only interrupts as its TX
+// FIFO drains past the trigger level, so it has to be primed by hand
+void BluetoothKick(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    BluetoothFillTX();
+    restore_interrupts(saved_irq);
+}
+
+// UART interrupt handler, just moves bytes between the FIFOs and the
+// Bluetooth transport's queues. Messages are run by ServiceTransports()
+void HOT_PATH_FUNC(BT_UART_Callback)(){
+    bool received = false;
+    while (uart_is_readable(BLUETOOTH)){
+        TransportReceived(TRANSPORT_BT, (uint8_t) uart_get_hw(BLUETOOTH)->dr);
+        received = true;
+    }
+    if (received) BT_Received = true;
+    BluetoothFillTX();
 }
 
 // ISR for rising edge interupt on STATE pin
 // called every time a user connects
 void BT_Connect_Callback(uint gpio, uint32_t events){
     if (gpio == BT_CONNECT_STATE_PIN){
+        BT_Last_Activity_MS = to_ms_since_boot(get_absolute_time());
         BLUETOOTH_SEND("Welcome!\nFor a list of commands type HelpInfo.\nFor information about a specific command type HelpInfo <Command Name>\n");
     }
     if (gpio == BT_RESET_BTN_PIN){
-        POWER_OFF_BLUETOOTH;
-        busy_wait_ms(BT_RESET_TIME_MS);
-        POWER_ON_BLUETOOTH;
+        // Only start a power cycle from idle, presses during one are ignored
+        if (BT_Reset_State != BT_RESET_IDLE) return;
+        // If the module was duty cycled off the press just wakes it up
+        if (!BT_Powered){
+            BluetoothWake();
+            BT_Reset_State = BT_RESET_HOLD;
+            StartTimerMs(&BT_Reset_Timer, BT_RESET_HOLD_MS, 0, &BT_Reset_Callback, NULL);
+            return;
+        }
+        // Check the button is still held once it has stopped bouncing
+        BT_Reset_State = BT_RESET_DEBOUNCE;
+        StartTimerMs(&BT_Reset_Timer, BT_RESET_DEBOUNCE_MS, 0, &BT_Reset_Callback, NULL);
+    }
+}
+
+// Timer callback that steps the reset button power cycle along:
+// debounce -> off for BT_RESET_TIME_MS -> on -> hold before accepting presses again
+void BT_Reset_Callback(TimerType* timer){
+    switch (BT_Reset_State){
+        case BT_RESET_DEBOUNCE:
+            // Ignore glitches that were gone before the debounce time ran out
+            if (!gpio_get(BT_RESET_BTN_PIN)){
+                BT_Reset_State = BT_RESET_IDLE;
+                return;
+            }
+            POWER_OFF_BLUETOOTH;
+            BT_Powered = false;
+            BT_Reset_State = BT_RESET_OFF;
+            StartTimerMs(timer, BT_RESET_TIME_MS, 0, &BT_Reset_Callback, NULL);     // When to power back on
+            return;
+        case BT_RESET_OFF:
+            POWER_ON_BLUETOOTH;
+            BT_Powered = true;
+            BT_Last_Activity_MS = to_ms_since_boot(get_absolute_time());
+            BT_Reset_State = BT_RESET_HOLD;
+            StartTimerMs(timer, BT_RESET_HOLD_MS, 0, &BT_Reset_Callback, NULL);     // The end of the hold
+            return;
+        default:
+            BT_Reset_State = BT_RESET_IDLE;
+            return;
     }
 }
 
@@ -3,6 +3,8 @@
 
 #include "pico/stdlib.h"
 #include "hardware/uart.h"
+#include "Transport.h"
+#include "TimerWheel.h"
 
 // Bluetooth configs 
 #define BLUETOOTH_NAME          "BT Alarm Clock"
@@ -32,17 +34,34 @@
 
 #define BT_RESET_BTN_PIN        15
 #define BT_RESET_TIME_MS        2000     
+#define BT_RESET_DEBOUNCE_MS    30              // Button has to still be pressed after this long
+#define BT_RESET_HOLD_MS        500             // Presses are ignored for this long after powering back on
+
+// Duty cycling, the HC05 is only powered while it might be needed
+#define BT_IDLE_OFF_MS          300000          // Power off after 5 min without a connection or command, until BTIdle says otherwise
+#define BT_IDLE_OFF_MAX_MIN     1440            // Longest BTIdle takes
+#define BT_ADVERTISE_PERIOD_MS  1800000         // Power up for an advertising slot every 30 min
+#define BT_ADVERTISE_SLOT_MS    120000          // that lasts 2 min
+#define BT_WAKE_BEFORE_WINDOW_S 600             // Power up 10 min before an alarm window opens
 
 // Macros
 #define POWER_ON_BLUETOOTH          gpio_set_mask(1ul << BLUETOOTH_PWR_PIN)
 #define POWER_OFF_BLUETOOTH         gpio_clr_mask(1ul << BLUETOOTH_PWR_PIN)
 #define BLUETOOTH_SET_DATA          gpio_clr_mask(1ul << BLUETOOTH_SET_PIN)
 #define BLUETOOTH_SET_CMD           gpio_set_mask(1ul << BLUETOOTH_SET_PIN)
-#define BLUETOOTH_SEND(DATA)        (uart_puts(BLUETOOTH,DATA))
+#define BLUETOOTH_SEND(DATA)        (TransportSend(TRANSPORT_BT,DATA))
 #define CLEAR_UART_RX_FLAG(UART)    uart_get_hw(UART)->icr &= (0x01 << 4)
 
+// Types
+// States of the reset button power cycle
+typedef enum BTResetStateEnum {BT_RESET_IDLE, BT_RESET_DEBOUNCE, BT_RESET_OFF, BT_RESET_HOLD} BTResetStateType;
+
+// Globals
+extern uint32_t BT_Idle_Off_MS;
+
 // Function Prototypes
-void BT_Data_Received();
+void BT_UART_Callback();
+void BluetoothKick();
 
 void uart_clear_rx_fifo(uart_inst_t *uart, uint32_t read_delay);
 static inline void uart_read(uart_inst_t *uart, uint8_t *dst, size_t len);
@@ -50,7 +69,15 @@ static inline void uart_read_blocking_within_us(uart_inst_t *uart, uint8_t *dst,
 size_t uart_read_until_within_us(uart_inst_t *uart, uint8_t *dst, uint8_t end_byte, uint16_t count_to,size_t buffer_size, uint32_t timeout, uint32_t read_delay);
 
 void BT_Connect_Callback(uint gpio, uint32_t events);
+void BT_Reset_Callback(TimerType* timer);
 void InitializeBluetooth();
+void BT_Power_On_Callback(TimerType* timer);
+bool BluetoothPoweredQ();
+void EnableBluetoothCommands();
+void BluetoothSleep();
+void BluetoothWake();
+bool AlarmWindowSoonQ();
+void BluetoothDutyCycle();
 void SetBluetoothDataMode();
 void SetBluetoothCmdMode();
 bool TestBluetooth();
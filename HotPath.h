@@ -0,0 +1,59 @@
+#ifndef HOTPATH_H
+#define HOTPATH_H
+
+#include "pico/stdlib.h"
+
+// Code run from XIP flash stalls on every cache miss while the QSPI fetches
+// it, and for the whole of a flash erase or program. The ISRs and the
+// sensing loop are marked with these so they're copied to SRAM at boot
+// instead. SNOOZE_RAM_HOT_PATH (a CMake option, on by default) turns it off
+// to get the flash back, Jitter shows what that costs. The host tools build
+// the same sources without the SDK's section macros, so they're no-ops there
+//
+// What's marked is every interrupt handler and timer callback between a zone
+// reading and the buzzer (zone DMA, latency probe, timer wheel, buzzer,
+// Bluetooth UART and message gaps) along with everything they call, and the
+// alarm window's pass through the main loop: the sensors, the wake rules,
+// the buzzer, the night summary and sleeping until the next pass. The
+// compiler's division, float, 64 bit and memcpy helpers come along through
+// the PICO_*_IN_RAM definitions in CMakeLists.txt. Left in flash on purpose
+// are the housekeeping the main loop does every pass (boot steps, commands,
+// the watchdog and retained state, tracing), everything between windows,
+// EnterFullPower() and the other clock speed changes, the window timer that
+// opens and closes the alarm window, and the callbacks that
+// only run now and then (the Bluetooth button and connect pin, the watchdog
+// wake, lining up with the RTC). None of those are between a reading and the
+// buzzer, though a pass can wait on the housekeeping being fetched
+
+#if defined(SNOOZE_RAM_HOT_PATH) && defined(__not_in_flash_func)
+#define HOT_PATH_RAM                1
+#define HOT_PATH_FUNC(name)         __not_in_flash_func(name)
+#define HOT_PATH_DATA               __not_in_flash("hot_path")
+#else
+#define HOT_PATH_RAM                0
+#define HOT_PATH_FUNC(name)         name
+#define HOT_PATH_DATA
+#endif
+
+// time_us_64() is a call into flash, this reads the timer directly. The high
+// word is read either side of the low one so a carry between the two reads
+// can't be missed. The host tools have no timer, theirs is time_us_64()
+#ifdef __not_in_flash_func
+#include "hardware/structs/timer.h"
+
+static inline uint64_t TimerNowUs(){
+    uint32_t high = timer_hw->timerawh;
+    while (true){
+        uint32_t low = timer_hw->timerawl;
+        uint32_t check = timer_hw->timerawh;
+        if (check == high) return ((uint64_t) high << 32) | low;
+        high = check;
+    }
+}
+#else
+static inline uint64_t TimerNowUs(){
+    return time_us_64();
+}
+#endif
+
+#endif
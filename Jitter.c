@@ -0,0 +1,105 @@
+#include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "hardware/regs/addressmap.h"
+#include "hardware/regs/m0plus.h"
+#include "Jitter.h"
+#include "TimerWheel.h"
+
+// Times how long the core takes to get into an interrupt handler, with the
+// handler in SRAM and in flash, and with the XIP cache warm and freshly
+// flushed. The cold flash case is what an ISR left in flash pays after the
+// main loop or core 1 has pushed it out of the cache, which is what
+// HotPath.h is there to avoid. Both handlers are built the same way
+// whatever SNOOZE_RAM_HOT_PATH says, so one build shows the difference. The
+// timer wheel's alarm handler is timed too, as a real handler that goes
+// wherever SNOOZE_RAM_HOT_PATH puts it. Pending it early is harmless, it
+// runs anything that's due, finds the rest isn't and re-arms
+
+// Globals
+const char* JitterPlacementNames[NUMBER_OF_JITTER_PLACEMENTS] = {"SRAM", "flash", "timer wheel"};
+const char* JitterCacheNames[NUMBER_OF_JITTER_CACHES] = {"warm", "cold"};
+static int Jitter_IRQ = -1;
+static volatile uint32_t Jitter_Entry;          // SysTick as the handler started
+
+// The two handlers do the same thing, only where they live differs. The
+// SysTick read is the only thing they do
+static void __not_in_flash_func(Jitter_SRAM_Callback)(){
+    Jitter_Entry = systick_hw->cvr;
+}
+
+static void Jitter_Flash_Callback(){
+    Jitter_Entry = systick_hw->cvr;
+}
+
+// One interrupt on irq, pended with interrupts masked then let in. Its
+// handler leaves SysTick in entry. Everything here runs from SRAM so the
+// flush only costs the handler. Interrupts are masked on the way in and
+// out. Returns SysTick cycles, 0 if the handler never ran
+static uint32_t __not_in_flash_func(JitterShot)(uint irq, volatile uint32_t* entry, bool cold){
+    *entry = JITTER_NOT_TAKEN;
+    if (cold){
+        xip_ctrl_hw->flush = 1;
+        // Reading it back waits for the flush to finish
+        (void) xip_ctrl_hw->flush;
+    }
+    *((io_rw_32*) (PPB_BASE + M0PLUS_NVIC_ISPR_OFFSET)) = 1u << irq;
+    uint32_t start = systick_hw->cvr;
+    __asm volatile ("cpsie i" : : : "memory");
+    __asm volatile ("cpsid i" : : : "memory");
+    if (*entry == JITTER_NOT_TAKEN) return 0;
+    // SysTick counts down
+    return (start - *entry) & 0x00FFFFFF;
+}
+
+// Take JITTER_SHOTS interrupts into each handler and cache state, taking
+// turns so they all see the same conditions. SysTick is borrowed the same
+// way Motion bench does. Returns false if there's no spare IRQ to use
+bool RunJitterBench(JitterStatsType* stats){
+    if (Jitter_IRQ < 0) Jitter_IRQ = user_irq_claim_unused(false);
+    if (Jitter_IRQ < 0) return false;
+    irq_set_priority(Jitter_IRQ, PICO_HIGHEST_IRQ_PRIORITY);
+    for (uint8_t p = 0; p < NUMBER_OF_JITTER_PLACEMENTS; p++){
+        for (uint8_t c = 0; c < NUMBER_OF_JITTER_CACHES; c++) ResetStats(&stats->Entry_Cycles[p][c], 0, JITTER_LOG2_BUCKET_CYCLES);
+    }
+    stats->Missed = 0;
+
+    for (uint16_t shot = 0; shot < JITTER_SHOTS * NUMBER_OF_JITTER_PLACEMENTS * NUMBER_OF_JITTER_CACHES; shot++){
+        JitterPlacementType placement = shot % NUMBER_OF_JITTER_PLACEMENTS;
+        JitterCacheType cache = (shot / NUMBER_OF_JITTER_PLACEMENTS) % NUMBER_OF_JITTER_CACHES;
+        uint irq = Jitter_IRQ;
+        volatile uint32_t* entry = &Jitter_Entry;
+        if (placement == JITTER_TIMER_WHEEL){
+            // Already installed and enabled, it keeps its own priority
+            irq = TimerAlarmIRQ();
+            entry = &Timer_IRQ_Entry;
+        }else{
+            // The vector table is in SRAM, so swapping handlers is just a write
+            irq_set_exclusive_handler(Jitter_IRQ, (placement == JITTER_SRAM) ? &Jitter_SRAM_Callback : &Jitter_Flash_Callback);
+            irq_set_enabled(Jitter_IRQ, true);
+        }
+
+        uint32_t saved_irq = save_and_disable_interrupts();
+        uint32_t csr = systick_hw->csr, rvr = systick_hw->rvr;
+        systick_hw->rvr = 0x00FFFFFF;
+        systick_hw->cvr = 0;
+        // Processor clock, no interrupt
+        systick_hw->csr = 0x05;
+        // Take one first so a warm shot really does find the handler in the cache
+        if (cache == JITTER_WARM) JitterShot(irq, entry, false);
+        uint32_t cycles = JitterShot(irq, entry, cache == JITTER_COLD);
+        systick_hw->rvr = rvr;
+        systick_hw->csr = csr;
+        restore_interrupts(saved_irq);
+
+        if (placement != JITTER_TIMER_WHEEL){
+            irq_set_enabled(Jitter_IRQ, false);
+            irq_remove_handler(Jitter_IRQ, (placement == JITTER_SRAM) ? &Jitter_SRAM_Callback : &Jitter_Flash_Callback);
+        }
+        if (cycles == 0) stats->Missed++;
+        else AddStatsSample(&stats->Entry_Cycles[placement][cache], cycles);
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef JITTER_H
+#define JITTER_H
+
+#include "pico/stdlib.h"
+#include "Stats.h"
+
+// Defines
+#define JITTER_SHOTS                64          // Interrupts taken per handler and cache state
+#define JITTER_LOG2_BUCKET_CYCLES   5           // 32 cycle buckets, the last holds anything over ~500
+#define JITTER_NOT_TAKEN            UINT32_MAX  // SysTick is only 24 bits, so no handler ever reads this
+
+// Types
+// Where the handler being timed runs from, and whether the XIP cache was
+// flushed first so a flash handler has to come all the way from the QSPI.
+// The timer wheel is its real alarm handler, wherever this build put it
+typedef enum JitterPlacementEnum {JITTER_SRAM, JITTER_FLASH, JITTER_TIMER_WHEEL, NUMBER_OF_JITTER_PLACEMENTS} JitterPlacementType;
+typedef enum JitterCacheEnum {JITTER_WARM, JITTER_COLD, NUMBER_OF_JITTER_CACHES} JitterCacheType;
+
+typedef struct JitterStatsStruct {
+    RunningStatsType    Entry_Cycles[NUMBER_OF_JITTER_PLACEMENTS][NUMBER_OF_JITTER_CACHES];    // Unmasking a pending interrupt to the handler's first read
+    uint32_t            Missed;                                                                 // Shots the handler didn't answer
+} JitterStatsType;
+
+// Globals
+extern const char* JitterPlacementNames[NUMBER_OF_JITTER_PLACEMENTS];
+extern const char* JitterCacheNames[NUMBER_OF_JITTER_CACHES];
+
+// Function Prototypes
+bool RunJitterBench(JitterStatsType* stats);
+
+#endif
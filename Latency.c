@@ -0,0 +1,170 @@
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+#include "build/Latency.pio.h"
+#include "Latency.h"
+#include "Buzzer.h"
+#include "AlarmState.h"
+#include "HotPath.h"
+
+// Measures what actually matters about the alarm, the time from weight
+// crossing the threshold to the buzzer starting, through the sensing pass,
+// the wake rules, StartBeepingPIOBuzzer and the beep timer. A spare state
+// machine next to the buzzer's does the timing, the CPU only hands it the
+// start edge (in ADC mode) and collects the counts
+
+// Globals
+const char* LatencyTriggerNames[NUMBER_OF_LATENCY_TRIGGERS] = {"adc", "gpio"};
+static PIO Latency_PIO;
+static int Latency_SM = -1;
+static uint Latency_Offset;
+static LatencyTriggerType Latency_Trigger = LATENCY_TRIGGER_ADC;
+static LatencyStatsType Latency_Stats;
+static volatile bool Latency_In_Window = false;
+static uint32_t Latency_Trip[NUMBER_OF_ZONES];          // Sensitivity times threshold, what 100 times the reading has to reach
+static uint16_t Latency_Hysteresis[NUMBER_OF_ZONES];
+static uint8_t Latency_Zone_Mask;
+static bool Latency_Below = false;                      // Seen under the trip point this window, so the next reading over it is a crossing
+static bool Latency_Triggered = false;
+
+// True from the trigger edge until the count is pushed
+static bool HOT_PATH_FUNC(ProbeTimingQ)(){
+    uint8_t pc = pio_sm_get_pc(Latency_PIO, Latency_SM) - Latency_Offset;
+    return pc >= latency_probe_offset_count - 1 && pc <= latency_probe_offset_count + 1;
+}
+
+// Throw away whatever the probe is timing and wait for the trigger to go low again
+static void HOT_PATH_FUNC(RestartProbe)(){
+    pio_sm_set_enabled(Latency_PIO, Latency_SM, false);
+    pio_sm_clear_fifos(Latency_PIO, Latency_SM);
+    pio_sm_restart(Latency_PIO, Latency_SM);
+    pio_sm_exec(Latency_PIO, Latency_SM, pio_encode_jmp(Latency_Offset));
+    pio_sm_set_enabled(Latency_PIO, Latency_SM, true);
+}
+
+static void HOT_PATH_FUNC(SetTriggerPin)(bool high){
+    Latency_Triggered = high;
+    if (Latency_Trigger == LATENCY_TRIGGER_ADC) gpio_put(LATENCY_TRIGGER_PIN, high);
+}
+
+// Give up on a crossing that's still being timed
+static void HOT_PATH_FUNC(AbandonTiming)(){
+    if (ProbeTimingQ()){
+        RestartProbe();
+        Latency_Stats.Abandoned++;
+    }
+}
+
+// RX FIFO not empty, each count is one latency
+static void HOT_PATH_FUNC(Latency_PIO_Callback)(){
+    while (!pio_sm_is_rx_fifo_empty(Latency_PIO, Latency_SM)){
+        uint32_t count = pio_sm_get(Latency_PIO, Latency_SM);
+        uint64_t latency_us = (uint64_t) count * LATENCY_US_PER_COUNT;
+        AddStatsSample(&Latency_Stats.Latency_US, (latency_us > INT32_MAX) ? INT32_MAX : latency_us);
+    }
+}
+
+// Boot step, after the buzzer so its pin is set up. The probe's clock is
+// only right at full speed, which the alarm window always runs at
+void InitializeLatencyProbe(){
+    ResetLatencyStats();
+    gpio_init(LATENCY_TRIGGER_PIN);
+    SetLatencyTrigger(Latency_Trigger);
+
+    Latency_PIO = pio0;
+    Latency_Offset = pio_add_program(Latency_PIO, &latency_probe_program);
+    Latency_SM = pio_claim_unused_sm(Latency_PIO, true);
+    latency_probe_program_init(Latency_PIO, Latency_SM, Latency_Offset, LATENCY_TRIGGER_PIN, PIO_BUZZER_PIN, (float) clock_get_hz(clk_sys) / LATENCY_PIO_HZ);
+
+    pio_set_irq1_source_enabled(Latency_PIO, pis_sm0_rx_fifo_not_empty + Latency_SM, true);
+    irq_set_exclusive_handler(PIO0_IRQ_1, &Latency_PIO_Callback);
+    irq_set_enabled(PIO0_IRQ_1, true);
+}
+
+// ADC drives the trigger pin from the zone readings, GPIO leaves it as an
+// input for a test rig, pulled low so a loose wire doesn't time anything
+void SetLatencyTrigger(LatencyTriggerType trigger){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    Latency_Trigger = trigger;
+    Latency_Triggered = false;
+    if (trigger == LATENCY_TRIGGER_ADC){
+        gpio_disable_pulls(LATENCY_TRIGGER_PIN);
+        gpio_put(LATENCY_TRIGGER_PIN, 0);
+        gpio_set_dir(LATENCY_TRIGGER_PIN, GPIO_OUT);
+    }else{
+        gpio_set_dir(LATENCY_TRIGGER_PIN, GPIO_IN);
+        gpio_pull_down(LATENCY_TRIGGER_PIN);
+    }
+    if (Latency_SM >= 0) RestartProbe();
+    restore_interrupts(saved_irq);
+}
+
+LatencyTriggerType GetLatencyTrigger(){
+    return Latency_Trigger;
+}
+
+// Called as the alarm window opens and closes. Crossings only count inside
+// it, and the trip points can't change while it's open so they're kept here
+// for the ADC interrupt. Anything still being timed as it closes never got a buzzer
+void LatencyWindow(bool open){
+    if (Latency_SM < 0){
+        Latency_In_Window = open;
+        return;
+    }
+    AlarmStateType state;
+    ReadAlarmState(&state);
+    uint32_t saved_irq = save_and_disable_interrupts();
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        Latency_Trip[i] = (uint32_t) state.Scale_Sensitivity[i] * state.Threshold[i];
+        Latency_Hysteresis[i] = state.Hysteresis[i];
+    }
+    Latency_Zone_Mask = state.Zone_Mask;
+    Latency_Below = false;
+    // Anything a test rig started while the window was shut is thrown away
+    if (open) RestartProbe();
+    else AbandonTiming();
+    SetTriggerPin(false);
+    Latency_In_Window = open;
+    restore_interrupts(saved_irq);
+}
+
+// Called from the ADC interrupt with every new set of zone readings. Raises
+// the trigger on the first reading over any counted zone's trip point, once
+// the bed has been seen empty this window, and drops it once every zone is
+// back under by its hysteresis. A crossing that empties again before the
+// buzzer goes is abandoned so it doesn't get timed to some later beep
+void HOT_PATH_FUNC(LatencyCheckZones)(const volatile uint16_t* readings){
+    if (!Latency_In_Window || Latency_Trigger != LATENCY_TRIGGER_ADC) return;
+    bool over = false, under = true;
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (!(Latency_Zone_Mask & ZONE_BIT(i))) continue;
+        if (100 * (uint32_t) readings[i] >= Latency_Trip[i]) over = true;
+        if (100 * ((uint32_t) readings[i] + Latency_Hysteresis[i]) >= Latency_Trip[i]) under = false;
+    }
+    if (over && Latency_Below && !Latency_Triggered){
+        SetTriggerPin(true);
+        Latency_Stats.Crossings++;
+    }else if (under){
+        if (Latency_Triggered){
+            AbandonTiming();
+            SetTriggerPin(false);
+        }
+        Latency_Below = true;
+    }
+}
+
+void ResetLatencyStats(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    ResetStats(&Latency_Stats.Latency_US, 0, LATENCY_LOG2_BUCKET_US);
+    Latency_Stats.Crossings = 0;
+    Latency_Stats.Abandoned = 0;
+    restore_interrupts(saved_irq);
+}
+
+void GetLatencyStats(LatencyStatsType* stats){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    *stats = Latency_Stats;
+    restore_interrupts(saved_irq);
+}
@@ -0,0 +1,39 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "pico/stdlib.h"
+#include "Stats.h"
+
+// Defines
+#define LATENCY_TRIGGER_PIN         16          // Spare GPIO, driven on the threshold crossing or by a test rig
+#define LATENCY_PIO_HZ              1000000     // Probe state machine clock
+#define LATENCY_CYCLES_PER_COUNT    2           // The probe's count loop is two instructions
+#define LATENCY_US_PER_COUNT        (LATENCY_CYCLES_PER_COUNT * 1000000 / LATENCY_PIO_HZ)
+#define LATENCY_LOG2_BUCKET_US      16          // 65.5ms buckets, the last holds anything over ~1s
+
+// Types
+// Where the probe's start edge comes from. ADC raises the trigger pin on
+// the first reading over a zone's trip point, so it misses the time the
+// FSR takes to settle. GPIO leaves it to a rig that drives the bed sensor's
+// input and the trigger pin together
+typedef enum LatencyTriggerEnum {LATENCY_TRIGGER_ADC, LATENCY_TRIGGER_GPIO, NUMBER_OF_LATENCY_TRIGGERS} LatencyTriggerType;
+
+typedef struct LatencyStatsStruct {
+    RunningStatsType    Latency_US;     // Trigger edge to the buzzer pin going high
+    uint32_t            Crossings;      // Trigger edges raised by the ADC
+    uint32_t            Abandoned;      // Timed but the bed emptied or the window closed before the buzzer went
+} LatencyStatsType;
+
+// Globals
+extern const char* LatencyTriggerNames[NUMBER_OF_LATENCY_TRIGGERS];
+
+// Function Prototypes
+void InitializeLatencyProbe();
+void SetLatencyTrigger(LatencyTriggerType trigger);
+LatencyTriggerType GetLatencyTrigger();
+void LatencyWindow(bool open);
+void LatencyCheckZones(const volatile uint16_t* readings);
+void ResetLatencyStats();
+void GetLatencyStats(LatencyStatsType* stats);
+
+#endif
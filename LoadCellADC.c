@@ -1,17 +1,11 @@
 #include "pico/stdlib.h"
 #include "LoadCellADC.h"
+#include "HotPath.h"
 #include "hardware/gpio.h"
 
-// Externs
-extern int32_t Scale_Zero_Offset;
-extern int32_t Scale_Threshold;
-extern uint8_t Scale_Sensitivity;
-extern bool In_Alarm_Window;
-extern datetime_t Alarm_Window_Start;
-extern datetime_t Alarm_Window_Stop;
-
 // Globals
 ScaleGainType Scale_Gain = A128;
+int32_t Scale_Zero_Offset = SCALE_LBS_OFFSET;
 
 void InitializeScale(){
     // Configure Clock and Data pins
@@ -21,11 +15,17 @@ void InitializeScale(){
     gpio_init(SCALE_DT_PIN);
     gpio_set_dir(SCALE_DT_PIN, GPIO_IN);
     gpio_pull_down(SCALE_DT_PIN);
-    // Set inital gain of the sensor
-    SetScaleGain(A128);
+    // A128 is the HX711's power up gain, and every read clocks out the
+    // gain for the next conversion, so there's no need to block here
+    Scale_Gain = A128;
+}
+
+// Returns true iff the HX711 has a conversion ready (DT pulled low)
+bool HOT_PATH_FUNC(ScaleReadyQ)(){
+    return !READ_SCALE_DT_PIN;
 }
 
-int32_t ReadScaleWeight(){
+int32_t HOT_PATH_FUNC(ReadScaleWeight)(){
     int32_t ReceiveValue = 0;
     // Wait for DT to drop low to indicate data is ready
     while (READ_SCALE_DT_PIN) tight_loop_contents();
@@ -55,20 +55,6 @@ int32_t ReadScaleWeight(){
     return ReceiveValue;
 }
 
-int32_t SampleScaleWeight(){
-    int64_t Weight = 0;
-    // Sample WEIGHT_SAMPLES times
-    for (uint8_t i; i < SCALE_SAMPLES; i++){
-        // Sample the current weight
-        Weight += (int64_t) ReadScaleWeight();
-        // Apply zero offset 
-        Weight -= Scale_Zero_Offset;
-    }
-    // Convert sum to average weight
-    Weight = Weight >> LOG2_SCALE_SAMPLES;
-    return (int32_t) Weight;
-}
-
 void SetScaleGain(ScaleGainType Gain){
     Scale_Gain = Gain;
     // Wait for DT to drop low before we cycle the clock
@@ -12,10 +12,16 @@
 #define SCALE_SCK_HIGH_US           1
 #define SCALE_SCK_LOW_US            1
 
-#define LOG2_SCALE_SAMPLES          4   // So we sample 16 times per measurement
-#define SCALE_SAMPLES               0x01 << LOG2_SCALE_SAMPLES
+#define LOG2_SCALE_SAMPLES          3   // The weight is the average of the last 8 samples, 0.8s at 10 SPS
 
-// Pound Conversions lbs = (scale_value - offset) Coefficent / factor
+// Raw readings the HX711 returns when the input is railed or nothing is 
+// driving DT, these never count as a real weight
+#define SCALE_RAIL_LOW              0x000000
+#define SCALE_RAIL_HIGH             0xFFFFFF
+#define SCALE_RAIL_MID              0x800000
+
+// Pound Conversions lbs = (scale_value - offset) Coefficent / factor,
+// see ScaleFilter.h for how they're applied
 #define SCALE_LBS_OFFSET            8207148
 #define SCALE_LBS_COEFFICIENT       50000
 #define SCALE_LBS_FACTOR            183379
@@ -29,10 +35,13 @@
 // Types
 typedef enum ScaleGainEnum {DONTUSE, A128, B32, A64} ScaleGainType;
 
+// Globals
+extern int32_t Scale_Zero_Offset;
+
 // Function Prototypes
 void InitializeScale();
+bool ScaleReadyQ();
 int32_t ReadScaleWeight();
-int32_t SampleScaleWeight();
 void SetScaleGain(ScaleGainType Gain);
 
 
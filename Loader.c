@@ -0,0 +1,85 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/bootrom.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
+#include "hardware/structs/scb.h"
+#include "hardware/regs/m0plus.h"
+#include "hardware/regs/addressmap.h"
+#include "FwUpdate.h"
+#include "Sha256.h"
+
+// The loader is its own executable (see CMakeLists.txt) in the first
+// FW_LOADER_SIZE bytes of flash, boot2 included, and nothing ever erases
+// it. Main is linked to start right after it, so installing a new Main
+// never touches the code doing the install. Every boot comes through here:
+// with an install pending and Main not yet hashing right, a staging bank
+// that still checks out is copied over Main. The copy starts again from the
+// top each time, so a power cut part way through is picked up on the next
+// boot. Main checks itself once more and marks the install done. Should
+// neither Main nor the staging bank be any good, the loader drops into the
+// USB bootloader so a UF2 can be copied on without opening the enclosure
+
+// Globals
+static uint8_t Loader_Sector[FLASH_SECTOR_SIZE];
+
+static bool FlashHashQ(uint32_t offset, uint32_t length, const uint8_t* hash){
+    uint8_t actual[SHA256_SIZE];
+    Sha256Type sha;
+    Sha256Start(&sha);
+    Sha256Add(&sha, (const uint8_t*) (XIP_BASE + offset), length);
+    Sha256Finish(&sha, actual);
+    return memcmp(actual, hash, SHA256_SIZE) == 0;
+}
+
+// The flash can't be read while it's being written, so each sector goes
+// through RAM. The loader itself keeps running from flash, the SDK's
+// flash routines are in RAM and put XIP back before they return
+static void CopyStagedImage(uint32_t length){
+    for (uint32_t offset = 0; offset < length; offset += FLASH_SECTOR_SIZE){
+        memcpy(Loader_Sector, (const void*) (XIP_BASE + FW_BANK_OFFSET + offset), FLASH_SECTOR_SIZE);
+        uint32_t saved_irq = save_and_disable_interrupts();
+        flash_range_erase(FW_APP_OFFSET + offset, FLASH_SECTOR_SIZE);
+        flash_range_program(FW_APP_OFFSET + offset, Loader_Sector, FLASH_SECTOR_SIZE);
+        restore_interrupts(saved_irq);
+    }
+}
+
+// Erased or half written flash won't have a stack in RAM and a reset
+// handler in Main's flash
+static bool MainPlausibleQ(){
+    const uint32_t* vectors = (const uint32_t*) (XIP_BASE + FW_APP_VECTORS);
+    uint32_t stack = vectors[0];
+    uint32_t reset = vectors[1];
+    return stack > SRAM_BASE && stack <= SRAM_END && (reset & 1) && reset > XIP_BASE + FW_APP_OFFSET && reset < XIP_BASE + FW_BANK_OFFSET;
+}
+
+// Hand over to Main as boot2 would have, through its vector table
+static void __attribute__((noreturn)) StartMain(){
+    const uint32_t* vectors = (const uint32_t*) (XIP_BASE + FW_APP_VECTORS);
+    save_and_disable_interrupts();
+    // Leave nothing of ours pending for Main's handlers
+    *((io_rw_32*) (PPB_BASE + M0PLUS_NVIC_ICER_OFFSET)) = 0xFFFFFFFF;
+    *((io_rw_32*) (PPB_BASE + M0PLUS_NVIC_ICPR_OFFSET)) = 0xFFFFFFFF;
+    scb_hw->vtor = (uintptr_t) vectors;
+    __asm volatile ("msr msp, %0\n\tcpsie i\n\tbx %1" : : "r" (vectors[0]), "r" (vectors[1]));
+    __builtin_unreachable();
+}
+
+int main(){
+    // A copy takes far longer than Main's watchdog timeout, Main turns it back on
+    hw_clear_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_ENABLE_BITS);
+
+    FwRecordType record;
+    memcpy(&record, (const void*) (XIP_BASE + FW_RECORD_OFFSET), sizeof(record));
+    if (record.Magic == FW_RECORD_MAGIC && record.State == FW_RECORD_INSTALLING && record.Length <= FW_BANK_SIZE){
+        if (!FlashHashQ(FW_APP_OFFSET, record.Length, record.Hash) && FlashHashQ(FW_BANK_OFFSET, record.Length, record.Hash)){
+            CopyStagedImage(record.Length);
+        }
+    }
+
+    if (MainPlausibleQ()) StartMain();
+    reset_usb_boot(0, 0);
+    while (1) tight_loop_contents();
+}
@@ -0,0 +1,181 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+#include "Motion.h"
+#include "Spectral.h"
+#include "Sensors.h"
+#include "HotPath.h"
+
+// Looks for breathing and movement in the FSR readings on core 1, so a still
+// sleeper can be told from a pile of laundry whatever SetUpper says. The zone
+// DMA interrupt on core 0 averages the fitted zones' readings down to
+// ~7.6 samples a second and queues them, core 1 sleeps until they come and
+// analyses the last MOTION_WINDOW of them every MOTION_HOP. Results go back
+// the same way the alarm state is shared, a pair of copies and a sequence count
+
+// Globals
+static uint32_t Motion_Queue[MOTION_QUEUE_SIZE];
+static volatile uint16_t Motion_Queue_Head = 0;     // Written by core 0
+static volatile uint16_t Motion_Queue_Tail = 0;     // Written by core 1
+static uint32_t Motion_Sum = 0;                     // Readings averaged into the next sample so far
+static uint16_t Motion_Summed = 0;
+static volatile bool Motion_Restart = false;
+static uint32_t Motion_Window[MOTION_WINDOW];       // Ring, core 1 only
+static uint16_t Motion_Window_Next = 0;
+static uint16_t Motion_Window_Filled = 0;
+static uint16_t Motion_Since_Analysis = 0;
+static volatile uint32_t Motion_Dropped = 0;
+static volatile uint32_t Motion_Status_Sequence = 0;
+static MotionStatusType Motion_Status_Copies[2];
+static MotionStatusType Motion_Status;              // Core 1's working copy
+static volatile bool Motion_Core_Running = false;
+
+// Reads the SysTick of the core it's called from, which counts down once a cycle
+static inline uint32_t CycleCount(){
+    return systick_hw->cvr;
+}
+
+static void StartCycleCounter(){
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    // Processor clock, no interrupt
+    systick_hw->csr = 0x05;
+}
+
+// ======================= Core 0 ======================= //
+
+// Called from the zone DMA interrupt with the fitted zones' latest readings
+// summed, every 1/ZONE_READING_HZ. Never blocks, a sample core 1 hasn't
+// made room for is dropped and counted
+void HOT_PATH_FUNC(MotionAddReading)(uint32_t reading){
+    if (!Motion_Core_Running) return;
+    Motion_Sum += reading;
+    if (++Motion_Summed < (0x01u << MOTION_LOG2_DECIMATION)) return;
+    uint16_t head = Motion_Queue_Head;
+    if (((head + 1) & (MOTION_QUEUE_SIZE - 1)) == Motion_Queue_Tail){
+        Motion_Dropped++;
+    }else{
+        Motion_Queue[head] = Motion_Sum >> MOTION_LOG2_DECIMATION;
+        __dmb();
+        Motion_Queue_Head = (head + 1) & (MOTION_QUEUE_SIZE - 1);
+        // Wake core 1
+        __sev();
+    }
+    Motion_Sum = 0;
+    Motion_Summed = 0;
+}
+
+// The zones were paused, so the stream has a gap in it. Core 1 starts its window over
+void HOT_PATH_FUNC(MotionRestart)(){
+    Motion_Sum = 0;
+    Motion_Summed = 0;
+    Motion_Restart = true;
+    __sev();
+}
+
+// Take a consistent snapshot of core 1's results
+void HOT_PATH_FUNC(ReadMotionStatus)(MotionStatusType* status){
+    uint32_t sequence;
+    do {
+        sequence = Motion_Status_Sequence;
+        __dmb();
+        *status = Motion_Status_Copies[sequence & 0x01];
+        __dmb();
+    } while (sequence != Motion_Status_Sequence);
+    status->Dropped = Motion_Dropped;
+}
+
+bool HOT_PATH_FUNC(MotionCoreRunningQ)(){
+    return Motion_Core_Running;
+}
+
+// Time one analysis of a made up window on this core, with interrupts off so
+// it's just the kernel. Returns the cycles it took
+uint32_t BenchmarkMotion(){
+    static uint32_t window[MOTION_WINDOW];
+    SpectrumType spectrum;
+    // A breath every 4s riding on a steady load, with some dither
+    for (uint16_t n = 0; n < MOTION_WINDOW; n++) window[n] = 30000 + ((n * 29) % 32 < 16 ? 200 : -200) + (n * 7919) % 13;
+    uint32_t saved_irq = save_and_disable_interrupts();
+    uint32_t csr = systick_hw->csr, rvr = systick_hw->rvr;
+    StartCycleCounter();
+    uint32_t start = CycleCount();
+    AnalyseWindow(window, 0, &spectrum);
+    uint32_t cycles = (start - CycleCount()) & 0x00FFFFFF;
+    systick_hw->rvr = rvr;
+    systick_hw->csr = csr;
+    restore_interrupts(saved_irq);
+    return cycles;
+}
+
+// ======================= Core 1 ======================= //
+
+// Share the working copy with core 0, core 1 is the only writer
+static void PublishMotionStatus(){
+    Motion_Status_Sequence++;
+    __dmb();
+    Motion_Status_Copies[0] = Motion_Status;
+    __dmb();
+    Motion_Status_Sequence++;
+    __dmb();
+    Motion_Status_Copies[1] = Motion_Status;
+}
+
+// Decide whether anyone is there from the last window. Breathing counts
+// as much as BreathingConfidence() says, and any movement makes it certain
+// for MOTION_MOVING_HOLD_US
+static void Analyse(){
+    MotionStatusType* status = &Motion_Status;
+    uint32_t start = CycleCount();
+    AnalyseWindow(Motion_Window, Motion_Window_Next, &status->Spectrum);
+    status->Last_Cycles = (start - CycleCount()) & 0x00FFFFFF;
+    if (status->Last_Cycles > status->Worst_Cycles) status->Worst_Cycles = status->Last_Cycles;
+    status->Analyses++;
+
+    uint64_t now = time_us_64();
+    status->Presence = BreathingConfidence(&status->Spectrum);
+    status->Breathing = status->Presence >= OCCUPIED_CONFIDENCE;
+    status->Moving = MovingQ(&status->Spectrum);
+    if (status->Moving) status->Last_Moving_US = now;
+    if (status->Last_Moving_US != 0 && now - status->Last_Moving_US < MOTION_MOVING_HOLD_US) status->Presence = 255;
+    PublishMotionStatus();
+}
+
+// Core 1's whole job. It sleeps whenever the queue is empty, and flash
+// writes on core 0 park it in RAM through the multicore lockout
+static void MotionCore(){
+    multicore_lockout_victim_init();
+    StartCycleCounter();
+    Motion_Core_Running = true;
+    while (1){
+        if (Motion_Restart){
+            // Anything still queued is from before the gap
+            Motion_Restart = false;
+            Motion_Queue_Tail = Motion_Queue_Head;
+            Motion_Window_Filled = 0;
+            Motion_Since_Analysis = 0;
+        }
+        uint16_t tail = Motion_Queue_Tail;
+        if (tail == Motion_Queue_Head){
+            __wfe();
+            continue;
+        }
+        __dmb();
+        Motion_Window[Motion_Window_Next] = Motion_Queue[tail];
+        Motion_Queue_Tail = (tail + 1) & (MOTION_QUEUE_SIZE - 1);
+        Motion_Window_Next = (Motion_Window_Next + 1) % MOTION_WINDOW;
+        if (Motion_Window_Filled < MOTION_WINDOW) Motion_Window_Filled++;
+        Motion_Since_Analysis++;
+        if (Motion_Window_Filled == MOTION_WINDOW && Motion_Since_Analysis >= MOTION_HOP){
+            Motion_Since_Analysis = 0;
+            Analyse();
+        }
+    }
+}
+
+// Boot step, core 1 takes samples once it's running
+void StartMotionCore(){
+    multicore_launch_core1(MotionCore);
+}
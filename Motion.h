@@ -0,0 +1,33 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include "pico/stdlib.h"
+#include "Spectral.h"
+
+// Defines
+#define MOTION_QUEUE_SIZE           16          // Samples on their way to core 1, must be a power of two
+#define MOTION_MOVING_HOLD_US       60000000    // Moving counts as someone there for this long after
+#define MOTION_CYCLE_BUDGET         200000      // Most core 1 cycles one analysis should take, ~1.6ms at 125MHz
+
+// Types
+typedef struct MotionStatusStruct {
+    SpectrumType    Spectrum;                   // Of the last window analysed
+    uint8_t         Presence;                   // 0 (nobody) to 255 (someone breathing or moving), like a sensor's confidence
+    bool            Breathing;
+    bool            Moving;
+    uint64_t        Last_Moving_US;
+    uint32_t        Analyses;
+    uint32_t        Last_Cycles;                // Core 1 cycles the last analysis took
+    uint32_t        Worst_Cycles;
+    uint32_t        Dropped;                    // Samples core 1 didn't take in time
+} MotionStatusType;
+
+// Function Prototypes
+void StartMotionCore();
+bool MotionCoreRunningQ();
+void MotionAddReading(uint32_t reading);
+void MotionRestart();
+void ReadMotionStatus(MotionStatusType* status);
+uint32_t BenchmarkMotion();
+
+#endif
@@ -0,0 +1,180 @@
+#include <stddef.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "Nights.h"
+#include "Timebase.h"
+#include "HotPath.h"
+
+// The nightly summary is kept up as things happen instead of being worked
+// out from a trace: every occupancy or buzzer transition adds the stretch
+// that just ended to a running total, and nothing is done between them.
+// Closing the window rounds the totals into a NightType on the end of a
+// small ring. The ring lives in RAM the runtime doesn't clear, like the
+// retained alarm state, so a watchdog reset doesn't lose the fortnight.
+// The night in progress isn't kept, a reset mid window starts it afresh
+
+// Types
+typedef struct NightLogStruct {
+    uint32_t    Magic;
+    uint8_t     Count;                  // Nights in the ring, up to NIGHTS_KEPT
+    uint8_t     Next;                   // Where the next night goes
+    NightType   Nights[NIGHTS_KEPT];
+    uint32_t    Checksum;
+} NightLogType;
+
+// Running totals for the window that's open, all time_us_64()
+typedef struct NightTotalsStruct {
+    bool        Open;
+    bool        Known;                  // Had the first occupancy reading, so Occupied means something
+    bool        Occupied;
+    bool        Returned;               // The current stretch in bed came after getting out
+    bool        Buzzing;
+    uint32_t    Start_S;
+    uint64_t    Start_US;
+    uint64_t    Since_US;               // Start of the current stretch in or out of bed
+    uint64_t    Buzz_Since_US;
+    uint64_t    In_Bed_US;
+    uint64_t    First_Exit_US;
+    uint64_t    Buzzer_US;
+    uint64_t    Longest_Return_US;
+    uint32_t    Exits;
+} NightTotalsType;
+
+// Globals
+static NightLogType __uninitialized_ram(Night_Log);
+static bool Night_Log_Checked = false;
+static NightTotalsType Night;
+
+// FNV-1a over the log except the checksum itself, same as the retained state
+static uint32_t NightLogChecksum(){
+    const uint8_t* bytes = (const uint8_t*) &Night_Log;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(NightLogType, Checksum); i++){
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Whatever was in the log's RAM after a power up is thrown away the first
+// time it's looked at. Interrupts must be masked
+static void CheckNightLog(){
+    if (Night_Log_Checked) return;
+    Night_Log_Checked = true;
+    if (Night_Log.Magic == NIGHT_LOG_MAGIC && Night_Log.Checksum == NightLogChecksum() && Night_Log.Count <= NIGHTS_KEPT && Night_Log.Next < NIGHTS_KEPT) return;
+    Night_Log.Magic = NIGHT_LOG_MAGIC;
+    Night_Log.Count = 0;
+    Night_Log.Next = 0;
+    Night_Log.Checksum = NightLogChecksum();
+}
+
+static uint32_t Seconds(uint64_t us){
+    uint64_t seconds = (us + 500000) / 1000000;
+    return seconds > NIGHT_MAX_S ? NIGHT_MAX_S : seconds;
+}
+
+// Round the totals as of now into a NightType, finishing the stretches that
+// are still going without ending them. Interrupts must be masked
+static void Summarise(uint64_t now, NightType* night){
+    uint64_t in_bed = Night.In_Bed_US;
+    uint64_t longest = Night.Longest_Return_US;
+    uint64_t buzzer = Night.Buzzer_US;
+    if (Night.Known && Night.Occupied){
+        in_bed += now - Night.Since_US;
+        if (Night.Returned && now - Night.Since_US > longest) longest = now - Night.Since_US;
+    }
+    if (Night.Buzzing) buzzer += now - Night.Buzz_Since_US;
+    night->Start_S = Night.Start_S;
+    night->Window_S = Seconds(now - Night.Start_US);
+    night->In_Bed_S = Seconds(in_bed);
+    night->First_Exit_S = Night.Exits ? Seconds(Night.First_Exit_US) : NIGHT_NEVER;
+    night->Buzzer_S = Seconds(buzzer);
+    night->Longest_Return_S = Seconds(longest);
+    night->Exits = Night.Exits > 0xFF ? 0xFF : Night.Exits;
+}
+
+// The alarm window just opened, start a new night
+void NightStart(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    Night = (NightTotalsType) {0};
+    Night.Open = true;
+    Night.Start_US = time_us_64();
+    Night.Since_US = Night.Start_US;
+    Night.Start_S = WallClockUs() / 1000000;
+    restore_interrupts(saved_irq);
+}
+
+// The alarm window just closed, put the night on the end of the log
+void NightEnd(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (Night.Open){
+        CheckNightLog();
+        Summarise(time_us_64(), &Night_Log.Nights[Night_Log.Next]);
+        Night_Log.Next = (Night_Log.Next + 1) % NIGHTS_KEPT;
+        if (Night_Log.Count < NIGHTS_KEPT) Night_Log.Count++;
+        Night_Log.Checksum = NightLogChecksum();
+        Night.Open = false;
+    }
+    restore_interrupts(saved_irq);
+}
+
+// Called with every pass's occupancy, only a change does any work. The
+// first reading of the window says what it opened with, so it's neither
+// a way out of bed nor back in
+void HOT_PATH_FUNC(NightOccupancy)(bool occupied){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (!Night.Open || (Night.Known && occupied == Night.Occupied)){
+        restore_interrupts(saved_irq);
+        return;
+    }
+    uint64_t now = TimerNowUs();
+    if (!Night.Known){
+        Night.Known = true;
+    }else if (Night.Occupied){
+        uint64_t stretch = now - Night.Since_US;
+        Night.In_Bed_US += stretch;
+        if (Night.Returned && stretch > Night.Longest_Return_US) Night.Longest_Return_US = stretch;
+        if (Night.Exits++ == 0) Night.First_Exit_US = now - Night.Start_US;
+        Night.Since_US = now;
+    }else{
+        Night.Returned = Night.Exits > 0;
+        Night.Since_US = now;
+    }
+    Night.Occupied = occupied;
+    restore_interrupts(saved_irq);
+}
+
+// Called as the alarm starts and stops beeping
+void HOT_PATH_FUNC(NightBuzzer)(bool on){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (!Night.Open || on == Night.Buzzing){
+        restore_interrupts(saved_irq);
+        return;
+    }
+    uint64_t now = TimerNowUs();
+    if (on) Night.Buzz_Since_US = now;
+    else Night.Buzzer_US += now - Night.Buzz_Since_US;
+    Night.Buzzing = on;
+    restore_interrupts(saved_irq);
+}
+
+// The window that's open as of now. Returns false if there isn't one
+bool NightSoFar(NightType* night){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    bool open = Night.Open;
+    if (open) Summarise(time_us_64(), night);
+    restore_interrupts(saved_irq);
+    return open;
+}
+
+// Copy the logged nights out, newest first. nights needs room for
+// NIGHTS_KEPT. Returns how many there were
+uint8_t GetNights(NightType* nights){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    CheckNightLog();
+    uint8_t count = Night_Log.Count;
+    for (uint8_t i = 0; i < count; i++){
+        nights[i] = Night_Log.Nights[(Night_Log.Next + NIGHTS_KEPT - 1 - i) % NIGHTS_KEPT];
+    }
+    restore_interrupts(saved_irq);
+    return count;
+}
@@ -0,0 +1,33 @@
+#ifndef NIGHTS_H
+#define NIGHTS_H
+
+#include "pico/stdlib.h"
+
+// Defines
+#define NIGHTS_KEPT                 14          // Two weeks of summaries
+#define NIGHT_NEVER                 0xFFFFFFFF  // First_Exit_S of a window nobody got out of bed in
+#define NIGHT_MAX_S                 0xFFFFFFFE  // Durations stick here, far past the longest window SetAlarm allows
+#define NIGHT_LOG_MAGIC             0x4E475432  // "NGT2", change whenever NightType changes
+
+// Types
+// One alarm window, in whole seconds. A window can run a whole day, more
+// than 16 bits of seconds, so 28 bytes and a fortnight costs 392
+typedef struct NightStruct {
+    uint32_t    Start_S;                // Wall clock the window opened, see Timebase.h
+    uint32_t    Window_S;
+    uint32_t    In_Bed_S;
+    uint32_t    First_Exit_S;           // Window start to first getting out of bed
+    uint32_t    Buzzer_S;               // Time the alarm was beeping
+    uint32_t    Longest_Return_S;       // Longest time back in bed after getting out
+    uint8_t     Exits;                  // Times out of bed
+} NightType;
+
+// Function Prototypes
+void NightStart();
+void NightEnd();
+void NightOccupancy(bool occupied);
+void NightBuzzer(bool on);
+bool NightSoFar(NightType* night);
+uint8_t GetNights(NightType* nights);
+
+#endif
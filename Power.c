@@ -0,0 +1,110 @@
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+#include "Power.h"
+#include "AlarmState.h"
+#include "PressureSensor.h"
+#include "Calibration.h"
+#include "FwUpdate.h"
+#include "TimerWheel.h"
+#include "HotPath.h"
+
+// Globals
+volatile PowerStateType Power_State = POWER_FULL;
+uint32_t Full_Speed_Hz;
+uint64_t Power_State_Since_US = 0;
+PowerStatsType Power_Stats;
+TimerType Power_Wake_Timer;
+
+// Move clk_peri off of clk_sys so the UARTs keep their baud rates when 
+// clk_sys is scaled. Must run before any UART is set up
+void InitializePower(){
+    Full_Speed_Hz = clock_get_hz(clk_sys);
+    clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, POWER_PERI_HZ, POWER_PERI_HZ);
+    Power_State = POWER_FULL;
+    Power_State_Since_US = time_us_64();
+}
+
+// Add the time since the last change to the state we're leaving
+static void PowerChangeState(PowerStateType new_state){
+    uint64_t now = time_us_64();
+    Power_Stats.State_US[Power_State] += now - Power_State_Since_US;
+    Power_State_Since_US = now;
+    Power_State = new_state;
+    Power_Stats.Transitions++;
+}
+
+// Drop clk_sys to the crystal, the PLL is left running so waking up is just 
+// a glitchless mux switch. The RTC, timer, UART and GPIO interrupts all
+// keep working and are what wake us back up. The zone ADC is paused
+void EnterLowPower(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    // Never slow down once the window has opened, while calibrating or during a firmware update
+    if (Power_State != POWER_LOW && !InAlarmWindowQ() && !CalibratingQ() && !FwUpdatingQ()){
+        // Nothing reads the zones outside a window, and decimating at 12MHz would keep waking us
+        PauseZoneSampling();
+        clock_configure(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLK_REF, 0, POWER_LOW_SYS_HZ, POWER_LOW_SYS_HZ);
+        PowerChangeState(POWER_LOW);
+    }
+    restore_interrupts(saved_irq);
+}
+
+// Put clk_sys back on pll_sys. Safe to call from an ISR and
+// cheap when we're already at full speed
+void EnterFullPower(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (Power_State != POWER_FULL){
+        uint32_t start = time_us_32();
+        clock_configure(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX, CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS, Full_Speed_Hz, Full_Speed_Hz);
+        PowerChangeState(POWER_FULL);
+        ResumeZoneSampling();
+        // Keep track of how long it takes us to be ready again
+        Power_Stats.Last_Wake_US = time_us_32() - start;
+        if (Power_Stats.Last_Wake_US > Power_Stats.Worst_Wake_US) Power_Stats.Worst_Wake_US = Power_Stats.Last_Wake_US;
+        if (Power_Stats.Last_Wake_US > POWER_WAKE_BUDGET_US) Power_Stats.Wakes_Over_Budget++;
+    }
+    restore_interrupts(saved_irq);
+}
+
+// Sleep until the next interrupt and count the time spent asleep. Interrupts
+// are masked while we check the window so one that fires in between still 
+// wakes __wfi() (it runs as soon as they're unmasked again)
+void PowerSleep(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (!InAlarmWindowQ()){
+        PowerStateType state = Power_State;
+        uint64_t start = time_us_64();
+        __wfi();
+        Power_Stats.Sleep_US[state] += time_us_64() - start;
+    }
+    restore_interrupts(saved_irq);
+}
+
+// Does nothing, the timer wheel's interrupt is what wakes PowerSleepUntil()
+static void HOT_PATH_FUNC(PowerWakeCallback)(TimerType* timer){
+}
+
+// Sleep until wake_us or the next interrupt, whichever comes first, even
+// inside a window. Returns true if something woke us before wake_us. The
+// wake up is a timer on the wheel like everything else, started with
+// interrupts masked so it can't go off before we're in __wfi()
+bool HOT_PATH_FUNC(PowerSleepUntil)(uint64_t wake_us){
+    PowerStateType state = Power_State;
+    uint64_t start = TimerNowUs();
+    uint32_t saved_irq = save_and_disable_interrupts();
+    StartTimerAt(&Power_Wake_Timer, wake_us, 0, &PowerWakeCallback, NULL);
+    __wfi();
+    restore_interrupts(saved_irq);
+    CancelTimer(&Power_Wake_Timer);
+    uint64_t now = TimerNowUs();
+    Power_Stats.Sleep_US[state] += now - start;
+    return now < wake_us;
+}
+
+// Copy of the stats with the current state's time brought up to date
+void GetPowerStats(PowerStatsType* stats){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    *stats = Power_Stats;
+    stats->State_US[Power_State] += time_us_64() - Power_State_Since_US;
+    restore_interrupts(saved_irq);
+}
@@ -0,0 +1,34 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include "pico/stdlib.h"
+
+// Defines
+#define POWER_LOW_SYS_HZ            (XOSC_MHZ * MHZ)   // clk_sys runs straight off the crystal between windows
+#define POWER_PERI_HZ               (48 * MHZ)         // clk_peri is moved to pll_usb so UART baud rates don't move with clk_sys
+#define POWER_WAKE_BUDGET_US        100                // Max time from the window opening to being back at full speed
+
+// Types
+typedef enum PowerStateEnum {POWER_FULL, POWER_LOW, NUMBER_OF_POWER_STATES} PowerStateType;
+
+typedef struct PowerStatsStruct {
+    uint64_t    State_US[NUMBER_OF_POWER_STATES];   // Time spent in each state
+    uint64_t    Sleep_US[NUMBER_OF_POWER_STATES];   // Part of that time spent asleep in __wfi()
+    uint32_t    Transitions;
+    uint32_t    Last_Wake_US;                       // Time to get back to full speed on the last wake
+    uint32_t    Worst_Wake_US;
+    uint32_t    Wakes_Over_Budget;
+} PowerStatsType;
+
+// Globals
+extern volatile PowerStateType Power_State;
+
+// Function Prototypes
+void InitializePower();
+void EnterLowPower();
+void EnterFullPower();
+void PowerSleep();
+bool PowerSleepUntil(uint64_t wake_us);
+void GetPowerStats(PowerStatsType* stats);
+
+#endif
@@ -1,15 +1,204 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "PressureSensor.h"
-#include "hardware/adc.h"
+#include "Motion.h"
+#include "Latency.h"
+#include "HotPath.h"
+
+#if ZONE_DECIMATION < ZONE_BLOCK_PER_ZONE || ZONE_READING_SHIFT < 0
+#error "LOG2_ZONE_DECIMATION is too small"
+#endif
+#if ZONE_BLOCK_SAMPLES * 2 != ZONE_BLOCK_BYTES
+#error "ZONE_BLOCK_SAMPLES 16 bit samples have to fill exactly 2^LOG2_ZONE_BLOCK_BYTES bytes"
+#endif
+#if NUMBER_OF_ZONES != 4
+#error "DecimateBlock is unrolled for four zones"
+#endif
+
+// Globals
+static uint16_t Zone_Blocks[2][ZONE_BLOCK_SAMPLES] __attribute__((aligned(ZONE_BLOCK_BYTES)));
+static int Zone_DMA_Channels[2];
+static uint32_t Zone_Sums[NUMBER_OF_ZONES];
+static uint32_t Zone_Summed = 0;                    // Samples per zone in Zone_Sums so far
+static volatile uint16_t Zone_Readings[NUMBER_OF_ZONES];
+static volatile bool Zone_Discard = false;
+static volatile bool Zone_Paused = false;
+static ZoneStatsType Zone_Stats;
+
+// Add a block to the running sums and hand out readings once there are
+// enough. Zones are interleaved in the block, zone 0 first
+static void HOT_PATH_FUNC(DecimateBlock)(const uint16_t* block){
+    uint32_t sum0 = Zone_Sums[0], sum1 = Zone_Sums[1], sum2 = Zone_Sums[2], sum3 = Zone_Sums[3];
+    for (uint32_t i = 0; i < ZONE_BLOCK_SAMPLES; i += NUMBER_OF_ZONES){
+        sum0 += block[i];
+        sum1 += block[i + 1];
+        sum2 += block[i + 2];
+        sum3 += block[i + 3];
+    }
+    Zone_Sums[0] = sum0; Zone_Sums[1] = sum1; Zone_Sums[2] = sum2; Zone_Sums[3] = sum3;
 
-// Define globals
-uint16_t Threshold = INITIAL_THRESHOLD;
+    Zone_Summed += ZONE_BLOCK_PER_ZONE;
+    if (Zone_Summed >= ZONE_DECIMATION){
+        uint32_t fitted = 0;
+        for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+            Zone_Readings[i] = Zone_Sums[i] >> ZONE_READING_SHIFT;
+            Zone_Sums[i] = 0;
+            if (ZONES_FITTED & ZONE_BIT(i)) fitted += Zone_Readings[i];
+        }
+        Zone_Summed = 0;
+        Zone_Stats.Readings++;
+        // Raise the latency probe's trigger as soon as the bed reads occupied
+        LatencyCheckZones(Zone_Readings);
+        // Every reading goes to core 1's breathing and movement detector too
+        MotionAddReading(fitted);
+        // A pause asked for before the first reading waits for it
+        if (Zone_Paused) adc_run(false);
+    }
+}
+
+// After an overrun the round robin and the DMA no longer agree on which
+// zone is next. Let the ADC finish and the DMA take everything it made,
+// then point the round robin at the zone the DMA's next slot belongs to
+static void HOT_PATH_FUNC(RealignZones)(){
+    adc_run(false);
+    while (!(adc_hw->cs & ADC_CS_READY_BITS)) tight_loop_contents();
+    while (!adc_fifo_is_empty()) tight_loop_contents();
+    uint8_t active = dma_channel_is_busy(Zone_DMA_Channels[0]) ? 0 : 1;
+    uint32_t next = ZONE_BLOCK_SAMPLES - dma_channel_hw_addr(Zone_DMA_Channels[active])->transfer_count;
+    adc_select_input(next % NUMBER_OF_ZONES);
+    hw_set_bits(&adc_hw->fcs, ADC_FCS_OVER_BITS);
+    Zone_Discard = true;
+    if (!Zone_Paused) adc_run(true);
+}
+
+// Fires each time one of the ping-pong channels fills its buffer. The other
+// channel is already filling the other buffer, so this has ZONE_BLOCK_US
+// to finish before the ADC FIFO overflows. Each channel's write address
+// wraps back to the start of its own buffer by itself, so however late
+// this runs (a flash erase, the HX711 read) the DMA never writes anywhere
+// else, the block is just overwritten with newer samples
+void HOT_PATH_FUNC(Zone_DMA_Callback)(){
+    uint32_t start = time_us_32();
+    for (uint8_t b = 0; b < 2; b++){
+        if (!dma_channel_get_irq0_status(Zone_DMA_Channels[b])) continue;
+        dma_channel_acknowledge_irq0(Zone_DMA_Channels[b]);
+
+        if (Zone_Discard){
+            // This block was started before a pause, throw it and the partial sums away
+            for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++) Zone_Sums[i] = 0;
+            Zone_Summed = 0;
+            Zone_Discard = false;
+            MotionRestart();
+        }else{
+            DecimateBlock(Zone_Blocks[b]);
+        }
+        Zone_Stats.Blocks++;
+    }
+    if (adc_hw->fcs & ADC_FCS_OVER_BITS){
+        // Samples were dropped so the zones may have slipped
+        RealignZones();
+        Zone_Stats.Overruns++;
+    }
+    uint32_t busy = time_us_32() - start;
+    Zone_Stats.Busy_US += busy;
+    if (busy > Zone_Stats.Worst_Block_US) Zone_Stats.Worst_Block_US = busy;
+}
 
 void InitializeADC(){
-    // Initialize the ADC on ADC 2 
+    // Set every zone's pin up as an analog input
     adc_init();
-    adc_gpio_init(ADC_PIN);
-    adc_select_input(ADC_INSTANCE);
-}
\ No newline at end of file
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        adc_gpio_init(ZONE_FIRST_PIN + i);
+    }
+    // Free run through all the zones at full speed, handing each result to the DMA
+    adc_select_input(0);
+    adc_set_round_robin(ALL_ZONES);
+    adc_set_clkdiv(0);
+    adc_fifo_setup(true, true, 1, false, false);
+
+    // Two channels that trigger each other, so there's always one 
+    // taking samples while the other buffer is being decimated
+    Zone_DMA_Channels[0] = dma_claim_unused_channel(true);
+    Zone_DMA_Channels[1] = dma_claim_unused_channel(true);
+    for (uint8_t b = 0; b < 2; b++){
+        dma_channel_config config = dma_channel_get_default_config(Zone_DMA_Channels[b]);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_ring(&config, true, LOG2_ZONE_BLOCK_BYTES);
+        channel_config_set_dreq(&config, DREQ_ADC);
+        channel_config_set_chain_to(&config, Zone_DMA_Channels[!b]);
+        dma_channel_configure(Zone_DMA_Channels[b], &config, Zone_Blocks[b], &adc_hw->fifo, ZONE_BLOCK_SAMPLES, false);
+        dma_channel_set_irq0_enabled(Zone_DMA_Channels[b], true);
+    }
+    // Above the UART so a long Bluetooth message can't starve the decimator
+    irq_set_exclusive_handler(DMA_IRQ_0, Zone_DMA_Callback);
+    irq_set_priority(DMA_IRQ_0, PICO_HIGHEST_IRQ_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    dma_channel_start(Zone_DMA_Channels[0]);
+    adc_run(true);
+}
+
+// Stop converting between alarm windows. The DMA just waits for the ADC 
+// and nothing is dropped, so the zones stay in their slots
+void HOT_PATH_FUNC(PauseZoneSampling)(){
+    Zone_Paused = true;
+    if (Zone_Stats.Readings > 0) adc_run(false);
+}
+
+void HOT_PATH_FUNC(ResumeZoneSampling)(){
+    if (!Zone_Paused) return;
+    // The block in progress holds samples from before the pause
+    Zone_Discard = true;
+    Zone_Paused = false;
+    adc_run(true);
+}
+
+bool ZoneSamplingPausedQ(){
+    return Zone_Paused;
+}
+
+// True once every zone has a reading
+bool ZoneReadingsQ(){
+    return Zone_Stats.Readings > 0;
+}
+
+// Copy out the latest reading for every zone
+void HOT_PATH_FUNC(ReadZones)(uint16_t* zones){
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        zones[i] = Zone_Readings[i];
+    }
+}
+
+// Like ReadZones but makes sure the readings are fresh, sampling 
+// just long enough to get them if we are paused. Returns false (and the
+// last readings there were) if none came within ZONE_MEASURE_TIMEOUT_US
+bool MeasureZones(uint16_t* zones){
+    bool paused = Zone_Paused;
+    ResumeZoneSampling();
+    // Wait on the next reading, after a resume it only has samples from after now
+    uint32_t readings = Zone_Stats.Readings;
+    uint32_t start = time_us_32();
+    bool fresh = true;
+    while (*(volatile uint32_t*) &Zone_Stats.Readings == readings){
+        if (time_us_32() - start > ZONE_MEASURE_TIMEOUT_US){
+            fresh = false;
+            break;
+        }
+        tight_loop_contents();
+    }
+    if (paused) PauseZoneSampling();
+    ReadZones(zones);
+    return fresh;
+}
+
+void GetZoneStats(ZoneStatsType* stats){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    *stats = Zone_Stats;
+    restore_interrupts(saved_irq);
+}
@@ -8,15 +8,61 @@
 //Defines
 #define ADC_PIN                     28
 #define ADC_INSTANCE                2
-#define INITIAL_THRESHOLD           1<<11     // Should range from 0 to 4096
 
+// Zones are FSRs on ADC inputs 0-3 (GPIO 26-29), zone n is ADC input n
+#define NUMBER_OF_ZONES             4
+#define ZONE_FIRST_PIN              26
+#define ZONE_BIT(ZONE)              (0x01u << (ZONE))
+#define ALL_ZONES                   (ZONE_BIT(NUMBER_OF_ZONES) - 1)
+// Zones that actually have an FSR wired up, add bits here as more are
+// fitted. Unwired inputs float (and GPIO 29 reads VSYS/3 on a Pico)
+#define ZONES_FITTED                ZONE_BIT(ADC_INSTANCE)
+#define ZONES_ANY                   ZONES_FITTED
 
-#define IN_BED_Q                    (100*adc_read() >= Scale_Sensitivity*Threshold)
+// The ADC free runs through every zone at 48MHz / 96 cycles = 500ksps and
+// the DMA hands the results over in blocks, ping-ponging between two buffers
+#define ADC_CONVERSION_US           2
+#define ZONE_BLOCK_PER_ZONE         64
+#define ZONE_BLOCK_SAMPLES          (NUMBER_OF_ZONES * ZONE_BLOCK_PER_ZONE)
+#define ZONE_BLOCK_US               (ZONE_BLOCK_SAMPLES * ADC_CONVERSION_US)   // 512us to process each block in
+// Each channel's writes wrap around its own block, so the blocks have to be
+// a power of two bytes and aligned to it
+#define LOG2_ZONE_BLOCK_BYTES       9
+#define ZONE_BLOCK_BYTES            (0x01ul << LOG2_ZONE_BLOCK_BYTES)
 
-//Globals
-extern uint16_t Threshold;
+// Each zone's conversions are summed in groups of 2^LOG2_ZONE_DECIMATION
+// (a first order CIC) and scaled to ZONE_READING_BITS. Every 4x of 
+// oversampling adds a bit, so 256 gives 16 bits at ~488 readings a second.
+// Must be at least log2(ZONE_BLOCK_PER_ZONE)
+#define LOG2_ZONE_DECIMATION        8
+#define ZONE_DECIMATION             (0x01ul << LOG2_ZONE_DECIMATION)
+#define ZONE_READING_BITS           16
+#define ZONE_READING_MAX            ((0x01ul << ZONE_READING_BITS) - 1)
+#define ZONE_READING_SHIFT          (12 + LOG2_ZONE_DECIMATION - ZONE_READING_BITS)
+#define ZONE_READING_HZ             (1000000 / (ADC_CONVERSION_US * NUMBER_OF_ZONES * ZONE_DECIMATION))
 
+// MeasureZones gives up if no reading turns up in this long
+#define ZONE_MEASURE_TIMEOUT_US     (4 * 1000000 / ZONE_READING_HZ + ZONE_BLOCK_US)
 
+#define INITIAL_THRESHOLD           1<<15     // Should range from 0 to ZONE_READING_MAX
+
+// Types
+typedef struct ZoneStatsStruct {
+    uint32_t    Blocks;             // DMA blocks processed, each is ZONE_BLOCK_US of ADC time
+    uint64_t    Busy_US;            // Time spent processing them
+    uint32_t    Worst_Block_US;
+    uint32_t    Overruns;           // Times the ADC FIFO overflowed because the DMA fell behind
+    uint32_t    Readings;           // Decimated readings per zone
+} ZoneStatsType;
+
+// Function Prototypes
 void InitializeADC();
+void PauseZoneSampling();
+void ResumeZoneSampling();
+bool ZoneSamplingPausedQ();
+bool ZoneReadingsQ();
+void ReadZones(uint16_t* zones);
+bool MeasureZones(uint16_t* zones);
+void GetZoneStats(ZoneStatsType* stats);
 
-#endif
\ No newline at end of file
+#endif
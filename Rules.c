@@ -0,0 +1,300 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "Rules.h"
+#include "Sensors.h"
+#include "PressureSensor.h"
+#include "HotPath.h"
+
+// Wake rules are compiled once, when they're added, into a few bytes of
+// postfix code each. Every pass of the sensing loop runs all of them, so the
+// evaluator is a flat switch over 1 bit values with no allocation or
+// recursion, and its work is bounded by RULE_MAX_OPS
+
+// Types
+typedef struct RuleCompilerStruct {
+    const char* Next;                   // Next character of the source
+    RuleType*   Rule;
+    uint8_t     Length;                 // Code bytes emitted so far
+    uint8_t     Depth;                  // Values on the stack at this point of the code
+    uint8_t     Timers;
+    const char* Error;
+} RuleCompilerType;
+
+// Globals
+// Without any rules added the alarm does what IN_BED_Q always did
+static const RuleType Default_Rule = {RULE_BEEP, {RULE_OP_IN_BED, RULE_OP_END}, "inbed"};
+RuleSetType Rule_Set = {1, {Default_Rule}};
+const char* RuleActionNames[NUMBER_OF_RULE_ACTIONS] = {"quiet", "beep", "escalate"};
+static uint64_t Rule_Timers[MAX_RULES][RULE_TIMERS];   // When each "for" clause's value last turned true, 0 while false
+static uint64_t Rule_Window_Open_US = 0;
+uint32_t Rule_Ops_Run = 0;
+uint32_t Rule_Worst_Ops = 0;
+
+// ======================= Compiler ======================= //
+
+static void Emit(RuleCompilerType* compiler, uint8_t byte){
+    // Always leave room for the RULE_OP_END
+    if (compiler->Length >= RULE_CODE_SIZE - 1){
+        compiler->Error = "Rule is too long";
+        return;
+    }
+    compiler->Rule->Code[compiler->Length++] = byte;
+}
+
+static void Emit16(RuleCompilerType* compiler, uint16_t value){
+    Emit(compiler, value & 0xFF);
+    Emit(compiler, value >> 8);
+}
+
+// Keep track of what the code will leave on the stack
+static void StackChange(RuleCompilerType* compiler, int8_t change){
+    compiler->Depth += change;
+    if (compiler->Depth > RULE_STACK_DEPTH) compiler->Error = "Rule is nested too deeply";
+}
+
+// Copy out the next word, or a single one of the symbols ( ) > <
+static bool Token(RuleCompilerType* compiler, char* token, size_t size){
+    while (*compiler->Next == ' ') compiler->Next++;
+    size_t length = 0;
+    if (strchr("()<>", *compiler->Next) && *compiler->Next){
+        token[length++] = *compiler->Next++;
+    }else{
+        while (*compiler->Next && !strchr(" ()<>", *compiler->Next) && length < size - 1) token[length++] = *compiler->Next++;
+    }
+    token[length] = '\0';
+    return length > 0;
+}
+
+// Look at the next token without taking it
+static bool PeekToken(RuleCompilerType* compiler, const char* expected){
+    const char* saved = compiler->Next;
+    char token[16];
+    bool match = Token(compiler, token, sizeof(token)) && strcmp(token, expected) == 0;
+    if (!match) compiler->Next = saved;
+    return match;
+}
+
+static uint16_t Number(RuleCompilerType* compiler){
+    char token[16];
+    uint32_t value = 0;
+    if (!Token(compiler, token, sizeof(token)) || token[0] < '0' || token[0] > '9'){
+        compiler->Error = "Expected a number";
+        return 0;
+    }
+    for (char* c = token; *c; c++){
+        if (*c < '0' || *c > '9' || value > UINT16_MAX){
+            compiler->Error = "Numbers have to be whole and under 65536";
+            return 0;
+        }
+        value = value * 10 + (*c - '0');
+    }
+    if (value > UINT16_MAX) compiler->Error = "Numbers have to be whole and under 65536";
+    return value;
+}
+
+static void Expression(RuleCompilerType* compiler);
+
+// primary := inbed | human | zone <n|any> | weight > <lbs> | weight < <lbs> | confidence > <n> | after <s> | ( expression )
+static void Primary(RuleCompilerType* compiler){
+    char token[16];
+    if (!Token(compiler, token, sizeof(token))){
+        compiler->Error = "Rule ends too early";
+    }else if (strcmp(token, "inbed") == 0){
+        Emit(compiler, RULE_OP_IN_BED);
+        StackChange(compiler, 1);
+    }else if (strcmp(token, "human") == 0){
+        Emit(compiler, RULE_OP_HUMAN);
+        StackChange(compiler, 1);
+    }else if (strcmp(token, "zone") == 0){
+        uint8_t mask = ZONES_ANY;
+        if (!PeekToken(compiler, "any")){
+            uint16_t zone = Number(compiler);
+            if (zone >= NUMBER_OF_ZONES || !(ZONES_FITTED & ZONE_BIT(zone))) compiler->Error = "No sensor fitted in that zone";
+            mask = ZONE_BIT(zone);
+        }
+        Emit(compiler, RULE_OP_ZONE);
+        Emit(compiler, mask);
+        StackChange(compiler, 1);
+    }else if (strcmp(token, "weight") == 0){
+        if (PeekToken(compiler, ">")) Emit(compiler, RULE_OP_WEIGHT_ABOVE);
+        else if (PeekToken(compiler, "<")) Emit(compiler, RULE_OP_WEIGHT_BELOW);
+        else compiler->Error = "weight needs > or <";
+        Emit16(compiler, Number(compiler));
+        StackChange(compiler, 1);
+    }else if (strcmp(token, "confidence") == 0){
+        if (!PeekToken(compiler, ">")) compiler->Error = "confidence needs >";
+        uint16_t confidence = Number(compiler);
+        if (confidence > 255) compiler->Error = "Confidence goes up to 255";
+        Emit(compiler, RULE_OP_CONFIDENCE);
+        Emit(compiler, confidence);
+        StackChange(compiler, 1);
+    }else if (strcmp(token, "after") == 0){
+        Emit(compiler, RULE_OP_AFTER);
+        Emit16(compiler, Number(compiler));
+        StackChange(compiler, 1);
+    }else if (strcmp(token, "(") == 0){
+        Expression(compiler);
+        if (!PeekToken(compiler, ")")) compiler->Error = "Missing )";
+    }else{
+        compiler->Error = "Unknown word in rule";
+    }
+}
+
+// factor := not factor | primary [for <s>]
+static void Factor(RuleCompilerType* compiler){
+    if (PeekToken(compiler, "not")){
+        Factor(compiler);
+        Emit(compiler, RULE_OP_NOT);
+        return;
+    }
+    Primary(compiler);
+    if (PeekToken(compiler, "for")){
+        if (compiler->Timers >= RULE_TIMERS) compiler->Error = "Too many for clauses in one rule";
+        Emit(compiler, RULE_OP_FOR);
+        Emit(compiler, compiler->Timers++);
+        Emit16(compiler, Number(compiler));
+    }
+}
+
+// term := factor {and factor}
+static void Term(RuleCompilerType* compiler){
+    Factor(compiler);
+    while (!compiler->Error && PeekToken(compiler, "and")){
+        Factor(compiler);
+        Emit(compiler, RULE_OP_AND);
+        StackChange(compiler, -1);
+    }
+}
+
+// expression := term {or term}
+static void Expression(RuleCompilerType* compiler){
+    Term(compiler);
+    while (!compiler->Error && PeekToken(compiler, "or")){
+        Term(compiler);
+        Emit(compiler, RULE_OP_OR);
+        StackChange(compiler, -1);
+    }
+}
+
+// Compile the condition in text into rule. Returns NULL if it worked,
+// otherwise what's wrong with it
+const char* CompileRule(const char* text, RuleActionType action, RuleType* rule){
+    RuleCompilerType compiler = {text, rule, 0, 0, 0, NULL};
+    memset(rule, 0, sizeof(RuleType));
+    rule->Action = action;
+    Expression(&compiler);
+    while (*compiler.Next == ' ') compiler.Next++;
+    if (!compiler.Error && *compiler.Next) compiler.Error = "Unexpected words at the end of the rule";
+    if (compiler.Error) return compiler.Error;
+    rule->Code[compiler.Length] = RULE_OP_END;
+    strncpy(rule->Text, text, RULE_TEXT_SIZE - 1);
+    return NULL;
+}
+
+// Compile and add a rule. The first one added replaces the default rule
+const char* AddRule(const char* text, RuleActionType action){
+    RuleType rule;
+    const char* error = CompileRule(text, action, &rule);
+    if (error) return error;
+    if (Rule_Set.Count == 1 && memcmp(&Rule_Set.Rules[0], &Default_Rule, sizeof(RuleType)) == 0) Rule_Set.Count = 0;
+    if (Rule_Set.Count >= MAX_RULES) return "No room for another rule";
+    Rule_Set.Rules[Rule_Set.Count++] = rule;
+    return NULL;
+}
+
+// Back to just the default rule
+void ClearRules(){
+    Rule_Set.Count = 1;
+    Rule_Set.Rules[0] = Default_Rule;
+    ResetRuleTimers();
+}
+
+// Called whenever the window is closed, so "after" and "for" start over with the next one
+void ResetRuleTimers(){
+    memset(Rule_Timers, 0, sizeof(Rule_Timers));
+    Rule_Window_Open_US = 0;
+}
+
+// ======================= Evaluator ======================= //
+
+static inline uint16_t Argument16(const uint8_t* code){
+    return code[0] | (code[1] << 8);
+}
+
+// Run one rule's code. The stack is a word with the top value in bit 0.
+// Anything malformed (only possible from corrupted code) counts as false
+static bool HOT_PATH_FUNC(RunRule)(const uint8_t* code, uint64_t* timers, const RuleInputType* input){
+    const uint8_t* end = code + RULE_CODE_SIZE;
+    uint32_t stack = 0;
+    bool value;
+    while (code < end){
+        Rule_Ops_Run++;
+        switch (*code++){
+            case RULE_OP_END:
+                return stack & 1;
+            case RULE_OP_IN_BED:
+                stack = (stack << 1) | (input->Confidence >= OCCUPIED_CONFIDENCE);
+                break;
+            case RULE_OP_HUMAN:
+                stack = (stack << 1) | input->Human;
+                break;
+            case RULE_OP_ZONE:
+                stack = (stack << 1) | ((input->Zones_Occupied & code[0]) != 0);
+                code += 1;
+                break;
+            case RULE_OP_WEIGHT_ABOVE:
+                stack = (stack << 1) | (input->Weight_Lbs > Argument16(code));
+                code += 2;
+                break;
+            case RULE_OP_WEIGHT_BELOW:
+                stack = (stack << 1) | (input->Weight_Lbs < Argument16(code));
+                code += 2;
+                break;
+            case RULE_OP_CONFIDENCE:
+                stack = (stack << 1) | (input->Confidence > code[0]);
+                code += 1;
+                break;
+            case RULE_OP_AFTER:
+                stack = (stack << 1) | (input->Now_US - Rule_Window_Open_US >= Argument16(code) * 1000000ull);
+                code += 2;
+                break;
+            case RULE_OP_FOR: {
+                uint64_t* since = &timers[code[0] % RULE_TIMERS];
+                if (!(stack & 1)) *since = 0;
+                else if (*since == 0) *since = input->Now_US;
+                value = *since != 0 && input->Now_US - *since >= Argument16(code + 1) * 1000000ull;
+                stack = (stack & ~1ul) | value;
+                code += 3;
+                break;
+            }
+            case RULE_OP_AND:
+                value = (stack & 1) && (stack & 2);
+                stack = (stack >> 2 << 1) | value;
+                break;
+            case RULE_OP_OR:
+                value = (stack & 1) || (stack & 2);
+                stack = (stack >> 2 << 1) | value;
+                break;
+            case RULE_OP_NOT:
+                stack ^= 1;
+                break;
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+// Run every rule against one pass's readings and return the strongest action
+// of the ones that hold. Every rule runs every time so the "for" clauses keep time
+RuleActionType HOT_PATH_FUNC(EvaluateRules)(const RuleInputType* input){
+    RuleActionType action = RULE_QUIET;
+    if (Rule_Window_Open_US == 0) Rule_Window_Open_US = input->Now_US;
+    Rule_Ops_Run = 0;
+    for (uint8_t i = 0; i < Rule_Set.Count && i < MAX_RULES; i++){
+        const RuleType* rule = &Rule_Set.Rules[i];
+        if (RunRule(rule->Code, Rule_Timers[i], input) && rule->Action > action) action = rule->Action;
+    }
+    if (Rule_Ops_Run > Rule_Worst_Ops) Rule_Worst_Ops = Rule_Ops_Run;
+    return action;
+}
@@ -0,0 +1,69 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include "pico/stdlib.h"
+#include "AlarmState.h"
+
+// Defines
+#define MAX_RULES                   8
+#define RULE_CODE_SIZE              24          // Bytecode bytes per rule, ops and their arguments
+#define RULE_TEXT_SIZE              64          // Source kept for listing the rules back
+#define RULE_STACK_DEPTH            8           // Values on the evaluator's stack, one bit each
+#define RULE_TIMERS                 2           // "for" clauses per rule
+// Worst case work per sample, every rule at full length with every op taking its arguments
+#define RULE_MAX_OPS                (MAX_RULES * RULE_CODE_SIZE)
+
+// Types
+// Each op pushes, pops or combines 1 bit values. Arguments follow the op, 16 bit ones low byte first
+typedef enum RuleOpEnum {
+    RULE_OP_END,            // End of the condition, the top of the stack is the result
+    RULE_OP_IN_BED,         // Fused confidence is at least OCCUPIED_CONFIDENCE
+    RULE_OP_ZONE,           // <mask>: any of the ZONE_BIT()s in mask reads as occupied
+    RULE_OP_WEIGHT_ABOVE,   // <lbs16>: the load cell reads more than lbs
+    RULE_OP_WEIGHT_BELOW,   // <lbs16>
+    RULE_OP_CONFIDENCE,     // <confidence>: fused confidence is at least this
+    RULE_OP_AFTER,          // <seconds16>: the window has been open at least this long
+    RULE_OP_FOR,            // <timer> <seconds16>: the top of the stack has been true for at least this long
+    RULE_OP_AND,
+    RULE_OP_OR,
+    RULE_OP_NOT,
+    RULE_OP_HUMAN           // Core 1 sees breathing or movement
+} RuleOpType;
+
+// What a rule does when its condition holds. The strongest one that holds wins
+typedef enum RuleActionEnum {RULE_QUIET, RULE_BEEP, RULE_ESCALATE, NUMBER_OF_RULE_ACTIONS} RuleActionType;
+
+typedef struct RuleStruct {
+    uint8_t     Action;
+    uint8_t     Code[RULE_CODE_SIZE];
+    char        Text[RULE_TEXT_SIZE];
+} RuleType;
+
+typedef struct RuleSetStruct {
+    uint8_t     Count;
+    RuleType    Rules[MAX_RULES];
+} RuleSetType;
+
+// What the rules are run against, one per pass of the sensing loop
+typedef struct RuleInputStruct {
+    uint8_t     Confidence;                     // Fused, 0-255
+    uint8_t     Zones_Occupied;                 // ZONE_BIT()s
+    int32_t     Weight_Lbs;                     // INT32_MAX while the load cell isn't healthy
+    bool        Human;                          // Also true while the motion detector isn't healthy
+    uint64_t    Now_US;
+} RuleInputType;
+
+// Globals
+extern RuleSetType Rule_Set;
+extern const char* RuleActionNames[NUMBER_OF_RULE_ACTIONS];
+extern uint32_t Rule_Ops_Run;                  // Ops the last evaluation took
+extern uint32_t Rule_Worst_Ops;
+
+// Function Prototypes
+const char* CompileRule(const char* text, RuleActionType action, RuleType* rule);
+const char* AddRule(const char* text, RuleActionType action);
+void ClearRules();
+void ResetRuleTimers();
+RuleActionType EvaluateRules(const RuleInputType* input);
+
+#endif
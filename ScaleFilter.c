@@ -0,0 +1,64 @@
+#include "pico/stdlib.h"
+#include "ScaleFilter.h"
+#include "LoadCellADC.h"
+#include "HotPath.h"
+
+// The load cell's streaming stage. Every HX711 sample goes in as it's read
+// and a calibrated weight comes straight back out, integers only and no
+// divides: the average is a running sum and a shift, the conversion to
+// weight a multiply by a reciprocal worked out at compile time. The zero
+// slowly follows an empty bed so the load cell creeping doesn't build up
+// into a weight
+
+// Globals
+ScaleFilterType Scale_Filter;
+
+// Start again from no samples, the zero tracked so far stays in Scale_Zero_Offset
+void ResetScaleFilter(){
+    Scale_Filter = (ScaleFilterType) {0};
+    Scale_Filter.Zero = Scale_Zero_Offset;
+}
+
+// Add a plausible raw sample and work out the weight
+void HOT_PATH_FUNC(ScaleFilterAdd)(int32_t sample){
+    ScaleFilterType* filter = &Scale_Filter;
+    // The first sample fills the whole ring so there's a weight straight away
+    if (filter->Samples == 0){
+        for (uint8_t i = 0; i < SCALE_FILTER_TAPS; i++) filter->Ring[i] = sample;
+        filter->Sum = sample << LOG2_SCALE_SAMPLES;
+    }else{
+        filter->Sum += sample - filter->Ring[filter->Index];
+        filter->Ring[filter->Index] = sample;
+    }
+    filter->Index = (filter->Index + 1) & (SCALE_FILTER_TAPS - 1);
+    filter->Samples++;
+
+    // A new zero from LoadZero (or a trace) replaces whatever was tracked
+    if (Scale_Zero_Offset != filter->Zero){
+        filter->Zero = Scale_Zero_Offset;
+        filter->Track_Residual = 0;
+        filter->Tracked = 0;
+    }
+    filter->Counts_Q = filter->Sum - (filter->Zero << LOG2_SCALE_SAMPLES);
+
+    // Track the zero one count at a time, once the ring holds real samples
+    if (filter->Samples >= SCALE_FILTER_TAPS && filter->Counts_Q <= (SCALE_TRACK_COUNTS << LOG2_SCALE_SAMPLES) && filter->Counts_Q >= -(SCALE_TRACK_COUNTS << LOG2_SCALE_SAMPLES)){
+        filter->Track_Residual += filter->Counts_Q;
+        int32_t step = (filter->Track_Residual >= (1 << (LOG2_SCALE_SAMPLES + LOG2_SCALE_TRACK))) - (filter->Track_Residual <= -(1 << (LOG2_SCALE_SAMPLES + LOG2_SCALE_TRACK)));
+        if (step){
+            filter->Track_Residual -= step << (LOG2_SCALE_SAMPLES + LOG2_SCALE_TRACK);
+            filter->Zero += step;
+            filter->Tracked += step;
+            filter->Counts_Q -= step << LOG2_SCALE_SAMPLES;
+            Scale_Zero_Offset = filter->Zero;
+        }
+    }
+
+    filter->Weight_Centilbs = ((int64_t) filter->Counts_Q * SCALE_CENTILBS_Q) >> (SCALE_LBS_SHIFT + LOG2_SCALE_SAMPLES);
+    filter->Weight_Lbs = ((int64_t) filter->Counts_Q * SCALE_LBS_Q) >> (SCALE_LBS_SHIFT + LOG2_SCALE_SAMPLES);
+}
+
+// True once there's been a sample since the last reset
+bool HOT_PATH_FUNC(ScaleFilterReadyQ)(){
+    return Scale_Filter.Samples > 0;
+}
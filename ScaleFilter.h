@@ -0,0 +1,45 @@
+#ifndef SCALEFILTER_H
+#define SCALEFILTER_H
+
+#include "pico/stdlib.h"
+#include "LoadCellADC.h"
+
+// Defines
+#define SCALE_FILTER_TAPS           (0x01 << LOG2_SCALE_SAMPLES)
+// Weight per count as fixed point reciprocals of SCALE_LBS_FACTOR, worked
+// out at compile time so converting a sample is a multiply and a shift
+#define SCALE_LBS_SHIFT             24
+#define SCALE_LBS_Q                 (((int64_t) SCALE_LBS_COEFFICIENT << SCALE_LBS_SHIFT) / SCALE_LBS_FACTOR)
+#define SCALE_CENTILBS_Q            (((int64_t) 100 * SCALE_LBS_COEFFICIENT << SCALE_LBS_SHIFT) / SCALE_LBS_FACTOR)
+// Tare tracking. While the bed reads within SCALE_TRACK_LBS of empty the zero
+// follows it 1/2^LOG2_SCALE_TRACK of the way per sample (~7 min at 10 SPS),
+// slow enough that nobody lying down is ever tared away but creep is
+#define SCALE_TRACK_LBS             3
+#define SCALE_TRACK_COUNTS          (SCALE_TRACK_LBS * SCALE_LBS_FACTOR / SCALE_LBS_COEFFICIENT)
+#define LOG2_SCALE_TRACK            12
+
+// Types
+// Moving average over the last SCALE_FILTER_TAPS raw samples, kept as a
+// running sum so each sample costs the same however many taps there are
+typedef struct ScaleFilterStruct {
+    int32_t     Ring[SCALE_FILTER_TAPS];
+    int32_t     Sum;
+    uint8_t     Index;                  // Oldest sample, overwritten next
+    int32_t     Counts_Q;               // Average less the zero, LOG2_SCALE_SAMPLES fraction bits
+    int32_t     Weight_Centilbs;
+    int32_t     Weight_Lbs;
+    int32_t     Zero;                   // Scale_Zero_Offset as we last saw it
+    int32_t     Track_Residual;         // Tracking error built up towards the next count the zero moves
+    int32_t     Tracked;                // Counts tracking has moved the zero since it was last set
+    uint32_t    Samples;
+} ScaleFilterType;
+
+// Globals
+extern ScaleFilterType Scale_Filter;
+
+// Function Prototypes
+void ResetScaleFilter();
+void ScaleFilterAdd(int32_t sample);
+bool ScaleFilterReadyQ();
+
+#endif
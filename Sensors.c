@@ -0,0 +1,274 @@
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/sync.h"
+#include "Sensors.h"
+#include "PressureSensor.h"
+#include "LoadCellADC.h"
+#include "ScaleFilter.h"
+#include "Power.h"
+#include "Rules.h"
+#include "Motion.h"
+#include "HotPath.h"
+
+// Globals
+SensorStatusType Sensor_Status[NUMBER_OF_SENSORS];
+uint8_t Fused_Confidence = 0;
+uint16_t FSR_Zones[NUMBER_OF_ZONES];
+static uint8_t Zone_Occupied = 0;               // ZONE_BIT()s of zones that read as occupied last time
+uint32_t Sample_Interval_US = SAMPLE_INTERVAL_MIN_US;
+uint32_t Worst_Sample_Gap_US = 0;               // Longest time between two passes inside a window
+static uint64_t Last_Pass_US = 0;
+static volatile bool Sensors_New_Window = false;     // Set as a window opens, the next pass starts afresh
+static uint64_t Next_Pass_US = 0;
+static uint8_t Filtered_Margin = 0;
+uint8_t Margin_Filter_Log2 = LOG2_MARGIN_FILTER;
+static uint32_t Motion_Analyses_Taken = 0;
+
+// ======================= FSR ======================= //
+
+// The DMA always has a fresh reading for every zone
+bool HOT_PATH_FUNC(FSRReadyQ)(){
+    return true;
+}
+
+// Snapshot every zone, the sample itself is the highest reading
+int32_t HOT_PATH_FUNC(FSRSample)(){
+    uint16_t highest = 0;
+    ReadZones(FSR_Zones);
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (FSR_Zones[i] > highest) highest = FSR_Zones[i];
+    }
+    return highest;
+}
+
+// Linear in the reading with the zone's SetUpper/SetTolTo point landing on OCCUPIED_CONFIDENCE
+uint8_t HOT_PATH_FUNC(ZoneConfidence)(uint8_t zone, uint16_t reading, const AlarmStateType* state){
+    uint32_t trip = (uint32_t) state->Scale_Sensitivity[zone] * state->Threshold[zone];
+    if (trip == 0) return 255;
+    uint32_t confidence = (100 * (uint32_t) reading * OCCUPIED_CONFIDENCE) / trip;
+    return (confidence > 255) ? 255 : confidence;
+}
+
+// The most confident of the zones that count, so one zone being pressed is enough.
+// An occupied zone is read Hysteresis higher so it doesn't flicker at the trip point
+uint8_t HOT_PATH_FUNC(FSRConfidence)(int32_t sample, const AlarmStateType* state){
+    uint8_t highest = 0;
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (!(state->Zone_Mask & ZONE_BIT(i))) continue;
+        uint32_t reading = FSR_Zones[i];
+        if (Zone_Occupied & ZONE_BIT(i)) reading += state->Hysteresis[i];
+        uint8_t confidence = ZoneConfidence(i, (reading > ZONE_READING_MAX) ? ZONE_READING_MAX : reading, state);
+        if (confidence >= OCCUPIED_CONFIDENCE) Zone_Occupied |= ZONE_BIT(i);
+        else Zone_Occupied &= ~ZONE_BIT(i);
+        if (confidence > highest) highest = confidence;
+    }
+    return highest;
+}
+
+bool HOT_PATH_FUNC(FSRPlausibleQ)(int32_t sample){
+    return true;
+}
+
+// ======================= Load Cell ======================= //
+
+bool HOT_PATH_FUNC(ScaleSampleReadyQ)(){
+    return ScaleReadyQ();
+}
+
+// Railed readings mean the load cell is disconnected or saturated
+bool HOT_PATH_FUNC(ScalePlausibleQ)(int32_t sample){
+    return sample != SCALE_RAIL_LOW && sample != SCALE_RAIL_HIGH && sample != SCALE_RAIL_MID;
+}
+
+// The HX711 powers down if SCK stays high for 60us, so don't let an interrupt
+// stretch a pulse. The raw sample is what's returned (so railed and stuck
+// readings can still be spotted) but only plausible ones reach the filter
+int32_t HOT_PATH_FUNC(ScaleSample)(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    int32_t sample = ReadScaleWeight();
+    restore_interrupts(saved_irq);
+    if (ScalePlausibleQ(sample)) ScaleFilterAdd(sample);
+    return sample;
+}
+
+// Linear in the filtered weight with SCALE_OCCUPIED_LBS landing on OCCUPIED_CONFIDENCE.
+// The filter already has this sample in it
+uint8_t HOT_PATH_FUNC(ScaleConfidence)(int32_t sample, const AlarmStateType* state){
+    int32_t centilbs = Scale_Filter.Weight_Centilbs;
+    if (centilbs <= 0) return 0;
+    if (centilbs >= SCALE_OCCUPIED_LBS * 100 * 2) return 255;
+    uint32_t confidence = ((uint32_t) centilbs * SCALE_CONFIDENCE_Q) >> 16;
+    return (confidence > 255) ? 255 : confidence;
+}
+
+// ======================= Motion ======================= //
+
+// Core 1 has analysed another window since the last sample
+bool HOT_PATH_FUNC(MotionReadyQ)(){
+    MotionStatusType status;
+    ReadMotionStatus(&status);
+    return status.Analyses != Motion_Analyses_Taken;
+}
+
+// The sample is core 1's presence score, already 0-255
+int32_t HOT_PATH_FUNC(MotionSample)(){
+    MotionStatusType status;
+    ReadMotionStatus(&status);
+    Motion_Analyses_Taken = status.Analyses;
+    return status.Presence;
+}
+
+uint8_t HOT_PATH_FUNC(MotionConfidence)(int32_t sample, const AlarmStateType* state){
+    return sample;
+}
+
+bool HOT_PATH_FUNC(MotionPlausibleQ)(int32_t sample){
+    return true;
+}
+
+// ======================= Scheduler ======================= //
+
+SensorType Sensors[NUMBER_OF_SENSORS] = {
+    // Name     // Ready            // Sample       // Confidence       // Plausible        // Max cost             // Stale after  // Stuck after          // Fused
+    {"FSR",     &FSRReadyQ,         &FSRSample,     &FSRConfidence,     &FSRPlausibleQ,     FSR_MAX_SAMPLE_US,      100000,         0,                      true},      // An empty bed reads a steady 0
+    {"Scale",   &ScaleSampleReadyQ, &ScaleSample,   &ScaleConfidence,   &ScalePlausibleQ,   SCALE_MAX_SAMPLE_US,    250000,         SCALE_STUCK_SAMPLES,    true},      // 10 SPS is 100ms per sample
+    {"Motion",  &MotionReadyQ,      &MotionSample,  &MotionConfidence,  &MotionPlausibleQ,  MOTION_MAX_SAMPLE_US,   10000000,       0,                      false}      // A result every ~4s once the first ~17s window is in. Presence holds for a minute after moving, so it's only the human input
+};
+
+// Also puts the occupancy logic back to how it starts, which tools/replay relies on
+void InitializeSensors(){
+    InitializeScale();
+    ResetScaleFilter();
+    for (uint8_t i = 0; i < NUMBER_OF_SENSORS; i++){
+        Sensor_Status[i] = (SensorStatusType) {0};
+    }
+    Fused_Confidence = 0;
+    Zone_Occupied = 0;
+    Sample_Interval_US = SAMPLE_INTERVAL_MIN_US;
+    Worst_Sample_Gap_US = 0;
+    Last_Pass_US = 0;
+    Next_Pass_US = 0;
+    Filtered_Margin = 0;
+    Sensors_New_Window = false;
+}
+
+// Called as the alarm window opens, from the window timer. The gap since
+// the last window's final pass isn't a stall, and its margin is out of date
+void SensorsWindowOpened(){
+    Sensors_New_Window = true;
+}
+
+// Pick when the next pass is due from how close this one was to the 
+// decision. The margin is filtered so one far reading doesn't slow us
+// down, but a close one speeds us up straight away
+static void HOT_PATH_FUNC(ScheduleSensors)(uint64_t now){
+    uint8_t margin = (Fused_Confidence > OCCUPIED_CONFIDENCE) ? Fused_Confidence - OCCUPIED_CONFIDENCE : OCCUPIED_CONFIDENCE - Fused_Confidence;
+    if (margin > SAMPLE_MARGIN_FAR) margin = SAMPLE_MARGIN_FAR;
+
+    // Start fast in a new window. Any other gap, however long, is a stall
+    // inside the window and counts against the latency bound
+    if (Sensors_New_Window){
+        Sensors_New_Window = false;
+        Filtered_Margin = 0;
+    }else if (Last_Pass_US != 0 && now - Last_Pass_US > Worst_Sample_Gap_US){
+        uint64_t gap = now - Last_Pass_US;
+        Worst_Sample_Gap_US = (gap > UINT32_MAX) ? UINT32_MAX : gap;
+    }
+
+    if (margin < Filtered_Margin) Filtered_Margin = margin;
+    else Filtered_Margin += (margin - Filtered_Margin + (1 << Margin_Filter_Log2) - 1) >> Margin_Filter_Log2;
+
+    Sample_Interval_US = SAMPLE_INTERVAL_MIN_US + ((SAMPLE_INTERVAL_MAX_US - SAMPLE_INTERVAL_MIN_US) * Filtered_Margin) / SAMPLE_MARGIN_FAR;
+    Last_Pass_US = now;
+    Next_Pass_US = now + Sample_Interval_US;
+}
+
+// True when it's time for the next pass of the sensing loop
+bool HOT_PATH_FUNC(SensorsDueQ)(){
+    return TimerNowUs() >= Next_Pass_US;
+}
+
+// Sleep until the next pass is due (or something else wakes us). When 
+// that's far enough off the zone ADC is paused until just before it, unless
+// core 1 is running the breathing detector
+void HOT_PATH_FUNC(SensorsSleep)(){
+    uint64_t now = TimerNowUs();
+    if (now >= Next_Pass_US) return;
+    // Core 1's breathing detector needs the readings to keep coming
+    if (Next_Pass_US - now > 2 * ZONE_WARMUP_US && !MotionCoreRunningQ()){
+        PauseZoneSampling();
+        bool early = PowerSleepUntil(Next_Pass_US - ZONE_WARMUP_US);
+        ResumeZoneSampling();
+        if (early) return;
+    }
+    PowerSleepUntil(Next_Pass_US);
+}
+
+// Take one sample from sensor i into its status
+static void HOT_PATH_FUNC(ReadSensor)(uint8_t i, const AlarmStateType* state, uint64_t now){
+    SensorStatusType* status = &Sensor_Status[i];
+    uint32_t start = time_us_32();
+    int32_t sample = Sensors[i].Sample();
+    uint32_t cost = time_us_32() - start;
+    if (cost > status->Worst_Sample_US) status->Worst_Sample_US = cost;
+
+    // Count repeats so a sensor frozen on one value can be caught
+    status->Same_Count = (sample == status->Last_Sample && status->Samples > 0) ? status->Same_Count + 1 : 0;
+    status->Last_Sample = sample;
+    status->Last_Sample_US = now;
+    status->Samples++;
+    status->Confidence = Sensors[i].Confidence(sample, state);
+    status->Healthy = Sensors[i].PlausibleQ(sample) && (Sensors[i].Stuck_Samples == 0 || status->Same_Count < Sensors[i].Stuck_Samples);
+}
+
+// Between windows nothing else reads the load cell, so the main loop takes
+// any sample that's ready to keep its filter and tare tracking going.
+// Calibration gets first pick, so call this after CalibrationStep()
+void ScaleStep(const AlarmStateType* state){
+    if (Sensors[SENSOR_SCALE].ReadyQ()) ReadSensor(SENSOR_SCALE, state, time_us_64());
+}
+
+// One pass of the sensing loop. Reads every source that has a sample ready
+// (at most one sample each, so a pass costs at most the sum of the sources'
+// Max_Sample_US) and fuses the Fused ones into a single occupancy confidence.
+// Fusion takes the most confident healthy source, so a failed or drifting
+// sensor reading low can never hold the alarm off. If no source is healthy
+// we assume someone is in bed rather than let the alarm go quiet
+uint8_t HOT_PATH_FUNC(SampleSensors)(const AlarmStateType* state){
+    uint64_t now = TimerNowUs();
+    uint8_t fused = 0;
+    bool any_healthy = false;
+
+    for (uint8_t i = 0; i < NUMBER_OF_SENSORS; i++){
+        SensorStatusType* status = &Sensor_Status[i];
+        if (Sensors[i].ReadyQ()) ReadSensor(i, state, now);
+        // No samples for too long is a failure too, allowing for the time between passes
+        if (status->Samples == 0 || (now - status->Last_Sample_US) > Sensors[i].Stale_US + Sample_Interval_US){
+            status->Healthy = false;
+        }
+        if (status->Healthy && Sensors[i].Fused){
+            any_healthy = true;
+            if (status->Confidence > fused) fused = status->Confidence;
+        }
+    }
+
+    Fused_Confidence = any_healthy ? fused : 255;
+    ScheduleSensors(now);
+    return Fused_Confidence;
+}
+
+// Sample every sensor and run the wake rules against the result. A failed
+// sensor reads as occupied (zones), heavy (load cell) or someone there
+// (motion), the same way fusion treats it, so it can't hold the alarm off
+RuleActionType HOT_PATH_FUNC(RunRules)(const AlarmStateType* state){
+    RuleInputType input;
+    input.Confidence = SampleSensors(state);
+    input.Zones_Occupied = Sensor_Status[SENSOR_FSR].Healthy ? Zone_Occupied : ALL_ZONES;
+    input.Weight_Lbs = INT32_MAX;
+    if (Sensor_Status[SENSOR_SCALE].Healthy && ScaleFilterReadyQ()){
+        input.Weight_Lbs = Scale_Filter.Weight_Lbs;
+    }
+    input.Human = !Sensor_Status[SENSOR_MOTION].Healthy || Sensor_Status[SENSOR_MOTION].Confidence >= OCCUPIED_CONFIDENCE;
+    input.Now_US = TimerNowUs();
+    return EvaluateRules(&input);
+}
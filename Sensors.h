@@ -0,0 +1,82 @@
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include "pico/stdlib.h"
+#include "AlarmState.h"
+#include "Rules.h"
+
+// Defines
+#define OCCUPIED_CONFIDENCE         128         // Fused confidence (0-255) at or above which the bed counts as occupied
+#define SCALE_OCCUPIED_LBS          40          // Load cell weight that counts as someone in bed
+#define SCALE_STUCK_SAMPLES         32          // A load cell returning the exact same value this many times in a row has failed
+#define SCALE_CONFIDENCE_Q          ((OCCUPIED_CONFIDENCE << 16) / (SCALE_OCCUPIED_LBS * 100))     // Confidence per hundredth of a lb, 16 fraction bits
+
+// Worst case time each source's Sample() adds to a pass of the sensing loop
+#define FSR_MAX_SAMPLE_US           5           // Copying out the DMA'd reading of every zone
+#define SCALE_MAX_SAMPLE_US         80          // 27 SCK pulses of SCALE_SCK_HIGH_US + SCALE_SCK_LOW_US plus overhead
+#define MOTION_MAX_SAMPLE_US        5           // Copying out core 1's last result
+
+// Adaptive sampling. The time between passes scales with how far the fused
+// confidence is from OCCUPIED_CONFIDENCE, from SAMPLE_INTERVAL_MIN_US right
+// at it up to SAMPLE_INTERVAL_MAX_US once it's SAMPLE_MARGIN_FAR away
+#define SAMPLE_INTERVAL_MIN_US      (1000000 / ZONE_READING_HZ)     // Every decimated reading
+#define SAMPLE_INTERVAL_MAX_US      200000                          // Has to stay under WATCHDOG_WAKE_MS
+#define SAMPLE_MARGIN_FAR           96
+#define LOG2_MARGIN_FILTER          3           // The margin grows back 1/8th of the way per pass but shrinks straight away
+// The zone ADC is paused between slow passes and restarted this long before the next one
+#define ZONE_WARMUP_US              (ZONE_BLOCK_US + 1000000 / ZONE_READING_HZ)
+// Worst case from the bed changing to the pass that sees it: a whole slow
+// interval, plus the reading in progress and the one after it (the boxcar
+// has to fill with the new value)
+#define SENSE_WORST_LATENCY_US      (SAMPLE_INTERVAL_MAX_US + 2 * (1000000 / ZONE_READING_HZ))
+
+// Types
+typedef enum SensorEnum {SENSOR_FSR, SENSOR_SCALE, SENSOR_MOTION, NUMBER_OF_SENSORS} SensorIdType;
+
+// Every occupancy source looks like this to the scheduler
+typedef struct SensorStruct {
+    char*       Name;
+    bool        (*ReadyQ)(void);                // True when a new sample can be read without waiting
+    int32_t     (*Sample)(void);                // Reads it, must take at most Max_Sample_US
+    uint8_t     (*Confidence)(int32_t sample, const AlarmStateType* state);    // 0 (empty) to 255 (occupied)
+    bool        (*PlausibleQ)(int32_t sample);  // False for readings a working sensor can't give
+    uint32_t    Max_Sample_US;
+    uint32_t    Stale_US;                       // Counts as failed without a new sample for this long
+    uint16_t    Stuck_Samples;                  // Counts as failed after this many identical samples, 0 to never
+    bool        Fused;                          // Part of the fused confidence, otherwise only its own rule input reads it
+} SensorType;
+
+typedef struct SensorStatusStruct {
+    int32_t     Last_Sample;
+    uint64_t    Last_Sample_US;
+    uint8_t     Confidence;
+    bool        Healthy;
+    uint16_t    Same_Count;                     // Samples in a row equal to Last_Sample
+    uint32_t    Samples;
+    uint32_t    Worst_Sample_US;                // Longest Sample() actually took
+} SensorStatusType;
+
+// Globals
+extern SensorType Sensors[NUMBER_OF_SENSORS];
+extern SensorStatusType Sensor_Status[NUMBER_OF_SENSORS];
+extern uint8_t Fused_Confidence;
+extern uint16_t FSR_Zones[NUMBER_OF_ZONES];
+extern uint32_t Sample_Interval_US;
+extern uint32_t Worst_Sample_Gap_US;
+extern uint8_t Margin_Filter_Log2;
+
+// Macros
+// STATE is an AlarmStateType snapshot. The alarm itself goes by RunRules(), whose default rule is the same
+#define IN_BED_Q(STATE)             (SampleSensors(&(STATE)) >= OCCUPIED_CONFIDENCE)
+
+// Function Prototypes
+void InitializeSensors();
+uint8_t SampleSensors(const AlarmStateType* state);
+RuleActionType RunRules(const AlarmStateType* state);
+bool SensorsDueQ();
+void SensorsSleep();
+void SensorsWindowOpened();
+void ScaleStep(const AlarmStateType* state);
+uint8_t ZoneConfidence(uint8_t zone, uint16_t reading, const AlarmStateType* state);
+
+#endif
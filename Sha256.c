@@ -0,0 +1,82 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "Sha256.h"
+
+// Macros
+#define ROTR(X, N)                  (((X) >> (N)) | ((X) << (32 - (N))))
+
+// Globals
+static const uint32_t Sha256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void Sha256Block(Sha256Type* sha, const uint8_t* block){
+    uint32_t w[64];
+    for (uint8_t i = 0; i < 16; i++){
+        w[i] = ((uint32_t) block[4*i] << 24) | ((uint32_t) block[4*i + 1] << 16) | ((uint32_t) block[4*i + 2] << 8) | block[4*i + 3];
+    }
+    for (uint8_t i = 16; i < 64; i++){
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = sha->State[0], b = sha->State[1], c = sha->State[2], d = sha->State[3];
+    uint32_t e = sha->State[4], f = sha->State[5], g = sha->State[6], h = sha->State[7];
+    for (uint8_t i = 0; i < 64; i++){
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + Sha256_K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    sha->State[0] += a; sha->State[1] += b; sha->State[2] += c; sha->State[3] += d;
+    sha->State[4] += e; sha->State[5] += f; sha->State[6] += g; sha->State[7] += h;
+}
+
+void Sha256Start(Sha256Type* sha){
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(sha->State, initial, sizeof(initial));
+    sha->Length = 0;
+}
+
+void Sha256Add(Sha256Type* sha, const uint8_t* data, size_t len){
+    while (len > 0){
+        size_t used = sha->Length % SHA256_BLOCK_SIZE;
+        size_t take = MIN(len, SHA256_BLOCK_SIZE - used);
+        // Hash whole blocks straight from data, only partial ones get copied
+        if (used == 0 && take == SHA256_BLOCK_SIZE){
+            Sha256Block(sha, data);
+        }else{
+            memcpy(&sha->Block[used], data, take);
+            if (used + take == SHA256_BLOCK_SIZE) Sha256Block(sha, sha->Block);
+        }
+        sha->Length += take;
+        data += take;
+        len -= take;
+    }
+}
+
+// Pad out the last block with the length and write the 32 byte hash
+void Sha256Finish(Sha256Type* sha, uint8_t* hash){
+    uint64_t bits = sha->Length * 8;
+    uint8_t pad = 0x80;
+    Sha256Add(sha, &pad, 1);
+    pad = 0;
+    while (sha->Length % SHA256_BLOCK_SIZE != SHA256_BLOCK_SIZE - 8) Sha256Add(sha, &pad, 1);
+    uint8_t length[8];
+    for (uint8_t i = 0; i < 8; i++) length[i] = bits >> (56 - 8*i);
+    Sha256Add(sha, length, 8);
+    for (uint8_t i = 0; i < 8; i++){
+        hash[4*i] = sha->State[i] >> 24;
+        hash[4*i + 1] = sha->State[i] >> 16;
+        hash[4*i + 2] = sha->State[i] >> 8;
+        hash[4*i + 3] = sha->State[i];
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include "pico/stdlib.h"
+
+// Defines
+#define SHA256_SIZE                 32          // Bytes in a hash
+#define SHA256_BLOCK_SIZE           64
+
+// Types
+// SHA-256 over a stream of bytes fed in pieces of any size
+typedef struct Sha256Struct {
+    uint32_t    State[8];
+    uint64_t    Length;                         // Bytes hashed so far
+    uint8_t     Block[SHA256_BLOCK_SIZE];       // Bytes waiting for a whole block
+} Sha256Type;
+
+// Function Prototypes
+void Sha256Start(Sha256Type* sha);
+void Sha256Add(Sha256Type* sha, const uint8_t* data, size_t len);
+void Sha256Finish(Sha256Type* sha, uint8_t* hash);
+
+#endif
@@ -0,0 +1,125 @@
+#include "pico/stdlib.h"
+#include "Spectral.h"
+#include "Sensors.h"
+#include "HotPath.h"
+
+#if MOTION_WINDOW != 128
+#error "Goertzel_Coefficients are worked out for a 128 sample window"
+#endif
+
+// A Goertzel filter per bin of interest, in Q15 with nothing wider than 32
+// bits in the per sample loop since the M0+ has no long multiply. The window
+// is block scaled into Q15 first so a faint breathing signal on a heavy
+// sleeper keeps its resolution. Everything here is plain C so tools/motionbench
+// can build it for the host
+
+// Globals
+// 2cos(2 pi k / MOTION_WINDOW) in Q14, bin 0 isn't used
+static const int32_t HOT_PATH_DATA Goertzel_Coefficients[MOTION_BINS] = {32768, 32729, 32610, 32413, 32138, 31786, 31357, 30853, 30274};
+
+// coeff * s >> 14. s is split so that neither half's product needs more than
+// 32 bits: a bin's state grows to at most MOTION_WINDOW * 2^15 / sin(2 pi / MOTION_WINDOW),
+// under 2^27, and the coefficients are under 2^15
+static inline int32_t MulQ14(int32_t coeff, int32_t s){
+    return coeff * (s >> 14) + ((coeff * (s & 0x3FFF)) >> 14);
+}
+
+// |X_k|^2 of the window x, in Q15^2
+static int64_t HOT_PATH_FUNC(GoertzelPower)(const int16_t* x, int32_t coeff){
+    int32_t s1 = 0, s2 = 0;
+    for (uint16_t n = 0; n < MOTION_WINDOW; n++){
+        int32_t s0 = x[n] + MulQ14(coeff, s1) - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+    return (int64_t) s1 * s1 + (int64_t) s2 * s2 - (int64_t) MulQ14(coeff, s1) * s2;
+}
+
+// Analyse the MOTION_WINDOW samples of ring (a circular buffer of that size)
+// starting at oldest
+void HOT_PATH_FUNC(AnalyseWindow)(const uint32_t* ring, uint16_t oldest, SpectrumType* spectrum){
+    int32_t residual[MOTION_WINDOW];
+    int16_t x[MOTION_WINDOW];
+    uint32_t sum = 0;
+    for (uint16_t n = 0; n < MOTION_WINDOW; n++) sum += ring[n];
+    uint32_t mean = sum / MOTION_WINDOW;
+
+    // Take the straight line through the window off too, a bed settling
+    // under someone (or a pile of laundry) would otherwise leak into every
+    // bin. Time runs from -(MOTION_WINDOW - 1) to MOTION_WINDOW - 1 in steps
+    // of 2 so the middle of the window is 0
+    int64_t slope = 0;
+    for (uint16_t n = 0; n < MOTION_WINDOW; n++){
+        residual[n] = (int32_t) (ring[(oldest + n) % MOTION_WINDOW] - mean);
+        slope += (int64_t) (2 * n - (MOTION_WINDOW - 1)) * residual[n];
+    }
+    // Sum of the times squared is MOTION_WINDOW (MOTION_WINDOW^2 - 1) / 3, the slope ends up in Q16
+    slope = (slope << 16) / ((int64_t) MOTION_WINDOW * (MOTION_WINDOW * MOTION_WINDOW - 1) / 3);
+
+    // Then scale so the biggest change left just fits in Q15
+    uint32_t peak = 0;
+    for (uint16_t n = 0; n < MOTION_WINDOW; n++){
+        residual[n] -= (int32_t) ((slope * (2 * n - (MOTION_WINDOW - 1))) >> 16);
+        uint32_t magnitude = (residual[n] < 0) ? -residual[n] : residual[n];
+        if (magnitude > peak) peak = magnitude;
+    }
+    int8_t exponent = 0;
+    while (peak > 0 && peak < 0x4000){
+        peak <<= 1;
+        exponent++;
+    }
+    while (peak > 0x7FFF){
+        peak >>= 1;
+        exponent--;
+    }
+    uint64_t energy = 0;
+    for (uint16_t n = 0; n < MOTION_WINDOW; n++){
+        x[n] = (exponent >= 0) ? residual[n] * (1 << exponent) : residual[n] >> -exponent;
+        energy += (int32_t) x[n] * x[n];
+    }
+
+    spectrum->Mean = mean;
+    spectrum->Exponent = exponent;
+    spectrum->Mean_Square = 0;
+    spectrum->Drift_Share = 0;
+    spectrum->Breath_Share = 0;
+    spectrum->Peak_Bin = 0;
+    if (energy == 0) return;
+    // Back to counts^2, a window can't change by more than 2^18 so this fits
+    uint64_t mean_square = (exponent >= 0) ? (energy >> (2 * exponent)) / MOTION_WINDOW : (energy << (-2 * exponent)) / MOTION_WINDOW;
+    spectrum->Mean_Square = (mean_square > UINT32_MAX) ? UINT32_MAX : mean_square;
+
+    // Parseval: the energy is the sum of every bin's |X_k|^2 over the window
+    // length, each bin below Nyquist counting twice for its negative twin
+    uint64_t scale = (uint64_t) MOTION_WINDOW * energy;
+    int64_t drift = GoertzelPower(x, Goertzel_Coefficients[MOTION_DRIFT_BIN]);
+    int64_t breath = 0, peak_power = 0;
+    for (uint8_t k = MOTION_FIRST_BREATH_BIN; k <= MOTION_LAST_BREATH_BIN; k++){
+        int64_t power = GoertzelPower(x, Goertzel_Coefficients[k]);
+        breath += power;
+        if (power > peak_power){
+            peak_power = power;
+            spectrum->Peak_Bin = k;
+        }
+    }
+    uint64_t drift_share = (512 * (uint64_t) drift) / scale;
+    uint64_t breath_share = (512 * (uint64_t) breath) / scale;
+    spectrum->Drift_Share = (drift_share > 255) ? 255 : drift_share;
+    spectrum->Breath_Share = (breath_share > 255) ? 255 : breath_share;
+}
+
+// Linear in the share of the change that's in the breathing band, with
+// MOTION_BREATH_SHARE landing on OCCUPIED_CONFIDENCE. A bed that barely
+// changes at all is nobody, however that little change is spread
+uint8_t BreathingConfidence(const SpectrumType* spectrum){
+    if (spectrum->Mean_Square < MOTION_NOISE_FLOOR * MOTION_NOISE_FLOOR) return 0;
+    uint32_t confidence = ((uint32_t) spectrum->Breath_Share * OCCUPIED_CONFIDENCE) / MOTION_BREATH_SHARE;
+    return (confidence > 255) ? 255 : confidence;
+}
+
+// Enough change above the breathing band to be tossing and turning
+bool MovingQ(const SpectrumType* spectrum){
+    uint32_t shares = spectrum->Drift_Share + spectrum->Breath_Share;
+    if (shares >= 256) return false;
+    return (((uint64_t) spectrum->Mean_Square * (256 - shares)) >> 8) >= (uint32_t) MOTION_MOVING_RMS * MOTION_MOVING_RMS;
+}
@@ -0,0 +1,41 @@
+#ifndef SPECTRAL_H
+#define SPECTRAL_H
+
+#include "pico/stdlib.h"
+#include "PressureSensor.h"
+
+// Defines
+// The fitted zones' readings are averaged 2^MOTION_LOG2_DECIMATION at a time
+// into a slow stream, ~7.6 samples a second, and analysed a window at a time
+#define MOTION_LOG2_DECIMATION      6
+#define MOTION_SAMPLE_MHZ           ((1000ul * ZONE_READING_HZ) >> MOTION_LOG2_DECIMATION)    // mHz, to keep it whole
+#define MOTION_WINDOW               128         // Samples analysed at once, ~17s
+#define MOTION_HOP                  32          // New samples between analyses, ~4s
+// Bin k of the window is at k * MOTION_SAMPLE_MHZ / MOTION_WINDOW, ~0.06Hz apart.
+// Breathing is 0.1-0.5Hz (6-30 a minute), anything below is the bed settling
+#define MOTION_DRIFT_BIN            1
+#define MOTION_FIRST_BREATH_BIN     2           // 0.12Hz
+#define MOTION_LAST_BREATH_BIN      8           // 0.48Hz
+#define MOTION_BINS                 (MOTION_LAST_BREATH_BIN + 1)
+#define MOTION_NOISE_FLOOR          16          // RMS change (zone reading counts) under which the bed is just still
+#define MOTION_MOVING_RMS           512         // RMS change above the breathing band that counts as moving
+#define MOTION_BREATH_SHARE         96          // /256 of the change in the breathing band that lands on OCCUPIED_CONFIDENCE
+
+// Types
+// What one window of the stream holds. Energies are mean squares of the
+// reading (in zone reading counts^2) once the window's mean and slope are taken off
+typedef struct SpectrumStruct {
+    uint32_t    Mean;
+    uint32_t    Mean_Square;                    // Everything that changed over the window
+    uint8_t     Drift_Share;                    // /256 of Mean_Square below the breathing band
+    uint8_t     Breath_Share;                   // /256 of Mean_Square in the breathing band
+    uint8_t     Peak_Bin;                       // Strongest bin of the breathing band
+    int8_t      Exponent;                       // Shift that put the window in Q15
+} SpectrumType;
+
+// Function Prototypes
+void AnalyseWindow(const uint32_t* ring, uint16_t oldest, SpectrumType* spectrum);
+uint8_t BreathingConfidence(const SpectrumType* spectrum);
+bool MovingQ(const SpectrumType* spectrum);
+
+#endif
@@ -0,0 +1,44 @@
+#include <math.h>
+#include "pico/stdlib.h"
+#include "Stats.h"
+#include "HotPath.h"
+
+// Clear everything and set the histogram to cover STATS_BUCKETS buckets
+// of 2^log2_bucket_width starting at histogram_low
+void ResetStats(RunningStatsType* stats, int32_t histogram_low, uint8_t log2_bucket_width){
+    stats->Count = 0;
+    stats->Mean = 0;
+    stats->M2 = 0;
+    stats->Min = INT32_MAX;
+    stats->Max = INT32_MIN;
+    stats->Histogram_Low = histogram_low;
+    stats->Log2_Bucket_Width = log2_bucket_width;
+    for (uint8_t i = 0; i < STATS_BUCKETS; i++) stats->Histogram[i] = 0;
+}
+
+// The latency probe's interrupt adds its samples, so this is in SRAM along
+// with the float helpers it uses
+void HOT_PATH_FUNC(AddStatsSample)(RunningStatsType* stats, int32_t sample){
+    stats->Count++;
+    // Welford's update
+    float delta = sample - stats->Mean;
+    stats->Mean += delta / stats->Count;
+    stats->M2 += delta * (sample - stats->Mean);
+
+    if (sample < stats->Min) stats->Min = sample;
+    if (sample > stats->Max) stats->Max = sample;
+
+    // Clamp into the end buckets rather than drop anything
+    int32_t bucket = (sample < stats->Histogram_Low) ? 0 : (sample - stats->Histogram_Low) >> stats->Log2_Bucket_Width;
+    if (bucket >= STATS_BUCKETS) bucket = STATS_BUCKETS - 1;
+    if (stats->Histogram[bucket] < UINT16_MAX) stats->Histogram[bucket]++;
+}
+
+// Sample variance, 0 until there are two samples
+float StatsVariance(const RunningStatsType* stats){
+    return (stats->Count > 1) ? stats->M2 / (stats->Count - 1) : 0;
+}
+
+float StatsDeviation(const RunningStatsType* stats){
+    return sqrtf(StatsVariance(stats));
+}
@@ -0,0 +1,30 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "pico/stdlib.h"
+
+// Defines
+#define STATS_BUCKETS               16
+
+// Types
+// Running statistics over a stream of samples, each update is O(1) and
+// nothing about the individual samples is kept. Mean and variance use 
+// Welford's method so they don't lose precision as the count grows
+typedef struct RunningStatsStruct {
+    uint32_t    Count;
+    float       Mean;
+    float       M2;                             // Sum of squared differences from the mean
+    int32_t     Min;
+    int32_t     Max;
+    int32_t     Histogram_Low;                  // Bucket 0 starts here
+    uint8_t     Log2_Bucket_Width;
+    uint16_t    Histogram[STATS_BUCKETS];       // Samples outside the range land in the end buckets
+} RunningStatsType;
+
+// Function Prototypes
+void ResetStats(RunningStatsType* stats, int32_t histogram_low, uint8_t log2_bucket_width);
+void AddStatsSample(RunningStatsType* stats, int32_t sample);
+float StatsVariance(const RunningStatsType* stats);
+float StatsDeviation(const RunningStatsType* stats);
+
+#endif
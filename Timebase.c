@@ -0,0 +1,207 @@
+#include "pico/stdlib.h"
+#include "hardware/rtc.h"
+#include "hardware/sync.h"
+#include "Timebase.h"
+#include "TimerWheel.h"
+
+// The RTC only counts whole seconds, so the wall clock is kept as an offset
+// from time_us_64() instead. The RTC seeds it (SetClock, or the time kept
+// across a reset) and is moved back onto it on a whole second every so
+// often. SyncTime exchanges correct it NTP style: the host's send and
+// receive times and ours give the offset with the round trip taken out.
+// Only the quickest round trip of each burst is used, and how far the clock
+// had to be stepped between bursts gives the crystal's drift
+
+// Globals
+TimebaseType Timebase = {0, 0, 0, false, false};
+static SyncStatsType Sync_Stats;
+static bool Sync_Pending = false;
+static uint64_t Burst_Start_US = 0;         // time_us_64() of the burst's first sample
+static int64_t Burst_Best_Delay_US;
+static int32_t Burst_Drift_Before;          // Drift going into the burst
+static uint64_t Previous_Burst_US = 0;      // Last applied sample of the burst before, 0 if it can't be judged from
+static TimerType Timebase_RTC_Timer;
+
+// ======================= Conversions ======================= //
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int32_t DaysFromCivil(int32_t year, uint32_t month, uint32_t day){
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    uint32_t year_of_era = year - era * 400;
+    uint32_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + (int32_t) day_of_era - 719468;
+}
+
+int64_t DatetimeToWallUs(const datetime_t* t){
+    int64_t seconds = DaysFromCivil(t->year, t->month, t->day) * 86400ll + t->hour * 3600l + t->min * 60l + t->sec;
+    return seconds * 1000000ll;
+}
+
+// Rounds down to the second
+void WallUsToDatetime(int64_t wall_us, datetime_t* t){
+    int64_t seconds = wall_us / 1000000 - (wall_us % 1000000 < 0);
+    int32_t days = seconds / 86400 - (seconds % 86400 < 0);
+    uint32_t second_of_day = seconds - days * 86400ll;
+    t->hour = second_of_day / 3600;
+    t->min = (second_of_day / 60) % 60;
+    t->sec = second_of_day % 60;
+    t->dotw = ((days % 7) + 11) % 7;        // 1970-01-01 was a Thursday
+    // Inverse of DaysFromCivil
+    days += 719468;
+    int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+    uint32_t day_of_era = days - era * 146097;
+    uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    uint32_t month_index = (5 * day_of_year + 2) / 153;
+    t->day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    t->month = month_index < 10 ? month_index + 3 : month_index - 9;
+    t->year = year_of_era + era * 400 + (t->month <= 2);
+}
+
+// Wall clock at a time_us_64() value. The drift is applied per ms so the
+// product can't overflow however long it's been since the base
+static int64_t WallAt(uint64_t local_us){
+    int64_t elapsed = (int64_t) (local_us - Timebase.Base_Local_US);
+    return Timebase.Base_Wall_US + elapsed + (elapsed / 1000) * Timebase.Drift_PPB / 1000000;
+}
+
+int64_t WallClockUs(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    int64_t wall = WallAt(time_us_64());
+    restore_interrupts(saved_irq);
+    return wall;
+}
+
+// The time_us_64() the wall clock reaches wall_us at, rounded up so timers
+// set from it are never early
+uint64_t LocalUsAt(int64_t wall_us){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    int64_t wall = wall_us - Timebase.Base_Wall_US;
+    int64_t local = wall - (wall / 1000) * Timebase.Drift_PPB / (1000000 + Timebase.Drift_PPB / 1000);
+    uint64_t local_us = Timebase.Base_Local_US + local;
+    while (WallAt(local_us) < wall_us) local_us++;
+    restore_interrupts(saved_irq);
+    return local_us;
+}
+
+// Move the base up to now, stepping the clock by step_us. Interrupts must be masked
+static void Rebase(int64_t step_us){
+    uint64_t now = time_us_64();
+    Timebase.Base_Wall_US = WallAt(now) + step_us;
+    Timebase.Base_Local_US = now;
+}
+
+// ======================= RTC ======================= //
+
+// Timer callback on a whole wall clock second. Puts the RTC on it and, while
+// we're here, rebases so the drift keeps being worked out over a short span
+static void Timebase_RTC_Callback(TimerType* timer){
+    datetime_t now;
+    uint32_t saved_irq = save_and_disable_interrupts();
+    Rebase(0);
+    // Rounded to the nearest second, the timer runs a tick or so late
+    WallUsToDatetime(Timebase.Base_Wall_US + 500000, &now);
+    restore_interrupts(saved_irq);
+    rtc_set_datetime(&now);
+    int64_t next = DatetimeToWallUs(&now) + TIMEBASE_RTC_ALIGN_US;
+    StartTimerAt(timer, LocalUsAt(next), 0, &Timebase_RTC_Callback, NULL);
+}
+
+// Put the RTC onto the timebase at the next whole second
+static void AlignRTC(){
+    int64_t wall = WallClockUs();
+    int64_t next = (wall / 1000000 + 1) * 1000000;
+    StartTimerAt(&Timebase_RTC_Timer, LocalUsAt(next), 0, &Timebase_RTC_Callback, NULL);
+}
+
+// Set the RTC and the timebase to t as of now. Anything learned from SyncTime
+// other than the drift is forgotten. Returns false if the RTC won't take t
+bool SetTimebase(const datetime_t* t){
+    datetime_t rtc_time = *t;
+    if (!rtc_set_datetime(&rtc_time)) return false;
+    uint32_t saved_irq = save_and_disable_interrupts();
+    Timebase.Base_Local_US = time_us_64();
+    Timebase.Base_Wall_US = DatetimeToWallUs(t);
+    Timebase.Set = true;
+    Timebase.Synced = false;
+    restore_interrupts(saved_irq);
+    Sync_Pending = false;
+    Burst_Start_US = 0;
+    Previous_Burst_US = 0;
+    StartTimerAt(&Timebase_RTC_Timer, LocalUsAt(Timebase.Base_Wall_US + TIMEBASE_RTC_ALIGN_US), 0, &Timebase_RTC_Callback, NULL);
+    return true;
+}
+
+// ======================= SyncTime ======================= //
+
+// The host sent t1 in a message that started coming in at received_us
+// (time_us_64()), and our reply is about to go out. The host's receive time
+// comes with its next SyncTime
+void SyncStart(int64_t t1, uint64_t received_us){
+    SyncSampleType* sample = &Sync_Stats.Last;
+    sample->T1 = t1;
+    sample->Local_US = time_us_64();
+    uint32_t saved_irq = save_and_disable_interrupts();
+    sample->T2 = WallAt(received_us);
+    sample->T3 = WallAt(sample->Local_US);
+    restore_interrupts(saved_irq);
+    sample->T4 = 0;
+    sample->Applied = false;
+    Sync_Pending = true;
+}
+
+// Finish the pending exchange with the host's receive time t4. If it's the
+// quickest of its burst the clock is stepped by its offset and the drift is
+// worked out again from the steps since the last burst. Returns false if
+// there was no exchange pending, sample gets the result either way
+bool SyncFinish(int64_t t4, SyncSampleType* sample){
+    if (!Sync_Pending){
+        *sample = Sync_Stats.Last;
+        return false;
+    }
+    Sync_Pending = false;
+    SyncSampleType* last = &Sync_Stats.Last;
+    last->T4 = t4;
+    last->Offset_US = ((last->T1 - last->T2) + (t4 - last->T3)) / 2;
+    last->Delay_US = (t4 - last->T1) - (last->T3 - last->T2);
+    Sync_Stats.Samples++;
+    if (last->Delay_US < 0 || last->Delay_US > SYNC_MAX_DELAY_US){
+        Sync_Stats.Rejected++;
+        *sample = *last;
+        return true;
+    }
+
+    // A new burst is judged against the last one's best sample, as long as
+    // that one was synced and long enough ago to tell drift from noise
+    if (Burst_Start_US == 0 || last->Local_US - Burst_Start_US > SYNC_BURST_US){
+        Previous_Burst_US = (Timebase.Synced && Burst_Start_US) ? Sync_Stats.Last_Sync_US : 0;
+        Burst_Start_US = last->Local_US;
+        Burst_Best_Delay_US = INT64_MAX;
+        Burst_Drift_Before = Timebase.Drift_PPB;
+        Sync_Stats.Burst_Step_US = 0;
+    }
+    if (last->Delay_US < Burst_Best_Delay_US){
+        Burst_Best_Delay_US = last->Delay_US;
+        Sync_Stats.Burst_Step_US += last->Offset_US;
+        Sync_Stats.Last_Sync_US = last->Local_US;
+        last->Applied = true;
+        uint32_t saved_irq = save_and_disable_interrupts();
+        Rebase(last->Offset_US);
+        if (Previous_Burst_US && last->Local_US - Previous_Burst_US >= SYNC_MIN_DRIFT_US){
+            int64_t drift = Burst_Drift_Before + Sync_Stats.Burst_Step_US * 1000000000ll / (int64_t) (last->Local_US - Previous_Burst_US);
+            Timebase.Drift_PPB = MAX(-SYNC_MAX_DRIFT_PPB, MIN(SYNC_MAX_DRIFT_PPB, drift));
+        }
+        Timebase.Set = true;
+        Timebase.Synced = true;
+        restore_interrupts(saved_irq);
+        AlignRTC();
+    }
+    *sample = *last;
+    return true;
+}
+
+void GetSyncStats(SyncStatsType* stats){
+    *stats = Sync_Stats;
+}
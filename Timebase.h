@@ -0,0 +1,63 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include "pico/stdlib.h"
+#include "pico/util/datetime.h"
+
+// Wall clock times are us since 1970-01-01 00:00:00 in the clock's own
+// time zone (whatever SetClock was given), so no time zone is ever stored
+
+// Defines
+#define SYNC_BURST_US               60000000    // Samples this close together are one burst, only the best of it counts
+#define SYNC_MAX_DELAY_US           2000000     // Round trips longer than this aren't worth correcting from
+#define SYNC_MIN_DRIFT_US           600000000   // Bursts have to be 10 min apart to judge drift from
+#define SYNC_MAX_DRIFT_PPB          500000      // A crystal 500ppm out is broken, not drifting
+#define TIMEBASE_RTC_ALIGN_US       3600000000u // Move the RTC onto the timebase this often
+
+// Types
+// The wall clock is Base_Wall_US at Base_Local_US (time_us_64()) and runs
+// Drift_PPB faster than the crystal from there. Only SetClock and SyncTime step it
+typedef struct TimebaseStruct {
+    uint64_t    Base_Local_US;
+    int64_t     Base_Wall_US;
+    int32_t     Drift_PPB;
+    bool        Set;                    // By SetClock or a restored RTC at least
+    bool        Synced;                 // By SyncTime since then
+} TimebaseType;
+
+// One NTP style exchange. T1 and T4 are the host's clock as the request went
+// out and the reply came back, T2 and T3 ours as the request came in and the
+// reply went out. All wall clock us
+typedef struct SyncSampleStruct {
+    int64_t     T1;
+    int64_t     T2;
+    int64_t     T3;
+    int64_t     T4;
+    uint64_t    Local_US;               // time_us_64() at T3
+    int64_t     Offset_US;              // Host minus us
+    int64_t     Delay_US;               // Round trip, less the time we held the request
+    bool        Applied;                // Best of its burst so far, so the clock was stepped by it
+} SyncSampleType;
+
+typedef struct SyncStatsStruct {
+    uint32_t        Samples;
+    uint32_t        Rejected;           // Negative or over SYNC_MAX_DELAY_US round trips
+    SyncSampleType  Last;
+    int64_t         Burst_Step_US;      // Stepped by in the current burst
+    uint64_t        Last_Sync_US;       // time_us_64() of the last applied sample
+} SyncStatsType;
+
+// Globals
+extern TimebaseType Timebase;
+
+// Function Prototypes
+int64_t WallClockUs();
+uint64_t LocalUsAt(int64_t wall_us);
+int64_t DatetimeToWallUs(const datetime_t* t);
+void WallUsToDatetime(int64_t wall_us, datetime_t* t);
+bool SetTimebase(const datetime_t* t);
+void SyncStart(int64_t t1, uint64_t received_us);
+bool SyncFinish(int64_t t4, SyncSampleType* sample);
+void GetSyncStats(SyncStatsType* stats);
+
+#endif
@@ -0,0 +1,252 @@
+#include "pico/stdlib.h"
+#include "hardware/timer.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+#include "TimerWheel.h"
+#include "HotPath.h"
+
+// Every firmware event under a second or so (beep cadence, button debounce,
+// the end of a UART message, escalation steps) and the alarm window
+// boundaries is a TimerType on one hierarchical wheel, driven by a single
+// hardware alarm. Its interrupt is ours alone and the alarm is set straight
+// through timer_hw, so nothing the wheel does runs from flash. Level 0 has a slot per tick and each level above a slot
+// per lap of the one below, so starting a timer is a push onto one slot's
+// list and cancelling it an unlink, O(1) however many are pending. The
+// alarm is only ever set for the next thing there is to do, a timer coming
+// due or a slot that has to be cascaded down a level, so an idle wheel
+// never wakes us
+
+// Globals
+static TimerType* Timer_Wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t Timer_Occupied[TIMER_LEVELS];       // Bit per slot with anything in it
+static uint64_t Timer_Tick = 0;                     // Next tick to be run
+static int Timer_Alarm = -1;
+static bool Timer_In_IRQ = false;
+static TimerStatsType Timer_Stats;
+volatile uint32_t Timer_IRQ_Entry;                  // SysTick as the interrupt came in, for Jitter
+
+static inline uint64_t LevelMask(uint8_t level){
+    return (1ull << (TIMER_LEVEL_SHIFT * level)) - 1;
+}
+
+// ======================= Wheel ======================= //
+
+// Put a timer in the slot its due tick falls in, at the lowest level that
+// reaches it from the current tick. Interrupts must be masked
+static void HOT_PATH_FUNC(Insert)(TimerType* timer){
+    // Round up so it's never run early, and anything overdue is run next tick
+    uint64_t target = (timer->When_US + TIMER_TICK_US - 1) >> TIMER_TICK_SHIFT;
+    if (target < Timer_Tick) target = Timer_Tick;
+    uint64_t delta = target - Timer_Tick;
+    if (delta >= TIMER_HORIZON_TICKS){
+        delta = TIMER_HORIZON_TICKS - 1;
+        target = Timer_Tick + delta;
+    }
+    uint8_t level = 0;
+    while (level < TIMER_LEVELS - 1 && delta > LevelMask(level + 1)) level++;
+    uint8_t slot = (target >> (TIMER_LEVEL_SHIFT * level)) & (TIMER_SLOTS - 1);
+
+    TimerType** head = &Timer_Wheel[level][slot];
+    timer->Level = level;
+    timer->Slot = slot;
+    timer->Prev = NULL;
+    timer->Next = *head;
+    if (*head) (*head)->Prev = timer;
+    *head = timer;
+    Timer_Occupied[level] |= 1ull << slot;
+}
+
+// Take a timer back out of its slot. Interrupts must be masked
+static void HOT_PATH_FUNC(Unlink)(TimerType* timer){
+    if (timer->Prev) timer->Prev->Next = timer->Next;
+    else Timer_Wheel[timer->Level][timer->Slot] = timer->Next;
+    if (timer->Next) timer->Next->Prev = timer->Prev;
+    if (!Timer_Wheel[timer->Level][timer->Slot]) Timer_Occupied[timer->Level] &= ~(1ull << timer->Slot);
+    timer->Next = NULL;
+    timer->Prev = NULL;
+}
+
+// The next tick with anything to do. A level 0 slot is due on its own tick,
+// a slot above is cascaded at the start of its block. The current block's
+// slot has already been cascaded unless we're right at its start, so
+// anything in it is a whole lap away. Interrupts must be masked
+static uint64_t HOT_PATH_FUNC(NextEventTick)(){
+    uint64_t next = TIMER_NEVER;
+    for (uint8_t level = 0; level < TIMER_LEVELS; level++){
+        if (!Timer_Occupied[level]) continue;
+        uint8_t shift = TIMER_LEVEL_SHIFT * level;
+        uint64_t block = Timer_Tick >> shift;
+        uint8_t index = block & (TIMER_SLOTS - 1);
+        // Rotate so bit 0 is the current slot
+        uint64_t ahead = index ? (Timer_Occupied[level] >> index) | (Timer_Occupied[level] << (TIMER_SLOTS - index)) : Timer_Occupied[level];
+        if (level > 0 && (Timer_Tick & LevelMask(level))) ahead &= ~1ull;
+        uint64_t tick = (block + (ahead ? __builtin_ctzll(ahead) : TIMER_SLOTS)) << shift;
+        if (tick < next) next = tick;
+    }
+    return next;
+}
+
+// Set the hardware alarm for the next event, or run the interrupt straight
+// away if that's already gone by. The alarm only matches the low 32 bits of
+// the timer, so one more than ~71 minutes off goes off early and the
+// interrupt just re-arms. Interrupts must be masked
+static void HOT_PATH_FUNC(ArmAlarm)(){
+    uint64_t next = NextEventTick();
+    if (next == TIMER_NEVER){
+        // Writing its bit to ARMED disarms it
+        timer_hw->armed = 1u << Timer_Alarm;
+        return;
+    }
+    uint64_t target = next << TIMER_TICK_SHIFT;
+    timer_hw->alarm[Timer_Alarm] = (uint32_t) target;
+    if (TimerNowUs() >= target){
+        timer_hw->armed = 1u << Timer_Alarm;
+        hw_set_bits(&timer_hw->intf, 1u << Timer_Alarm);
+    }
+}
+
+// Move everything in one slot down to wherever it belongs from the current tick
+static void HOT_PATH_FUNC(Cascade)(uint8_t level, uint8_t slot){
+    TimerType* timer = Timer_Wheel[level][slot];
+    Timer_Wheel[level][slot] = NULL;
+    Timer_Occupied[level] &= ~(1ull << slot);
+    while (timer){
+        TimerType* next = timer->Next;
+        Insert(timer);
+        Timer_Stats.Cascaded++;
+        timer = next;
+    }
+}
+
+// Cascade whatever starts at the current tick, highest level first so it
+// can carry on down, then run everything due on it. The lock is dropped
+// around each callback, the slot's head is looked at afresh every time
+// round since a callback (or another interrupt) can change it
+static uint32_t HOT_PATH_FUNC(RunTick)(uint32_t saved_irq){
+    for (uint8_t level = TIMER_LEVELS - 1; level > 0; level--){
+        if (Timer_Tick & LevelMask(level)) continue;
+        Cascade(level, (Timer_Tick >> (TIMER_LEVEL_SHIFT * level)) & (TIMER_SLOTS - 1));
+    }
+    TimerType** head = &Timer_Wheel[0][Timer_Tick & (TIMER_SLOTS - 1)];
+    while (*head){
+        TimerType* timer = *head;
+        Unlink(timer);
+        uint64_t now = TimerNowUs();
+        uint32_t late = now - timer->When_US;
+        if (late > Timer_Stats.Worst_Late_US) Timer_Stats.Worst_Late_US = late;
+        Timer_Stats.Fired++;
+        // Repeating timers keep their phase unless they've fallen a whole period behind
+        if (timer->Period_US){
+            timer->When_US += timer->Period_US;
+            if (timer->When_US <= now) timer->When_US = now + timer->Period_US;
+            Insert(timer);
+        }else{
+            timer->Pending = false;
+            Timer_Stats.Pending--;
+        }
+        restore_interrupts(saved_irq);
+        timer->Callback(timer);
+        saved_irq = save_and_disable_interrupts();
+    }
+    Timer_Tick++;
+    return saved_irq;
+}
+
+// The one hardware alarm's interrupt. Runs every tick up to now that has
+// anything to do, skipping straight over the ones that don't, then re-arms
+static void HOT_PATH_FUNC(TimerAlarmCallback)(){
+    Timer_IRQ_Entry = systick_hw->cvr;
+    // Clear both the alarm and a forced interrupt, ArmAlarm() may have used either
+    hw_clear_bits(&timer_hw->intf, 1u << Timer_Alarm);
+    timer_hw->intr = 1u << Timer_Alarm;
+    uint32_t saved_irq = save_and_disable_interrupts();
+    Timer_In_IRQ = true;
+    Timer_Stats.Interrupts++;
+    uint64_t now_tick = TimerNowUs() >> TIMER_TICK_SHIFT;
+    while (Timer_Tick <= now_tick){
+        uint64_t next = NextEventTick();
+        if (next > now_tick){
+            Timer_Tick = now_tick + 1;
+            break;
+        }
+        Timer_Tick = next;
+        saved_irq = RunTick(saved_irq);
+    }
+    Timer_In_IRQ = false;
+    ArmAlarm();
+    restore_interrupts(saved_irq);
+}
+
+// ======================= Timers ======================= //
+
+// Boot step, claims the hardware alarm and takes its interrupt for our own
+// handler rather than the SDK's (in flash) dispatcher. Has to come before
+// anything starts a timer
+void InitializeTimers(){
+    Timer_Tick = time_us_64() >> TIMER_TICK_SHIFT;
+    Timer_Alarm = hardware_alarm_claim_unused(true);
+    irq_set_exclusive_handler(TIMER_IRQ_0 + Timer_Alarm, &TimerAlarmCallback);
+    hw_set_bits(&timer_hw->inte, 1u << Timer_Alarm);
+    irq_set_enabled(TIMER_IRQ_0 + Timer_Alarm, true);
+}
+
+// The interrupt the wheel's alarm raises, Jitter pends it to time the handler
+int TimerAlarmIRQ(){
+    return TIMER_IRQ_0 + Timer_Alarm;
+}
+
+// Run callback at when_us (time since boot) and, if period_us isn't 0, every
+// period_us after that. A timer that's already pending is moved. Safe to call
+// from an ISR
+void HOT_PATH_FUNC(StartTimerAt)(TimerType* timer, uint64_t when_us, uint32_t period_us, void (*callback)(TimerType* timer), void* data){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (timer->Pending){
+        Unlink(timer);
+    }else{
+        timer->Pending = true;
+        Timer_Stats.Pending++;
+    }
+    timer->When_US = when_us;
+    timer->Period_US = period_us;
+    timer->Callback = callback;
+    timer->Data = data;
+    Insert(timer);
+    // The interrupt re-arms on its way out
+    if (!Timer_In_IRQ) ArmAlarm();
+    restore_interrupts(saved_irq);
+}
+
+void HOT_PATH_FUNC(StartTimerUs)(TimerType* timer, uint32_t delay_us, uint32_t period_us, void (*callback)(TimerType* timer), void* data){
+    StartTimerAt(timer, TimerNowUs() + delay_us, period_us, callback, data);
+}
+
+void HOT_PATH_FUNC(StartTimerMs)(TimerType* timer, uint32_t delay_ms, uint32_t period_ms, void (*callback)(TimerType* timer), void* data){
+    StartTimerAt(timer, TimerNowUs() + delay_ms * 1000ull, period_ms * 1000ul, callback, data);
+}
+
+// Safe to call from an ISR, or on a timer that isn't pending. The alarm is
+// left as it was, at worst it wakes us once for nothing
+void HOT_PATH_FUNC(CancelTimer)(TimerType* timer){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (timer->Pending){
+        Unlink(timer);
+        timer->Pending = false;
+        Timer_Stats.Pending--;
+    }
+    restore_interrupts(saved_irq);
+}
+
+// When the hardware alarm will next go off, TIMER_NEVER if nothing's pending
+uint64_t NextTimerUs(){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    uint64_t next = NextEventTick();
+    restore_interrupts(saved_irq);
+    return next == TIMER_NEVER ? next : next << TIMER_TICK_SHIFT;
+}
+
+void GetTimerStats(TimerStatsType* stats){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    *stats = Timer_Stats;
+    restore_interrupts(saved_irq);
+}
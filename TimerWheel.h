@@ -0,0 +1,58 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "pico/stdlib.h"
+#include "hardware/structs/timer.h"
+#include "HotPath.h"
+
+// Defines
+#define TIMER_TICK_SHIFT            6           // 64us ticks
+#define TIMER_TICK_US               (1ul << TIMER_TICK_SHIFT)
+#define TIMER_LEVEL_SHIFT           6           // 64 slots a level, each level's slot is a lap of the one below
+#define TIMER_SLOTS                 (1ul << TIMER_LEVEL_SHIFT)
+#define TIMER_LEVELS                5           // 64^5 ticks, about 19 hours. Anything further is parked at the top and put back
+#define TIMER_HORIZON_TICKS         (1ull << (TIMER_LEVEL_SHIFT * TIMER_LEVELS))
+#define TIMER_NEVER                 UINT64_MAX
+
+// Types
+// Callers own the storage, starting and cancelling never allocate. Callbacks
+// run from the alarm interrupt and may start or cancel any timer, their own included
+typedef struct TimerStruct {
+    struct TimerStruct* Next;               // Rest of the slot it's in
+    struct TimerStruct* Prev;
+    uint64_t            When_US;            // Due at, never run before this
+    uint32_t            Period_US;          // 0 for one shot
+    void                (*Callback)(struct TimerStruct* timer);
+    void*               Data;
+    uint8_t             Level;
+    uint8_t             Slot;
+    volatile bool       Pending;
+} TimerType;
+
+typedef struct TimerStatsStruct {
+    uint32_t    Pending;                    // Timers on the wheel right now
+    uint32_t    Fired;
+    uint32_t    Cascaded;                   // Times a timer was moved down a level
+    uint32_t    Interrupts;
+    uint32_t    Worst_Late_US;              // Longest a callback ran after its timer was due
+} TimerStatsType;
+
+// Globals
+extern volatile uint32_t Timer_IRQ_Entry;
+
+// Function Prototypes
+void InitializeTimers();
+void StartTimerAt(TimerType* timer, uint64_t when_us, uint32_t period_us, void (*callback)(TimerType* timer), void* data);
+void StartTimerUs(TimerType* timer, uint32_t delay_us, uint32_t period_us, void (*callback)(TimerType* timer), void* data);
+void StartTimerMs(TimerType* timer, uint32_t delay_ms, uint32_t period_ms, void (*callback)(TimerType* timer), void* data);
+void CancelTimer(TimerType* timer);
+uint64_t NextTimerUs();
+void GetTimerStats(TimerStatsType* stats);
+int TimerAlarmIRQ();
+
+// Inline so the interrupt handlers in SRAM never call into flash for them
+static inline bool TimerPendingQ(const TimerType* timer){
+    return timer->Pending;
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/rtc.h"
+#include "Trace.h"
+#include "Sensors.h"
+#include "LoadCellADC.h"
+
+// The trace is a ring that overwrites its oldest records once full, so
+// it always ends with the most recent window. Records are only added from
+// the main loop, received messages included since that's where they're run
+
+// Globals
+static TraceRecordType Trace_Records[TRACE_RECORDS];
+static uint32_t Trace_Added = 0;                // Records ever added, the newest is at (Trace_Added - 1) % TRACE_RECORDS
+static volatile bool Tracing = false;
+static uint64_t Trace_Start_US;
+static uint64_t Trace_Last_Sample_US;
+static bool Trace_In_Window;
+static AlarmStateType Trace_Settings;           // The settings last written to the trace
+static int32_t Trace_Zero;
+static int32_t Trace_Scale;
+
+static TraceRecordType* TraceAdd(TraceTypeType type){
+    TraceRecordType* record = &Trace_Records[Trace_Added % TRACE_RECORDS];
+    Trace_Added++;
+    uint32_t ms = (time_us_64() - Trace_Start_US) / 1000;
+    record->Stamp = ((uint32_t) type << TRACE_TYPE_SHIFT) | (ms & TRACE_TIME_MASK);
+    return record;
+}
+
+// Write out any settings that changed since the last time
+static void TraceSettings(const AlarmStateType* state){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    if (memcmp(state->Threshold, Trace_Settings.Threshold, sizeof(state->Threshold)) || memcmp(state->Scale_Sensitivity, Trace_Settings.Scale_Sensitivity, sizeof(state->Scale_Sensitivity))){
+        TraceRecordType* record = TraceAdd(TRACE_THRESHOLDS);
+        memcpy(record->Thresholds.Threshold, state->Threshold, sizeof(state->Threshold));
+        memcpy(record->Thresholds.Scale_Sensitivity, state->Scale_Sensitivity, sizeof(state->Scale_Sensitivity));
+    }
+    if (memcmp(state->Hysteresis, Trace_Settings.Hysteresis, sizeof(state->Hysteresis)) || state->Zone_Mask != Trace_Settings.Zone_Mask){
+        TraceRecordType* record = TraceAdd(TRACE_HYSTERESIS);
+        memcpy(record->Hysteresis.Hysteresis, state->Hysteresis, sizeof(state->Hysteresis));
+        record->Hysteresis.Zone_Mask = state->Zone_Mask;
+    }
+    if (Scale_Zero_Offset != Trace_Zero){
+        TraceAdd(TRACE_ZERO)->Zero = Scale_Zero_Offset;
+        Trace_Zero = Scale_Zero_Offset;
+    }
+    Trace_Settings = *state;
+    restore_interrupts(saved_irq);
+}
+
+// Start a new trace, throwing away the old one
+void StartTrace(){
+    AlarmStateType state;
+    ReadAlarmState(&state);
+
+    uint32_t saved_irq = save_and_disable_interrupts();
+    Tracing = false;
+    Trace_Added = 0;
+    Trace_Start_US = time_us_64();
+    rtc_get_datetime(&TraceAdd(TRACE_CLOCK)->Clock);
+    // Make sure every setting gets written at the start
+    memset(&Trace_Settings, 0xFF, sizeof(Trace_Settings));
+    Trace_Zero = ~Scale_Zero_Offset;
+    Trace_In_Window = !state.In_Alarm_Window;
+    Trace_Last_Sample_US = 0;
+    Trace_Scale = Sensor_Status[SENSOR_SCALE].Last_Sample;
+    Tracing = true;
+    restore_interrupts(saved_irq);
+}
+
+void StopTrace(){
+    Tracing = false;
+}
+
+bool TracingQ(){
+    return Tracing;
+}
+
+// Called every pass of the main loop. Notes window and setting changes 
+// and takes a sample every TRACE_WINDOW_PERIOD_MS in a window and 
+// TRACE_IDLE_PERIOD_MS outside one
+void TraceStep(const AlarmStateType* state){
+    if (!Tracing) return;
+    uint64_t now = time_us_64();
+
+    TraceSettings(state);
+    if (state->In_Alarm_Window != Trace_In_Window){
+        Trace_In_Window = state->In_Alarm_Window;
+        uint32_t saved_irq = save_and_disable_interrupts();
+        TraceAdd(TRACE_WINDOW)->Open = Trace_In_Window;
+        restore_interrupts(saved_irq);
+        // Sample straight away at the start of a window
+        Trace_Last_Sample_US = 0;
+    }
+
+    uint32_t period_ms = Trace_In_Window ? TRACE_WINDOW_PERIOD_MS : TRACE_IDLE_PERIOD_MS;
+    if (Trace_Last_Sample_US != 0 && now - Trace_Last_Sample_US < period_ms * 1000ull) return;
+    Trace_Last_Sample_US = now;
+
+    uint16_t zones[NUMBER_OF_ZONES];
+    if (Trace_In_Window){
+        // The sensing loop is keeping the zones up to date
+        ReadZones(zones);
+    }else{
+        // The zone ADC is paused between windows
+        if (!MeasureZones(zones)) return;
+    }
+    // The load cell is read every pass in the window and by ScaleStep() between them
+    Trace_Scale = Sensor_Status[SENSOR_SCALE].Last_Sample;
+    uint32_t saved_irq = save_and_disable_interrupts();
+    TraceRecordType* record = TraceAdd(TRACE_SAMPLE);
+    memcpy(record->Sample.Zones, zones, sizeof(zones));
+    record->Sample.Scale = Trace_Scale;
+    restore_interrupts(saved_irq);
+}
+
+// Keep a received message, split over as many records as it takes. 
+// New lines are stored as ';' so each piece stays on one line when dumped
+void TraceMessage(const uint8_t* msg, size_t len){
+    if (!Tracing) return;
+    uint32_t saved_irq = save_and_disable_interrupts();
+    for (size_t i = 0; i < len; i += TRACE_TEXT_SIZE){
+        TraceRecordType* record = TraceAdd(TRACE_RX);
+        for (size_t j = 0; j < TRACE_TEXT_SIZE; j++){
+            char c = (i + j < len) ? msg[i + j] : '\0';
+            record->Text[j] = (c == '\n' || c == '\r') ? ';' : c;
+        }
+    }
+    restore_interrupts(saved_irq);
+}
+
+// Records that can still be dumped, the oldest is index 0
+uint32_t TraceRecordCount(){
+    return (Trace_Added < TRACE_RECORDS) ? Trace_Added : TRACE_RECORDS;
+}
+
+// Records lost to the ring wrapping
+uint32_t TraceDroppedCount(){
+    return Trace_Added - TraceRecordCount();
+}
+
+// Write one record as a line of text, the format tools/replay reads.
+// Returns the length like snprintf
+int FormatTraceRecord(uint32_t index, char* buffer, size_t size){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    TraceRecordType record = Trace_Records[(TraceDroppedCount() + index) % TRACE_RECORDS];
+    restore_interrupts(saved_irq);
+
+    uint32_t ms = record.Stamp & TRACE_TIME_MASK;
+    switch (record.Stamp >> TRACE_TYPE_SHIFT){
+        case TRACE_SAMPLE:
+            return snprintf(buffer, size, "S %lu %u %u %u %u %ld\n", ms, record.Sample.Zones[0], record.Sample.Zones[1], record.Sample.Zones[2], record.Sample.Zones[3], record.Sample.Scale);
+        case TRACE_WINDOW:
+            return snprintf(buffer, size, "W %lu %d\n", ms, record.Open);
+        case TRACE_RX:
+            return snprintf(buffer, size, "R %lu %.*s\n", ms, TRACE_TEXT_SIZE, record.Text);
+        case TRACE_THRESHOLDS:
+            return snprintf(buffer, size, "U %lu %u %u %u %u %u %u %u %u\n", ms, record.Thresholds.Threshold[0], record.Thresholds.Threshold[1], record.Thresholds.Threshold[2], record.Thresholds.Threshold[3], 
+                record.Thresholds.Scale_Sensitivity[0], record.Thresholds.Scale_Sensitivity[1], record.Thresholds.Scale_Sensitivity[2], record.Thresholds.Scale_Sensitivity[3]);
+        case TRACE_HYSTERESIS:
+            return snprintf(buffer, size, "H %lu %u %u %u %u %u\n", ms, record.Hysteresis.Hysteresis[0], record.Hysteresis.Hysteresis[1], record.Hysteresis.Hysteresis[2], record.Hysteresis.Hysteresis[3], record.Hysteresis.Zone_Mask);
+        case TRACE_ZERO:
+            return snprintf(buffer, size, "Z %lu %ld\n", ms, record.Zero);
+        case TRACE_CLOCK:
+            return snprintf(buffer, size, "C %lu %d %d %d %d %d %d\n", ms, record.Clock.year, record.Clock.month, record.Clock.day, record.Clock.hour, record.Clock.min, record.Clock.sec);
+        default:
+            return snprintf(buffer, size, "# %lu unknown record\n", ms);
+    }
+}
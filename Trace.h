@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "pico/stdlib.h"
+#include "AlarmState.h"
+
+// Defines
+#define TRACE_RECORDS               6144        // 96KB, a 30 minute window plus a night of idle samples
+#define TRACE_WINDOW_PERIOD_MS      500         // Sample period inside a window
+#define TRACE_IDLE_PERIOD_MS        30000       // and outside one
+#define TRACE_TEXT_SIZE             12
+#define TRACE_TIME_MASK             0x0FFFFFFFul    // ms since the trace started, ~74 hours
+#define TRACE_TYPE_SHIFT            28
+#define TRACE_DUMP_LINES            32          // Records sent back per TraceDump, keeps it under CMD_RESPONSE_SIZE
+
+// Types
+typedef enum TraceTypeEnum {
+    TRACE_SAMPLE,           // Every zone's reading and the load cell
+    TRACE_WINDOW,           // The alarm window opened or closed
+    TRACE_RX,               // A piece of a received Bluetooth message
+    TRACE_THRESHOLDS,       // Threshold and Scale_Sensitivity for every zone
+    TRACE_HYSTERESIS,       // Hysteresis for every zone and the Zone_Mask
+    TRACE_ZERO,             // Load cell zero offset
+    TRACE_CLOCK             // RTC time the trace started at
+} TraceTypeType;
+
+// One 16 byte entry in the trace
+typedef struct TraceRecordStruct {
+    uint32_t    Stamp;                  // Type in the top 4 bits, time below
+    union {
+        struct {
+            uint16_t    Zones[NUMBER_OF_ZONES];
+            int32_t     Scale;
+        } Sample;
+        struct {
+            uint16_t    Threshold[NUMBER_OF_ZONES];
+            uint8_t     Scale_Sensitivity[NUMBER_OF_ZONES];
+        } Thresholds;
+        struct {
+            uint16_t    Hysteresis[NUMBER_OF_ZONES];
+            uint8_t     Zone_Mask;
+        } Hysteresis;
+        char        Text[TRACE_TEXT_SIZE];
+        int32_t     Zero;
+        bool        Open;
+        datetime_t  Clock;
+    };
+} TraceRecordType;
+
+// Function Prototypes
+void StartTrace();
+void StopTrace();
+bool TracingQ();
+void TraceStep(const AlarmStateType* state);
+void TraceMessage(const uint8_t* msg, size_t len);
+uint32_t TraceRecordCount();
+uint32_t TraceDroppedCount();
+int FormatTraceRecord(uint32_t index, char* buffer, size_t size);
+
+#endif
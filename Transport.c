@@ -0,0 +1,184 @@
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
+#include "tusb.h"
+#include "Transport.h"
+#include "HC05.h"
+#include "HotPath.h"
+
+// Function Prototypes
+static void USBPoll();
+static void Transport_Gap_Callback(TimerType* timer);
+
+// Globals
+static uint8_t BT_RX_Data[TRANSPORT_RX_SIZE];
+static uint8_t BT_TX_Data[TRANSPORT_BT_TX_SIZE];
+static uint8_t USB_RX_Data[TRANSPORT_RX_SIZE];
+static uint8_t USB_TX_Data[TRANSPORT_USB_TX_SIZE];
+
+TransportType Transports[NUMBER_OF_TRANSPORTS] = {
+    // Name         // Poll         // Kick             // Bulk     // Max bytes/s                  // RX                                           // TX
+    {"Bluetooth",   NULL,           &BluetoothKick,     false,      DATA_MODE_BAUD_RATE / 10,       {BT_RX_Data, TRANSPORT_RX_SIZE - 1, 0, 0},      {BT_TX_Data, TRANSPORT_BT_TX_SIZE - 1, 0, 0}},
+    {"USB",         &USBPoll,       NULL,               true,       TRANSPORT_USB_BYTES_PER_S,      {USB_RX_Data, TRANSPORT_RX_SIZE - 1, 0, 0},     {USB_TX_Data, TRANSPORT_USB_TX_SIZE - 1, 0, 0}}
+};
+
+// Boot step, commands are accepted on every link from here on
+void EnableCommands(){
+    Transports[TRANSPORT_USB].Enabled = true;
+    EnableBluetoothCommands();
+}
+
+// Called for every byte that comes in, from an ISR or the main loop. The
+// message is run once the link goes quiet, the gap timer just makes sure
+// the main loop wakes up to notice
+void HOT_PATH_FUNC(TransportReceived)(TransportIdType id, uint8_t byte){
+    TransportType* transport = &Transports[id];
+    if (!transport->Enabled) return;
+    if (QueueUsed(&transport->RX) == 0) transport->First_RX_US = TimerNowUs();
+    if (!QueuePut(&transport->RX, byte)) transport->RX_Dropped++;
+    transport->Last_RX_US = time_us_32();
+    if (!TimerPendingQ(&transport->Gap_Timer)){
+        StartTimerUs(&transport->Gap_Timer, TRANSPORT_MESSAGE_GAP_US, 0, &Transport_Gap_Callback, transport);
+    }
+}
+
+// Timer callback that keeps pushing itself back until the link has been quiet for the gap
+static void HOT_PATH_FUNC(Transport_Gap_Callback)(TimerType* timer){
+    TransportType* transport = timer->Data;
+    uint32_t quiet = time_us_32() - transport->Last_RX_US;
+    if (quiet < TRANSPORT_MESSAGE_GAP_US) StartTimerUs(timer, TRANSPORT_MESSAGE_GAP_US - quiet, 0, &Transport_Gap_Callback, transport);
+}
+
+// Queue as much of str as fits and get it moving, never blocks. Interrupts
+// are masked while queueing since ISRs send too (the HC05 welcome message).
+// Returns how many bytes were queued
+size_t TransportSend(TransportIdType id, const char* str){
+    TransportType* transport = &Transports[id];
+    size_t sent = 0;
+    uint32_t saved_irq = save_and_disable_interrupts();
+    while (str[sent] && QueuePut(&transport->TX, str[sent])) sent++;
+    restore_interrupts(saved_irq);
+    if (transport->Kick) transport->Kick();
+    return sent;
+}
+
+// Queue all of str, waiting on the link for room. Only for the main loop and
+// bulk links, the watchdog is fed as long as bytes keep going out. Returns
+// false if the link stopped taking bytes for TRANSPORT_STALL_US
+bool TransportSendAll(TransportIdType id, const char* str){
+    TransportType* transport = &Transports[id];
+    uint32_t last_progress = time_us_32();
+    while (*str){
+        size_t sent = TransportSend(id, str);
+        str += sent;
+        if (sent){
+            last_progress = time_us_32();
+            watchdog_update();
+        }else if (time_us_32() - last_progress > TRANSPORT_STALL_US){
+            return false;
+        }
+        if (*str && transport->Poll) transport->Poll();
+    }
+    return true;
+}
+
+// Throw away anything still waiting to go out, for when the link goes away
+void TransportDiscardTX(TransportIdType id){
+    uint32_t saved_irq = save_and_disable_interrupts();
+    Transports[id].TX.Tail = Transports[id].TX.Head;
+    restore_interrupts(saved_irq);
+}
+
+// Hand the rest of a reply over to stream, which is called on every pass of
+// the main loop to queue the next piece as the link drains. Nothing else is
+// run on the link until it's done, so replies never interleave
+void TransportStartStream(TransportIdType id, bool (*stream)(TransportIdType id)){
+    TransportType* transport = &Transports[id];
+    transport->Stream_Tail = transport->TX.Tail;
+    transport->Stream_Progress_US = time_us_32();
+    transport->Stream = stream;
+}
+
+// Queue the next piece of a streamed reply. Gives up on it once the link
+// stops taking bytes for TRANSPORT_STALL_US, like TransportSendAll
+static void TransportStreamStep(TransportIdType id){
+    TransportType* transport = &Transports[id];
+    if (transport->TX.Tail != transport->Stream_Tail){
+        transport->Stream_Tail = transport->TX.Tail;
+        transport->Stream_Progress_US = time_us_32();
+    }else if (QueueUsed(&transport->TX) > 0 && time_us_32() - transport->Stream_Progress_US > TRANSPORT_STALL_US){
+        transport->Stream = NULL;
+        return;
+    }
+    if (!transport->Stream(id)) transport->Stream = NULL;
+}
+
+// Called from the main loop. Moves bytes on the polled links and runs one
+// message from each link that has gone quiet, its reply goes back the same way
+void ServiceTransports(){
+    static uint8_t message[TRANSPORT_MESSAGE_SIZE + 1];     // Leave room to terminate the message
+
+    for (uint8_t id = 0; id < NUMBER_OF_TRANSPORTS; id++){
+        TransportType* transport = &Transports[id];
+        if (!transport->Enabled) continue;
+        if (transport->Poll) transport->Poll();
+
+        // A streamed reply has to finish before the next message is run
+        if (transport->Stream){
+            TransportStreamStep(id);
+            if (transport->Poll) transport->Poll();
+            continue;
+        }
+
+        // Wait for the link to go quiet, unless a whole message is already in
+        uint16_t waiting = QueueUsed(&transport->RX);
+        if (waiting == 0) continue;
+        if (waiting < TRANSPORT_MESSAGE_SIZE && time_us_32() - transport->Last_RX_US < TRANSPORT_MESSAGE_GAP_US) continue;
+
+        // A message too long to take in one go is cut after its last whole
+        // command, so commands sent back to back are never split in two
+        size_t length = MIN(waiting, TRANSPORT_MESSAGE_SIZE);
+        if (waiting >= TRANSPORT_MESSAGE_SIZE){
+            size_t cut = length;
+            while (cut > 0 && QueuePeek(&transport->RX, cut - 1) != '\n' && QueuePeek(&transport->RX, cut - 1) != ';') cut--;
+            if (cut > 0) length = cut;
+        }
+        transport->Message_RX_US = transport->First_RX_US;
+        for (size_t i = 0; i < length; i++) QueueGet(&transport->RX, &message[i]);
+        message[length] = '\0';
+        RunCommandMessage(message, length, id);
+
+        // Start the reply on its way now rather than on the next pass
+        if (transport->Poll) transport->Poll();
+    }
+}
+
+// ======================= USB CDC ======================= //
+
+// stdio_usb's own background task services the USB stack, this just moves
+// bytes in and out of it. Only what the CDC FIFOs have room for is moved so
+// it never blocks, the USB interrupts wake the main loop to do the rest
+static void USBPoll(){
+    TransportType* usb = &Transports[TRANSPORT_USB];
+    char chunk[TRANSPORT_USB_CHUNK];
+    int length;
+
+    // Leave bytes with the host while the RX queue is full
+    while (QueueFree(&usb->RX) >= sizeof(chunk) && (length = stdio_usb.in_chars(chunk, sizeof(chunk))) > 0){
+        for (int i = 0; i < length; i++) TransportReceived(TRANSPORT_USB, chunk[i]);
+    }
+
+    // Nobody is listening, don't let replies pile up for whoever plugs in next
+    if (!stdio_usb_connected()){
+        TransportDiscardTX(TRANSPORT_USB);
+        return;
+    }
+    uint32_t room = tud_cdc_write_available();
+    while (room > 0 && QueueUsed(&usb->TX) > 0){
+        length = 0;
+        while (length < sizeof(chunk) && length < room && QueueGet(&usb->TX, (uint8_t*) &chunk[length])) length++;
+        stdio_usb.out_chars(chunk, length);
+        room -= length;
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "pico/stdlib.h"
+#include "TimerWheel.h"
+
+// Every link commands can come in on. Replies always go back out the link the message came from
+typedef enum TransportIdEnum {
+    TRANSPORT_BT,           // HC05 on uart1, interrupt driven
+    TRANSPORT_USB,          // USB CDC from stdio_init_all(), polled from the main loop
+    NUMBER_OF_TRANSPORTS
+} TransportIdType;
+
+// Defines
+#define TRANSPORT_RX_SIZE           1024        // Must be powers of two
+#define TRANSPORT_BT_TX_SIZE        2048        // Holds a whole CMD_RESPONSE_SIZE response
+#define TRANSPORT_USB_TX_SIZE       4096
+#define TRANSPORT_MESSAGE_SIZE      512         // Max bytes in one message, longer ones are split
+#define TRANSPORT_MESSAGE_GAP_US    20000       // A message ends once the link has been quiet this long
+#define TRANSPORT_STALL_US          500000      // Give up on a bulk response once the link stops taking bytes for this long
+#define TRANSPORT_USB_CHUNK         64          // Bytes moved to or from the CDC endpoint at a time
+#define TRANSPORT_USB_BYTES_PER_S   1216000     // Full speed bulk tops out at 19 64 byte packets per 1ms frame
+
+// Types
+// Single producer, single consumer byte ring. One side runs in an ISR and
+// the other in the main loop, so neither needs interrupts masked
+typedef struct ByteQueueStruct {
+    uint8_t*            Data;
+    uint16_t            Mask;               // Size - 1
+    volatile uint16_t   Head;               // Next byte written
+    volatile uint16_t   Tail;               // Next byte read
+} ByteQueueType;
+
+typedef struct TransportStruct {
+    char*               Name;
+    void                (*Poll)(void);      // Moves bytes between the hardware and the queues, NULL if interrupts do it
+    void                (*Kick)(void);      // Gets the hardware sending what's queued, NULL if Poll does it
+    bool                Bulk;               // Fast enough to stream responses longer than CMD_RESPONSE_SIZE
+    uint32_t            Max_Bytes_Per_S;    // What the link could carry at best, for judging throughput
+    ByteQueueType       RX;
+    ByteQueueType       TX;
+    volatile bool       Enabled;
+    TimerType           Gap_Timer;          // Wakes the main loop once a message has gone quiet
+    volatile uint32_t   Last_RX_US;
+    volatile uint64_t   First_RX_US;        // time_us_64() the message coming in now started
+    uint64_t            Message_RX_US;      // and the one being run did, for SyncTime
+    uint32_t            RX_Dropped;         // Bytes that came in with the RX queue full
+    bool                (*Stream)(TransportIdType id);  // Queues the next piece of a long reply, false once it's all queued
+    uint32_t            Stream_Progress_US; // Last time the link took any of the streamed reply
+    uint16_t            Stream_Tail;
+} TransportType;
+
+// Globals
+extern TransportType Transports[NUMBER_OF_TRANSPORTS];
+
+// Function Prototypes
+void EnableCommands();
+void TransportReceived(TransportIdType id, uint8_t byte);
+size_t TransportSend(TransportIdType id, const char* str);
+bool TransportSendAll(TransportIdType id, const char* str);
+void TransportDiscardTX(TransportIdType id);
+void TransportStartStream(TransportIdType id, bool (*stream)(TransportIdType id));
+void ServiceTransports();
+
+// Run by the command engine in CommandList.h
+void RunCommandMessage(uint8_t* msg, size_t len, TransportIdType transport);
+
+// ======================= Byte Queues ======================= //
+
+static inline uint16_t QueueUsed(const ByteQueueType* queue){
+    return (uint16_t) (queue->Head - queue->Tail) & queue->Mask;
+}
+
+// One slot is always left empty so a full queue can be told from an empty one
+static inline uint16_t QueueFree(const ByteQueueType* queue){
+    return queue->Mask - QueueUsed(queue);
+}
+
+static inline bool QueuePut(ByteQueueType* queue, uint8_t byte){
+    uint16_t head = queue->Head;
+    if (((head + 1) & queue->Mask) == queue->Tail) return false;
+    queue->Data[head] = byte;
+    queue->Head = (head + 1) & queue->Mask;
+    return true;
+}
+
+// Look at the byte offset bytes past the next one without taking anything
+static inline uint8_t QueuePeek(const ByteQueueType* queue, uint16_t offset){
+    return queue->Data[(queue->Tail + offset) & queue->Mask];
+}
+
+static inline bool QueueGet(ByteQueueType* queue, uint8_t* byte){
+    uint16_t tail = queue->Tail;
+    if (tail == queue->Head) return false;
+    *byte = queue->Data[tail];
+    queue->Tail = (tail + 1) & queue->Mask;
+    return true;
+}
+
+#endif
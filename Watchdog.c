@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stddef.h>
+#include "pico/stdlib.h"
+#include "hardware/watchdog.h"
+#include "hardware/rtc.h"
+#include "pico/util/datetime.h"
+#include "Watchdog.h"
+#include "TimerWheel.h"
+#include "Timebase.h"
+#include "HC05.h"
+
+// Externs
+extern void Enter_Alarm_Window(void);
+extern void Exit_Alarm_Window(void);
+extern void ScheduleAlarmWindow(void);
+extern bool TimeCompare(datetime_t t1, datetime_t t2);
+
+// Globals
+static RetainedStateType __uninitialized_ram(Retained_State);
+volatile bool Retained_State_Dirty = false;
+bool Warm_Boot = false;
+static bool Resume_In_Window = false;               // The window was open when we went down
+uint32_t Last_Save_US = 0;
+TimerType WatchdogWakeTimer;
+
+// FNV-1a over everything in the retained state except the checksum itself
+uint32_t RetainedChecksum(const RetainedStateType* state){
+    const uint8_t* bytes = (const uint8_t*) state;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(RetainedStateType, Checksum); i++){
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool AlarmSetQ(const datetime_t* t){
+    return t->year != 0 || t->month != 0 || t->day != 0 || t->hour != 0 || t->min != 0 || t->sec != 0;
+}
+
+// Does nothing, just wakes the main loop out of __wfi() so it can feed the watchdog
+void WatchdogWakeCallback(TimerType* timer){
+}
+
+void InitializeWatchdog(){
+    // Pause on debug so stepping through code doesn't reset the chip
+    watchdog_enable(WATCHDOG_TIMEOUT_MS, true);
+    StartTimerMs(&WatchdogWakeTimer, WATCHDOG_WAKE_MS, WATCHDOG_WAKE_MS, &WatchdogWakeCallback, NULL);
+}
+
+// Called from the main loop every time around. Feeds the watchdog and 
+// mirrors the alarm state into retained RAM when it changed or is getting old
+void FeedWatchdog(){
+    watchdog_update();
+    if (Retained_State_Dirty || (time_us_32() - Last_Save_US) > RETAINED_SAVE_INTERVAL_US){
+        SaveRetainedState();
+    }
+}
+
+// Copy the alarm state and the current time into retained RAM.
+// Only ever called from the main loop so there is a single writer
+void SaveRetainedState(){
+    Retained_State_Dirty = false;
+    Last_Save_US = time_us_32();
+
+    Retained_State.Magic = RETAINED_STATE_MAGIC;
+    ReadAlarmState(&Retained_State.Alarm_State);
+    Retained_State.Rules = Rule_Set;
+    rtc_get_datetime(&Retained_State.Last_Time);
+    Retained_State.Clock_Drift_PPB = Timebase.Drift_PPB;
+    Retained_State.BT_Idle_Off_MS = BT_Idle_Off_MS;
+    Retained_State.Checksum = RetainedChecksum(&Retained_State);
+}
+
+// Check retained RAM for the state of a previous run and, if it is intact,
+// put the clock, thresholds and wake rules back the way they were. The
+// window itself waits for ResumeAlarmWindow(). Must run after rtc_init().
+// Returns true on a warm boot
+bool RestoreRetainedState(){
+    // A cold boot leaves random data here, so insist on the magic and checksum
+    if (Retained_State.Magic != RETAINED_STATE_MAGIC || Retained_State.Checksum != RetainedChecksum(&Retained_State)){
+        Warm_Boot = false;
+        return false;
+    }
+    Warm_Boot = true;
+
+    // Bring back the thresholds and window, but leave the window 
+    // closed until we've checked it against the clock
+    AlarmStateType state = Retained_State.Alarm_State;
+    Resume_In_Window = state.In_Alarm_Window;
+    state.In_Alarm_Window = false;
+    SetAlarmState(&state);
+    Rule_Set = Retained_State.Rules;
+
+    // Put the clock back to the last time we saw, this lags by at most the
+    // watchdog timeout plus the time it took to reboot
+    datetime_t now = Retained_State.Last_Time;
+    SetTimebase(&now);
+    Timebase.Drift_PPB = Retained_State.Clock_Drift_PPB;
+    BT_Idle_Off_MS = Retained_State.BT_Idle_Off_MS;
+    // and give the clock time to update
+    busy_wait_us(64);
+
+    Retained_State_Dirty = true;
+    return true;
+}
+
+// Boot step, once everything opening a window starts up (the clock speed,
+// the sensing loop, the latency probe) is ready for it. Opens the window if
+// we were in it or it opened while we were down, closes it if it has closed
+// since, otherwise sets the timer for it. Nothing to do on a cold boot
+void ResumeAlarmWindow(){
+    if (!Warm_Boot) return;
+    AlarmStateType state;
+    ReadAlarmState(&state);
+    datetime_t now;
+    rtc_get_datetime(&now);
+
+    if (Resume_In_Window || (AlarmSetQ(&state.Alarm_Window_Start) && !TimeCompare(now, state.Alarm_Window_Start))){
+        // We were in the window, or it opened while we were down
+        if (TimeCompare(now, state.Alarm_Window_Stop)){
+            Enter_Alarm_Window();
+        }else{
+            // The window closed while we were down
+            Exit_Alarm_Window();
+        }
+    }else if (AlarmSetQ(&state.Alarm_Window_Start)){
+        // Still waiting for the window to open
+        ScheduleAlarmWindow();
+    }
+}
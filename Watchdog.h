@@ -0,0 +1,39 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include "pico/stdlib.h"
+#include "pico/util/datetime.h"
+#include "AlarmState.h"
+#include "Rules.h"
+
+// Defines
+#define WATCHDOG_TIMEOUT_MS         2000        // Reboot if the main loop stalls this long
+#define WATCHDOG_WAKE_MS            250         // Wake the main loop at least this often to feed the watchdog
+#define RETAINED_SAVE_INTERVAL_US   100000      // Mirror the alarm state at least every 100ms
+#define RETAINED_STATE_MAGIC        0x534E5A36  // "SNZ6", change whenever this, AlarmStateType or RuleSetType changes
+
+// Types
+// Everything needed to pick an alarm window back up after a reset.
+// Lives in RAM that the runtime does not clear at boot
+typedef struct RetainedStateStruct {
+    uint32_t        Magic;
+    AlarmStateType  Alarm_State;
+    RuleSetType     Rules;          // Compiled wake rules
+    datetime_t      Last_Time;      // The RTC is reset along with the chip so keep the last time we saw
+    int32_t         Clock_Drift_PPB;// What SyncTime has learned of the crystal
+    uint32_t        BT_Idle_Off_MS; // What BTIdle was set to
+    uint32_t        Checksum;
+} RetainedStateType;
+
+// Globals
+extern volatile bool Retained_State_Dirty;
+extern bool Warm_Boot;
+
+// Function Prototypes
+void InitializeWatchdog();
+void FeedWatchdog();
+void SaveRetainedState();
+bool RestoreRetainedState();
+void ResumeAlarmWindow();
+
+#endif
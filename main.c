@@ -8,56 +8,76 @@
 #include "hardware/uart.h"
 #include "HC05.h"
 #include "PressureSensor.h"
+#include "Sensors.h"
+#include "Boot.h"
+#include "Watchdog.h"
+#include "AlarmState.h"
+#include "Power.h"
+#include "Calibration.h"
+#include "Trace.h"
+#include "Transport.h"
+#include "FwUpdate.h"
+#include "Rules.h"
+#include "Nights.h"
+#include "HotPath.h"
 
-// Define externs
-uint8_t Scale_Sensitivity = 50;
-bool In_Alarm_Window = false;
-datetime_t Alarm_Window_Start = {
-    .year  = 0,
-    .month = 0,
-    .day   = 0,
-    .dotw  = 0,
-    .hour  = 0,
-    .min   = 0,
-    .sec   = 0
-};
-datetime_t Alarm_Window_Stop = {
-    .year  = 0,
-    .month = 0,
-    .day   = 0,
-    .dotw  = 0,
-    .hour  = 0,
-    .min   = 0,
-    .sec   = 0
-};
+int HOT_PATH_FUNC(main)(){
 
-int main(){
-
-    //Enable Printing
-    stdio_init_all();
-
-    //Initialize Hardware
-    InitializeBuzzer();
-    rtc_init(); // Real time clock
-    InitializeBluetooth();
-    InitializeADC();
+    //Initialize Hardware, anything slow (like the HC05 power up)
+    //finishes in the background while we start sensing
+    StartBoot();
 
     int32_t CurrentWeight;
+    AlarmStateType state;
 
     // Inf loop
     while (1){
-        if(!In_Alarm_Window){
-            // Shut up 
+        // The housekeeping up to TraceStep() runs from flash, see HotPath.h
+        // Finish any boot steps that were waiting on hardware, 
+        // then let the HC05 power policy run
+        if (PollBoot()){
+            BluetoothDutyCycle();
+        }
+        // Run whatever commands came in over Bluetooth or USB since the last pass
+        ServiceTransports();
+        // Let the watchdog know we're alive and mirror the alarm state
+        FeedWatchdog();
+
+        // Take a consistent snapshot of the shared alarm state for this pass
+        ReadAlarmState(&state);
+        // Record it (and the sensors) if a trace is running
+        TraceStep(&state);
+
+        if(!state.In_Alarm_Window){
+            // Shut up, and have the wake rules start timing afresh next window
             StopBeepingPIOBuzzer();
-            // Wait for interupts
-             __wfi();
+            ResetRuleTimers();
+            // Learn thresholds or the tare if asked to
+            CalibrationStep();
+            // Keep the load cell's weight current for WeighNow
+            ScaleStep(&state);
+            // Slow down and wait for interupts, unless a firmware update still has erasing to do
+            if (!FwUpdateStep()){
+                EnterLowPower();
+                PowerSleep();
+            }
         }else{
-            // Check if in bed and beep if in bed
-            if (IN_BED_Q){
-                StartBeepingPIOBuzzer();
-            }else{
-                StopBeepingPIOBuzzer();
+            // Make sure we're at full speed for the window
+            EnterFullPower();
+
+            // Check the wake rules (by default, beep if in bed) as 
+            // often as the adaptive sampling rate says to
+            if (SensorsDueQ()){
+                RuleActionType action = RunRules(&state);
+                NightOccupancy(Fused_Confidence >= OCCUPIED_CONFIDENCE);
+                if (action == RULE_QUIET){
+                    StopBeepingPIOBuzzer();
+                }else{
+                    StartBeepingPIOBuzzer();
+                    EscalatePIOBuzzer(action == RULE_ESCALATE);
+                }
             }
+            SensorsSleep();
 
         }
     }
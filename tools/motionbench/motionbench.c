@@ -0,0 +1,106 @@
+// Runs the firmware's breathing and movement kernel (Spectral.c, built for
+// the host) over made up beds and checks what it makes of each: an empty bed,
+// laundry settling, sleepers breathing slowly and quickly under sensor noise
+// and someone tossing and turning. Also reports how long an analysis takes on
+// this machine, the Motion command gives the cycles it takes on the M0+.
+//
+// Usage: motionbench [analyses]
+//
+// Exits with 1 if any bed is read wrong
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "pico/stdlib.h"
+#include "Spectral.h"
+#include "Sensors.h"
+
+// Defines
+#define DEFAULT_ANALYSES            100000
+#define PI                          3.14159265f
+
+// Types
+typedef struct BedStruct {
+    char*       Name;
+    float       Load;                   // Steady reading
+    float       Settle;                 // Reading still to come off as the bed settles, over ~10s
+    float       Breath_Hz;
+    float       Breath_Amplitude;
+    float       Noise;                  // Uniform, +/- this
+    float       Burst;                  // Movement, random steps of up to +/- this every sample for a few seconds
+    bool        Present;
+} BedType;
+
+// Globals
+static const BedType Beds[] = {
+    // Name             // Load     // Settle   // Breath Hz    // Amplitude    // Noise    // Burst    // Present
+    {"empty",           0,          0,          0,              0,              3,          0,          false},
+    {"laundry",         24000,      0,          0,              0,              3,          0,          false},
+    {"laundry settling",24000,      800,        0,              0,              3,          0,          false},
+    {"noisy empty",     2000,       0,          0,              0,              60,         0,          false},
+    {"sleeper 15/min",  30000,      0,          0.25f,          120,            10,         0,          true},
+    {"sleeper 7/min",   30000,      0,          0.12f,          120,            10,         0,          true},
+    {"sleeper 28/min",  30000,      0,          0.47f,          120,            10,         0,          true},
+    {"faint, settling", 30000,      500,        0.25f,          30,             5,          0,          true},
+    {"tossing",         30000,      0,          0.25f,          120,            10,         4000,       true}
+};
+static uint32_t Seed = 1;
+
+static float Random(){
+    Seed = Seed * 1664525 + 1013904223;
+    return (Seed >> 8) / 8388608.0f - 1.0f;
+}
+
+// A window of the stream core 1 would see for bed
+static void MakeWindow(const BedType* bed, uint32_t* window){
+    float hz = MOTION_SAMPLE_MHZ / 1000.0f;
+    float burst = 0;
+    for (uint16_t n = 0; n < MOTION_WINDOW; n++){
+        float t = n / hz;
+        float reading = bed->Load + bed->Settle * expf(-t / 10.0f) + bed->Breath_Amplitude * sinf(2 * PI * bed->Breath_Hz * t) + bed->Noise * Random();
+        if (n > MOTION_WINDOW / 2 && n < MOTION_WINDOW / 2 + 30) burst += bed->Burst * Random();
+        reading += burst;
+        window[n] = (reading < 0) ? 0 : (reading > ZONE_READING_MAX) ? ZONE_READING_MAX : reading;
+    }
+}
+
+static double Seconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv){
+    long analyses = (argc > 1) ? atol(argv[1]) : DEFAULT_ANALYSES;
+    if (analyses <= 0){
+        fprintf(stderr, "Usage: %s [analyses]\n", argv[0]);
+        return 2;
+    }
+    int status = 0;
+    uint32_t window[MOTION_WINDOW];
+    SpectrumType spectrum;
+
+    printf("bed,rms,drift_share,breath_share,per_minute,confidence,moving,present,expected\n");
+    for (size_t b = 0; b < sizeof(Beds) / sizeof(Beds[0]); b++){
+        MakeWindow(&Beds[b], window);
+        AnalyseWindow(window, 0, &spectrum);
+        uint8_t confidence = BreathingConfidence(&spectrum);
+        bool moving = MovingQ(&spectrum);
+        bool present = moving || confidence >= OCCUPIED_CONFIDENCE;
+        printf("%s,%.0f,%u,%u,%.1f,%u,%d,%d,%d\n", Beds[b].Name, sqrt(spectrum.Mean_Square), spectrum.Drift_Share, spectrum.Breath_Share,
+               spectrum.Peak_Bin * MOTION_SAMPLE_MHZ * 60.0 / MOTION_WINDOW / 1000, confidence, moving, present, Beds[b].Present);
+        if (present != Beds[b].Present){
+            fprintf(stderr, "%s read as %s\n", Beds[b].Name, present ? "someone there" : "nobody");
+            status = 1;
+        }
+    }
+
+    MakeWindow(&Beds[4], window);
+    double start = Seconds();
+    for (long i = 0; i < analyses; i++) AnalyseWindow(window, i % MOTION_WINDOW, &spectrum);
+    double elapsed = Seconds() - start;
+    printf("analyses,us_per_analysis,goertzel_steps\n");
+    printf("%ld,%.2f,%u\n", analyses, elapsed * 1e6 / analyses, (MOTION_LAST_BREATH_BIN - MOTION_FIRST_BREATH_BIN + 2) * MOTION_WINDOW);
+    return status;
+}
@@ -0,0 +1,6 @@
+#ifndef HOST_HARDWARE_ADC_H
+#define HOST_HARDWARE_ADC_H
+
+// Nothing needed, the firmware only uses this through replay.c
+
+#endif
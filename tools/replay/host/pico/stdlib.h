@@ -0,0 +1,19 @@
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+// Just enough of the Pico SDK for the firmware's occupancy logic to build
+// on a host. Anything that touches hardware is supplied by replay.c
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef unsigned int uint;
+
+#define tight_loop_contents()       ((void) 0)
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+
+#endif
@@ -0,0 +1,467 @@
+// Replays a trace recorded with the Trace and TraceDump commands through
+// the firmware's own occupancy logic (Sensors.c, built for the host) and
+// reports when the buzzer would have sounded. Any of the settings can be
+// swept, every combination is replayed over the whole trace.
+//
+// Usage: replay [-t threshold] [-s sensitivity] [-y hysteresis] [-f filter]
+//               [-m zone mask] [-r "action condition"]... [-v] trace.txt
+//
+// Each setting is a single value or LOW:HIGH[:STEP]. Settings that aren't
+// given come from the trace. -r adds a wake rule as WakeRule would, without
+// any the default "beep inbed" is used. -v lists every time the buzzer turns on or off
+// and the bed to buzzer latency histogram the Latency command keeps on the device.
+// Exits with 1 if any replay breaks the sensing latency bound
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "Sensors.h"
+#include "LoadCellADC.h"
+#include "Rules.h"
+#include "Motion.h"
+#include "Latency.h"
+#include "BuzzerTiming.h"
+
+// Defines
+#define SCALE_PERIOD_US             100000      // The HX711 has a new sample ready at 10 SPS
+#define TRACE_GAP_US                3600000000ull   // Time put between traces that were dumped back to back
+#define MAX_LINE                    256
+// StartBeepingPIOBuzzer's first toggle (which turns the buzzer on) comes a half period in
+#define BEEP_HALF_PERIOD_US         (BUZZER_PIO_BEEP_HALF_PERIOD * 1000ull)
+#define ESCALATED_HALF_PERIOD_US    (BUZZER_ESCALATED_HALF_PERIOD * 1000ull)
+
+// Types
+typedef struct EventStruct {
+    uint64_t    US;
+    char        Type;
+    int32_t     Values[9];
+} EventType;
+
+typedef struct SweepStruct {
+    bool        Given;
+    long        Low;
+    long        High;
+    long        Step;
+} SweepType;
+
+typedef struct ResultStruct {
+    uint32_t    Windows;
+    uint32_t    Windows_Beeped;
+    uint64_t    Beep_US;
+    uint64_t    First_Beep_US;          // Summed over the windows that beeped
+    uint32_t    Toggles;
+    LatencyStatsType Latency;
+} ResultType;
+
+// The PIO buzzer as Buzzer.c drives it, so the latency is to the buzzer
+// actually sounding and not just the rules saying it should
+typedef struct BeeperStruct {
+    bool        Beeping;                // PIO_Buzzing
+    bool        Escalated;
+    bool        On;                     // PIOBuzzerState
+    uint64_t    Next_Toggle_US;
+    uint64_t    Half_US;
+} BeeperType;
+
+// The Latency command's probe in ADC mode
+typedef struct ProbeStruct {
+    bool        Below;                  // Seen under the trip point this window
+    bool        Triggered;
+    bool        Timing;
+    uint64_t    Trigger_US;
+} ProbeType;
+
+// Globals
+static EventType* Events;
+static size_t Number_Of_Events = 0;
+static uint64_t Now_US;
+static uint64_t Next_Event_US;
+static uint16_t Current_Zones[NUMBER_OF_ZONES];
+static int32_t Current_Scale;
+static uint64_t Scale_Ready_US;
+static bool Verbose = false;
+static BeeperType Beeper;
+static ProbeType Probe;
+int32_t Scale_Zero_Offset = SCALE_LBS_OFFSET;
+
+// ======================= Hardware the firmware expects ======================= //
+
+uint64_t time_us_64(void){
+    return Now_US;
+}
+
+uint32_t time_us_32(void){
+    return (uint32_t) Now_US;
+}
+
+uint32_t save_and_disable_interrupts(void){
+    return 0;
+}
+
+void restore_interrupts(uint32_t status){
+}
+
+void InitializeScale(){
+}
+
+void ReadZones(uint16_t* zones){
+    memcpy(zones, Current_Zones, sizeof(Current_Zones));
+}
+
+// The trace holds the scale's value between samples, hand it out at the HX711's rate
+bool ScaleReadyQ(){
+    return Now_US >= Scale_Ready_US;
+}
+
+int32_t ReadScaleWeight(){
+    Scale_Ready_US = Now_US + SCALE_PERIOD_US;
+    return Current_Scale;
+}
+
+void PauseZoneSampling(){
+}
+
+void ResumeZoneSampling(){
+}
+
+// Traces don't hold the stream core 1 analyses, so the motion sensor never
+// has a result and human always holds, as it does for a window's first ~17s
+bool MotionCoreRunningQ(){
+    return false;
+}
+
+void ReadMotionStatus(MotionStatusType* status){
+    memset(status, 0, sizeof(MotionStatusType));
+}
+
+// Jump the clock forward, stopping early at the next trace event
+bool PowerSleepUntil(uint64_t wake_us){
+    if (Next_Event_US < wake_us){
+        Now_US = Next_Event_US;
+        return true;
+    }
+    Now_US = wake_us;
+    return false;
+}
+
+// ======================= Trace ======================= //
+
+static void LoadTrace(FILE* file){
+    char line[MAX_LINE];
+    size_t capacity = 1024;
+    uint64_t base_us = 1000000;     // Start a second in, the firmware's clock never reads 0 in a window
+    uint64_t last_us = base_us;
+    Events = malloc(capacity * sizeof(EventType));
+
+    while (fgets(line, sizeof(line), file)){
+        EventType event = {0};
+        unsigned long ms;
+        int offset;
+        if (sscanf(line, "%c %lu%n", &event.Type, &ms, &offset) < 2) continue;
+        if (!strchr("SWUHZC", event.Type)) continue;
+
+        // A new trace starts its clock again, so put it after the last one
+        if (event.Type == 'C' && Number_Of_Events > 0) base_us = last_us + TRACE_GAP_US;
+        event.US = base_us + ms * 1000ull;
+        last_us = event.US;
+
+        char* values = line + offset;
+        for (int i = 0; i < 9; i++){
+            char* end;
+            event.Values[i] = strtol(values, &end, 10);
+            if (end == values) break;
+            values = end;
+        }
+        if (Number_Of_Events == capacity){
+            capacity *= 2;
+            Events = realloc(Events, capacity * sizeof(EventType));
+        }
+        Events[Number_Of_Events++] = event;
+    }
+}
+
+// ======================= Replay ======================= //
+
+static void ParseSweep(const char* text, SweepType* sweep){
+    char* end;
+    sweep->Given = true;
+    sweep->Low = strtol(text, &end, 0);
+    sweep->High = (*end == ':') ? strtol(end + 1, &end, 0) : sweep->Low;
+    sweep->Step = (*end == ':') ? strtol(end + 1, &end, 0) : 1;
+    if (sweep->Step <= 0) sweep->Step = 1;
+}
+
+static void PrintTime(uint64_t us){
+    printf("%llu.%03llu s", (unsigned long long) (us / 1000000), (unsigned long long) ((us / 1000) % 1000));
+}
+
+static void SetBuzzer(bool on, bool* buzzer, uint64_t* on_since, ResultType* result){
+    if (on == *buzzer) return;
+    *buzzer = on;
+    result->Toggles++;
+    if (on) *on_since = Now_US;
+    else result->Beep_US += Now_US - *on_since;
+    if (Verbose){
+        printf("    buzzer %s at ", on ? "on " : "off");
+        PrintTime(Now_US);
+        printf("\n");
+    }
+}
+
+// ======================= Latency ======================= //
+
+// Run the beep timer up to until, timing any crossing to the toggle that turns the buzzer on
+static void AdvanceBeeper(uint64_t until, ResultType* result){
+    while (Beeper.Beeping && Beeper.Next_Toggle_US <= until){
+        Beeper.On = !Beeper.On;
+        if (Beeper.On && Probe.Timing){
+            Probe.Timing = false;
+            AddStatsSample(&result->Latency.Latency_US, Beeper.Next_Toggle_US - Probe.Trigger_US);
+        }
+        Beeper.Next_Toggle_US += Beeper.Half_US;
+    }
+}
+
+// StartBeepingPIOBuzzer, StopBeepingPIOBuzzer and EscalatePIOBuzzer
+static void EscalateBeeper(bool escalate){
+    if (escalate == Beeper.Escalated) return;
+    Beeper.Escalated = escalate;
+    if (Beeper.Beeping){
+        Beeper.Half_US = escalate ? ESCALATED_HALF_PERIOD_US : BEEP_HALF_PERIOD_US;
+        Beeper.Next_Toggle_US = Now_US + Beeper.Half_US;
+    }
+}
+
+static void StartBeeper(){
+    if (Beeper.Beeping) return;
+    Beeper.Beeping = true;
+    Beeper.Half_US = Beeper.Escalated ? ESCALATED_HALF_PERIOD_US : BEEP_HALF_PERIOD_US;
+    Beeper.Next_Toggle_US = Now_US + Beeper.Half_US;
+}
+
+static void StopBeeper(){
+    Beeper.Beeping = false;
+    Beeper.On = false;
+    EscalateBeeper(false);
+}
+
+// Same test LatencyCheckZones makes on every reading
+static void CheckProbe(const AlarmStateType* state, ResultType* result){
+    bool over = false, under = true;
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (!(state->Zone_Mask & ZONE_BIT(i))) continue;
+        uint32_t trip = (uint32_t) state->Scale_Sensitivity[i] * state->Threshold[i];
+        if (100 * (uint32_t) Current_Zones[i] >= trip) over = true;
+        if (100 * ((uint32_t) Current_Zones[i] + state->Hysteresis[i]) >= trip) under = false;
+    }
+    if (over && Probe.Below && !Probe.Triggered){
+        Probe.Triggered = true;
+        Probe.Timing = true;
+        Probe.Trigger_US = Now_US;
+        result->Latency.Crossings++;
+        // The probe sees the buzzer pin already high if it's mid beep
+        if (Beeper.On){
+            Probe.Timing = false;
+            AddStatsSample(&result->Latency.Latency_US, 0);
+        }
+    }else if (under){
+        if (Probe.Triggered && Probe.Timing) result->Latency.Abandoned++;
+        Probe.Triggered = false;
+        Probe.Timing = false;
+        Probe.Below = true;
+    }
+}
+
+// The histogram as the Latency command sends it
+static void PrintLatency(const LatencyStatsType* latency){
+    const RunningStatsType* stats = &latency->Latency_US;
+    printf("  latency: %u samples mean %d sd %d min %d max %d, %u crossings, %u abandoned\n    ", stats->Count, (int32_t) stats->Mean,
+           (int32_t) StatsDeviation(stats), stats->Count ? stats->Min : 0, stats->Count ? stats->Max : 0, latency->Crossings, latency->Abandoned);
+    for (uint8_t i = 0; i < STATS_BUCKETS; i++) printf("%u ", stats->Histogram[i]);
+    printf("(%lu us buckets)\n", 1ul << LATENCY_LOG2_BUCKET_US);
+}
+
+// The settings given on the command line win over the ones in the trace
+static void Override(AlarmStateType* state, const long* settings){
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        if (settings[0] >= 0) state->Threshold[i] = settings[0];
+        if (settings[1] >= 0) state->Scale_Sensitivity[i] = settings[1];
+        if (settings[2] >= 0) state->Hysteresis[i] = settings[2];
+    }
+    if (settings[4] >= 0) state->Zone_Mask = settings[4];
+}
+
+// Run every event through the same steps main.c takes inside a window
+static ResultType Replay(const long* settings){
+    ResultType result = {0};
+    AlarmStateType state = {.Zone_Mask = ZONES_ANY};
+    bool buzzer = false;
+    uint64_t on_since = 0;
+    uint64_t window_open_us = 0;
+    bool window_beeped = false;
+
+    InitializeSensors();
+    ResetRuleTimers();
+    ResetStats(&result.Latency.Latency_US, 0, LATENCY_LOG2_BUCKET_US);
+    memset(&Beeper, 0, sizeof(Beeper));
+    memset(&Probe, 0, sizeof(Probe));
+    Margin_Filter_Log2 = (settings[3] >= 0) ? settings[3] : LOG2_MARGIN_FILTER;
+    Scale_Zero_Offset = SCALE_LBS_OFFSET;
+    Scale_Ready_US = 0;
+    memset(Current_Zones, 0, sizeof(Current_Zones));
+    for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+        state.Threshold[i] = INITIAL_THRESHOLD;
+        state.Scale_Sensitivity[i] = INITIAL_SENSITIVITY;
+    }
+    Override(&state, settings);
+    Now_US = (Number_Of_Events > 0) ? Events[0].US : 0;
+
+    for (size_t e = 0; e <= Number_Of_Events; e++){
+        // Run the window loop up to the next event
+        Next_Event_US = (e < Number_Of_Events) ? Events[e].US : Now_US;
+        while (state.In_Alarm_Window && Now_US < Next_Event_US){
+            AdvanceBeeper(Now_US, &result);
+            if (SensorsDueQ()){
+                RuleActionType action = RunRules(&state);
+                SetBuzzer(action != RULE_QUIET, &buzzer, &on_since, &result);
+                if (action == RULE_QUIET){
+                    StopBeeper();
+                }else{
+                    StartBeeper();
+                    EscalateBeeper(action == RULE_ESCALATE);
+                }
+                if (buzzer && !window_beeped){
+                    window_beeped = true;
+                    result.Windows_Beeped++;
+                    result.First_Beep_US += Now_US - window_open_us;
+                }
+            }
+            SensorsSleep();
+        }
+        if (e == Number_Of_Events) break;
+        AdvanceBeeper(Next_Event_US, &result);
+        Now_US = Next_Event_US;
+
+        const EventType* event = &Events[e];
+        switch (event->Type){
+            case 'S':
+                for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++) Current_Zones[i] = event->Values[i];
+                Current_Scale = event->Values[4];
+                if (state.In_Alarm_Window) CheckProbe(&state, &result);
+                break;
+            case 'W':
+                if (event->Values[0] && !state.In_Alarm_Window){
+                    result.Windows++;
+                    window_open_us = Now_US;
+                    window_beeped = false;
+                    SensorsWindowOpened();
+                    if (Verbose){
+                        printf("  window opened at ");
+                        PrintTime(Now_US);
+                        printf("\n");
+                    }
+                }
+                state.In_Alarm_Window = event->Values[0];
+                // Both ends of the window start the probe afresh, see LatencyWindow
+                if (Probe.Timing && !state.In_Alarm_Window) result.Latency.Abandoned++;
+                memset(&Probe, 0, sizeof(Probe));
+                if (!state.In_Alarm_Window){
+                    SetBuzzer(false, &buzzer, &on_since, &result);
+                    StopBeeper();
+                    ResetRuleTimers();
+                }
+                break;
+            case 'U':
+                for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++){
+                    state.Threshold[i] = event->Values[i];
+                    state.Scale_Sensitivity[i] = event->Values[NUMBER_OF_ZONES + i];
+                }
+                Override(&state, settings);
+                break;
+            case 'H':
+                for (uint8_t i = 0; i < NUMBER_OF_ZONES; i++) state.Hysteresis[i] = event->Values[i];
+                state.Zone_Mask = event->Values[NUMBER_OF_ZONES];
+                Override(&state, settings);
+                break;
+            case 'Z':
+                Scale_Zero_Offset = event->Values[0];
+                break;
+        }
+    }
+    SetBuzzer(false, &buzzer, &on_since, &result);
+    return result;
+}
+
+int main(int argc, char** argv){
+    // Threshold, sensitivity, hysteresis, filter, zone mask
+    SweepType sweeps[5] = {0};
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++){
+        const char* option = strchr("tsyfm", argv[i][1]);
+        if (argv[i][0] == '-' && argv[i][1] == 'v'){
+            Verbose = true;
+        }else if (argv[i][0] == '-' && argv[i][1] == 'r' && i + 1 < argc){
+            const char* rule = argv[++i];
+            const char* error = "Action has to be beep or escalate";
+            for (uint8_t a = RULE_BEEP; a < NUMBER_OF_RULE_ACTIONS; a++){
+                size_t length = strlen(RuleActionNames[a]);
+                if (strncmp(rule, RuleActionNames[a], length) == 0 && rule[length] == ' ') error = AddRule(rule + length + 1, a);
+            }
+            if (error){
+                fprintf(stderr, "%s: %s\n", rule, error);
+                return 2;
+            }
+        }else if (argv[i][0] == '-' && argv[i][1] && option && i + 1 < argc){
+            ParseSweep(argv[++i], &sweeps[option - "tsyfm"]);
+        }else if (argv[i][0] != '-'){
+            path = argv[i];
+        }else{
+            path = NULL;
+            break;
+        }
+    }
+    if (!path){
+        fprintf(stderr, "Usage: %s [-t threshold] [-s sensitivity] [-y hysteresis] [-f filter] [-m zone mask] [-r \"action condition\"]... [-v] trace.txt\n"
+                        "Each setting is a value or LOW:HIGH[:STEP]\n", argv[0]);
+        return 2;
+    }
+    FILE* file = fopen(path, "r");
+    if (!file){
+        perror(path);
+        return 2;
+    }
+    LoadTrace(file);
+    fclose(file);
+
+    // Settings that weren't swept are -1 and come from the trace
+    for (uint8_t i = 0; i < 5; i++){
+        if (!sweeps[i].Given) sweeps[i] = (SweepType) {false, -1, -1, 1};
+    }
+    printf("threshold,sensitivity,hysteresis,filter,mask,windows,windows_beeped,beep_s,mean_first_beep_s,toggles,worst_gap_us,latency_samples,latency_mean_ms,latency_max_ms\n");
+    int status = 0;
+    long settings[5];
+    for (settings[0] = sweeps[0].Low; settings[0] <= sweeps[0].High; settings[0] += sweeps[0].Step)
+    for (settings[1] = sweeps[1].Low; settings[1] <= sweeps[1].High; settings[1] += sweeps[1].Step)
+    for (settings[2] = sweeps[2].Low; settings[2] <= sweeps[2].High; settings[2] += sweeps[2].Step)
+    for (settings[3] = sweeps[3].Low; settings[3] <= sweeps[3].High; settings[3] += sweeps[3].Step)
+    for (settings[4] = sweeps[4].Low; settings[4] <= sweeps[4].High; settings[4] += sweeps[4].Step){
+        ResultType result = Replay(settings);
+        for (uint8_t i = 0; i < 5; i++){
+            if (settings[i] >= 0) printf("%ld,", settings[i]);
+            else printf("trace,");
+        }
+        const RunningStatsType* latency = &result.Latency.Latency_US;
+        printf("%u,%u,%.3f,%.3f,%u,%u,%u,%.1f,%.1f\n", result.Windows, result.Windows_Beeped, result.Beep_US / 1e6,
+               result.Windows_Beeped ? result.First_Beep_US / 1e6 / result.Windows_Beeped : 0.0, result.Toggles, Worst_Sample_Gap_US,
+               latency->Count, latency->Mean / 1e3, latency->Count ? latency->Max / 1e3 : 0.0);
+        if (Verbose) PrintLatency(&result.Latency);
+        // Same check SensStat makes on the device
+        if (Worst_Sample_Gap_US > SAMPLE_INTERVAL_MAX_US + SAMPLE_INTERVAL_MIN_US){
+            fprintf(stderr, "A pass came %u us after the last one, breaking the %lu us latency bound\n", Worst_Sample_Gap_US, (unsigned long) SENSE_WORST_LATENCY_US);
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,94 @@
+// Measures what running the wake rules costs per sensing pass. Fills every
+// rule slot with the longest condition the compiler takes, runs the set over
+// a stream of changing readings and reports the time per pass on this
+// machine along with the ops each pass took against RULE_MAX_OPS, the bound
+// the firmware budgets for.
+//
+// Usage: rulebench [passes] ["action condition"]...
+//
+// Rules given on the command line are compiled and measured instead.
+// Exits with 1 if a rule doesn't compile or a pass goes over RULE_MAX_OPS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pico/stdlib.h"
+#include "Rules.h"
+
+// Defines
+#define DEFAULT_PASSES              10000000
+#define PASS_INTERVAL_US            100000      // Readings come at least this often in the window
+
+// Globals
+// Every op that takes arguments, two for clauses and both joins, RULE_CODE_SIZE - 1 bytes in all
+static const char* Worst_Rule = "escalate (weight > 150 for 20 and zone any for 5) or confidence > 100 and inbed or after 300";
+
+// Only here so Rules.c links, the evaluator is handed the time
+uint64_t time_us_64(void){
+    return 0;
+}
+
+uint32_t time_us_32(void){
+    return 0;
+}
+
+static bool AddRuleText(const char* text){
+    const char* error = "Action has to be beep or escalate";
+    for (uint8_t a = RULE_BEEP; a < NUMBER_OF_RULE_ACTIONS; a++){
+        size_t length = strlen(RuleActionNames[a]);
+        if (strncmp(text, RuleActionNames[a], length) == 0 && text[length] == ' ') error = AddRule(text + length + 1, a);
+    }
+    if (error) fprintf(stderr, "%s: %s\n", text, error);
+    return error == NULL;
+}
+
+static double Seconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv){
+    long passes = (argc > 1) ? atol(argv[1]) : DEFAULT_PASSES;
+    if (passes <= 0){
+        fprintf(stderr, "Usage: %s [passes] [\"action condition\"]...\n", argv[0]);
+        return 2;
+    }
+    for (int i = 2; i < argc; i++){
+        if (!AddRuleText(argv[i])) return 1;
+    }
+    if (argc <= 2){
+        for (uint8_t i = 0; i < MAX_RULES; i++){
+            if (!AddRuleText(Worst_Rule)) return 1;
+        }
+    }
+
+    // Readings that wander so every branch and for clause gets taken
+    RuleInputType input = {.Now_US = 1};
+    uint32_t seed = 1;
+    uint32_t actions[NUMBER_OF_RULE_ACTIONS] = {0};
+    uint64_t total_ops = 0;
+    ResetRuleTimers();
+    double start = Seconds();
+    for (long pass = 0; pass < passes; pass++){
+        seed = seed * 1664525 + 1013904223;
+        input.Confidence = seed >> 24;
+        input.Zones_Occupied = (seed >> 16) & ZONES_FITTED;
+        input.Weight_Lbs = (seed & 0x100) ? INT32_MAX : (seed >> 4) % 300;
+        input.Human = seed & 0x200;
+        input.Now_US += PASS_INTERVAL_US;
+        actions[EvaluateRules(&input)]++;
+        total_ops += Rule_Ops_Run;
+    }
+    double elapsed = Seconds() - start;
+
+    printf("rules,passes,ns_per_pass,mean_ops,worst_ops,max_ops,quiet,beep,escalate\n");
+    printf("%u,%ld,%.1f,%.1f,%u,%u,%u,%u,%u\n", Rule_Set.Count, passes, elapsed * 1e9 / passes, (double) total_ops / passes,
+           Rule_Worst_Ops, RULE_MAX_OPS, actions[RULE_QUIET], actions[RULE_BEEP], actions[RULE_ESCALATE]);
+    if (Rule_Worst_Ops > RULE_MAX_OPS){
+        fprintf(stderr, "A pass took %u ops, over the %u the firmware budgets for\n", Rule_Worst_Ops, RULE_MAX_OPS);
+        return 1;
+    }
+    return 0;
+}
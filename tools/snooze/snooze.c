@@ -0,0 +1,473 @@
+// Drives the alarm clock from a Linux PC over any tty its commands come in
+// on: the HC05 through rfcomm, USB CDC, or a pty. Commands are sent framed
+// (a message starting with '#') so every response ends with #END and can be
+// picked apart per command, and up to SNOOZE_MAX_COMMANDS go in each message.
+//
+// Usage: snooze [-p port] [-b baud] [-t timeout ms] [-v] <action> ...
+//
+//   send <command>...              Runs the commands in one round trip and prints their output
+//   clock [when]                   Sets the clock, to now if when is left off
+//   alarm <start> <end|+duration>  Sets the alarm window
+//   trace <file>                   Saves the whole trace for tools/replay
+//   bench [-n messages] [-d depth] [command]...
+//                                  Sends the commands over and over, depth to a message, and
+//                                  reports each one's round trip latency percentiles. With no
+//                                  commands, times empty messages to find the link's floor
+//   sync [-n exchanges]            Corrects the clock to this PC's with a burst of SyncTime
+//                                  exchanges. Run it again 10 min or more later to correct
+//                                  the clock's drift too
+//
+// Times are YYYY-MM-DD HH:MM[:SS], HH:MM[:SS] (the next time it comes round)
+// or now, durations +N followed by s, m or h. The port defaults to
+// $SNOOZE_PORT, then /dev/rfcomm0. -v shows each command's status line.
+// Exits with 1 if any command doesn't come back OK
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Defines
+#define SNOOZE_MAX_COMMANDS         8           // CMD_QUEUE_DEPTH
+#define SNOOZE_MAX_MESSAGE          512         // TRANSPORT_MESSAGE_SIZE
+#define SNOOZE_RESPONSE_SIZE        65536       // Bigger than any framed response, those are capped at CMD_RESPONSE_SIZE
+#define SNOOZE_DEFAULT_TIMEOUT_MS   3000
+#define SNOOZE_DEFAULT_BENCH        100
+#define SNOOZE_DEFAULT_SYNC         8
+#define SNOOZE_DEFAULT_PORT         "/dev/rfcomm0"
+#define MAX_BENCH_COMMANDS          32
+
+// Types
+// One command's part of a framed response
+typedef struct ReplyStruct {
+    char*       Name;
+    int         Status;
+    char*       Body;                   // Points into the response, '\0' terminated
+} ReplyType;
+
+// Latencies of every run of one command
+typedef struct TimingStruct {
+    const char* Command;
+    double*     MS;
+    size_t      Count;
+} TimingType;
+
+// Globals
+static int Port = -1;
+static int Timeout_MS = SNOOZE_DEFAULT_TIMEOUT_MS;
+static bool Verbose = false;
+static char Response[SNOOZE_RESPONSE_SIZE];
+static int64_t Replied_Wall_US;         // Local time the last response started coming back
+
+// ======================= Link ======================= //
+
+static speed_t BaudConstant(long baud){
+    switch (baud){
+        case 9600:      return B9600;
+        case 19200:     return B19200;
+        case 38400:     return B38400;
+        case 57600:     return B57600;
+        case 115200:    return B115200;
+        default:        return 0;
+    }
+}
+
+// Raw mode, so nothing is echoed or translated on the way. The baud rate only
+// matters for a real UART, rfcomm, USB CDC and ptys ignore it
+static bool OpenPort(const char* path, long baud){
+    Port = open(path, O_RDWR | O_NOCTTY);
+    if (Port < 0){
+        perror(path);
+        return false;
+    }
+    struct termios tty;
+    if (tcgetattr(Port, &tty) == 0){
+        cfmakeraw(&tty);
+        cfsetspeed(&tty, BaudConstant(baud));
+        tty.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(Port, TCSANOW, &tty);
+        tcflush(Port, TCIOFLUSH);
+    }
+    return true;
+}
+
+static double Milliseconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+// us since 1970 in the local time zone, the clock's own time zone once SetClock has been run from here
+static int64_t WallUs(void){
+    struct timespec now;
+    struct tm tm;
+    clock_gettime(CLOCK_REALTIME, &now);
+    localtime_r(&now.tv_sec, &tm);
+    return (now.tv_sec + tm.tm_gmtoff) * 1000000ll + now.tv_nsec / 1000;
+}
+
+// True once the response holds a whole "#END <count>" line
+static bool ResponseEndedQ(const char* response, size_t length){
+    if (length == 0 || response[length - 1] != '\n') return false;
+    const char* line = response + length - 1;
+    while (line > response && line[-1] != '\n') line--;
+    return strncmp(line, "#END ", 5) == 0;
+}
+
+// Send the commands as one framed message and wait for the whole response.
+// Returns the round trip in ms, or a negative number if it timed out
+static double Exchange(const char** commands, size_t count){
+    char message[SNOOZE_MAX_MESSAGE + 1] = "#";
+    for (size_t i = 0; i < count; i++){
+        strncat(message, commands[i], SNOOZE_MAX_MESSAGE - strlen(message));
+        strncat(message, "\n", SNOOZE_MAX_MESSAGE - strlen(message));
+    }
+
+    double start = Milliseconds();
+    size_t length = strlen(message), sent = 0;
+    while (sent < length){
+        ssize_t written = write(Port, message + sent, length - sent);
+        if (written < 0 && errno != EINTR) return -1;
+        if (written > 0) sent += written;
+    }
+
+    size_t received = 0;
+    while (!ResponseEndedQ(Response, received)){
+        int left = Timeout_MS - (int) (Milliseconds() - start);
+        struct pollfd poller = {Port, POLLIN, 0};
+        if (left <= 0 || poll(&poller, 1, left) <= 0) return -1;
+        ssize_t got = read(Port, Response + received, sizeof(Response) - 1 - received);
+        if (got < 0 && errno != EINTR) return -1;
+        if (got > 0 && received == 0) Replied_Wall_US = WallUs();
+        if (got > 0) received += got;
+        Response[received] = '\0';
+        if (received >= sizeof(Response) - 1) return -1;
+    }
+    return Milliseconds() - start;
+}
+
+// Split the last response into per command replies, returns how many there were
+static size_t ParseResponse(ReplyType* replies, size_t size){
+    char* ends[SNOOZE_MAX_COMMANDS];
+    size_t count = 0;
+    char* line = Response;
+    while (*line){
+        char* next = strchr(line, '\n');
+        next = next ? next + 1 : line + strlen(line);
+        // Headers are "#<index> <name> <status code> <status>", body lines can start with '#' too
+        int index, status;
+        char name[32];
+        bool header = line[0] == '#' && line[1] >= '0' && line[1] <= '9' && sscanf(line, "#%d %31s %d", &index, name, &status) == 3;
+        bool end = strncmp(line, "#END ", 5) == 0;
+        // Each body runs up to the next header or the #END
+        if ((header || end) && count > 0) ends[count - 1] = line;
+        if (end) break;
+        if (header && count < size){
+            replies[count].Name = strdup(name);
+            replies[count].Status = status;
+            replies[count].Body = next;
+            ends[count++] = next;
+        }
+        line = next;
+    }
+    for (size_t i = 0; i < count; i++) *ends[i] = '\0';
+    return count;
+}
+
+// Print every reply, with its status line if asked. Returns the number that weren't OK
+static int PrintReplies(ReplyType* replies, size_t count){
+    int failed = 0;
+    for (size_t i = 0; i < count; i++){
+        if (Verbose) printf("[%s: %d]\n", replies[i].Name, replies[i].Status);
+        fputs(replies[i].Body, stdout);
+        if (replies[i].Status != 0){
+            fprintf(stderr, "%s failed with status %d\n", replies[i].Name, replies[i].Status);
+            failed++;
+        }
+        free(replies[i].Name);
+    }
+    return failed;
+}
+
+// Run the commands, SNOOZE_MAX_COMMANDS to a message, and print their output
+static int Send(const char** commands, size_t count){
+    ReplyType replies[SNOOZE_MAX_COMMANDS];
+    int failed = 0;
+    for (size_t i = 0; i < count; i += SNOOZE_MAX_COMMANDS){
+        size_t batch = (count - i < SNOOZE_MAX_COMMANDS) ? count - i : SNOOZE_MAX_COMMANDS;
+        if (Exchange(commands + i, batch) < 0){
+            fprintf(stderr, "No response within %d ms\n", Timeout_MS);
+            return 1;
+        }
+        size_t replied = ParseResponse(replies, SNOOZE_MAX_COMMANDS);
+        failed += PrintReplies(replies, replied);
+        if (replied != batch) failed++;
+    }
+    return failed ? 1 : 0;
+}
+
+// ======================= Times ======================= //
+
+// Fill when from text, see the usage. Returns false if it can't be read
+static bool ParseTime(const char* text, time_t base, time_t* when){
+    struct tm tm;
+    const char* end;
+    if (strcmp(text, "now") == 0){
+        *when = base;
+        return true;
+    }
+    if (text[0] == '+'){
+        char* unit;
+        long amount = strtol(text + 1, &unit, 10);
+        long scale = (*unit == 's') ? 1 : (*unit == 'm') ? 60 : (*unit == 'h') ? 3600 : 0;
+        if (amount <= 0 || scale == 0 || unit[1] != '\0') return false;
+        *when = base + amount * scale;
+        return true;
+    }
+    // A failed strptime can leave tm half filled, so start each try afresh
+    localtime_r(&base, &tm);
+    tm.tm_sec = 0;
+    end = strptime(text, "%Y-%m-%d %H:%M", &tm);
+    if (!end){
+        localtime_r(&base, &tm);
+        tm.tm_sec = 0;
+        end = strptime(text, "%H:%M", &tm);
+    }
+    if (end){
+        if (*end == ':') end = strptime(end + 1, "%S", &tm);
+        if (!end || *end) return false;
+        tm.tm_isdst = -1;
+        *when = mktime(&tm);
+        // A bare time of day is the next time it comes round
+        if (!strchr(text, '-') && *when <= base) *when += 24 * 3600;
+        return true;
+    }
+    return false;
+}
+
+// The fixed width "<Year> <Month> <Day> <Day of Week> <Hour> <Min> <Sec>" SetClock and SetAlarm take
+static void FormatDeviceTime(time_t when, char* text, size_t size){
+    struct tm tm;
+    localtime_r(&when, &tm);
+    snprintf(text, size, "%04d %02d %02d %d %02d %02d %02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_wday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+static int SetClock(const char* text){
+    char command[96], device_time[64];
+    time_t when;
+    if (!ParseTime(text ? text : "now", time(NULL), &when)){
+        fprintf(stderr, "Can't read the time %s\n", text);
+        return 2;
+    }
+    FormatDeviceTime(when, device_time, sizeof(device_time));
+    snprintf(command, sizeof(command), "SetClock %s", device_time);
+    const char* commands[] = {command};
+    return Send(commands, 1);
+}
+
+static int SetAlarm(const char* start_text, const char* end_text){
+    char command[160], start_time[64], end_time[64];
+    time_t start, end;
+    if (!ParseTime(start_text, time(NULL), &start) || !ParseTime(end_text, start, &end) || end <= start){
+        fprintf(stderr, "Can't read the window %s to %s\n", start_text, end_text);
+        return 2;
+    }
+    FormatDeviceTime(start, start_time, sizeof(start_time));
+    FormatDeviceTime(end, end_time, sizeof(end_time));
+    snprintf(command, sizeof(command), "SetAlarm %s %s", start_time, end_time);
+    const char* commands[] = {command};
+    return Send(commands, 1);
+}
+
+// ======================= Trace ======================= //
+
+// Page through TraceDump until #DONE, keeping just the records
+static int SaveTrace(const char* path){
+    FILE* file = fopen(path, "w");
+    if (!file){
+        perror(path);
+        return 2;
+    }
+    unsigned long index = 0, records = 0;
+    while (1){
+        char command[32];
+        snprintf(command, sizeof(command), "TraceDump %lu", index);
+        const char* commands[] = {command};
+        if (Exchange(commands, 1) < 0){
+            fprintf(stderr, "No response within %d ms\n", Timeout_MS);
+            fclose(file);
+            return 1;
+        }
+        bool more = false;
+        for (char* line = strtok(Response, "\n"); line; line = strtok(NULL, "\n")){
+            if (sscanf(line, "#NEXT %lu", &index) == 1) more = true;
+            else if (strncmp(line, "#DONE", 5) == 0) fprintf(stderr, "Trace: %s\n", line + 1);
+            else if (line[0] == '#') continue;
+            else{
+                fprintf(file, "%s\n", line);
+                records++;
+            }
+        }
+        if (!more) break;
+    }
+    fclose(file);
+    fprintf(stderr, "%lu records saved to %s\n", records, path);
+    return 0;
+}
+
+// ======================= Bench ======================= //
+
+static int CompareDoubles(const void* a, const void* b){
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank, times has to be sorted
+static double Percentile(const double* times, size_t count, double percent){
+    size_t rank = (size_t) (percent / 100 * count + 0.999999);
+    if (rank < 1) rank = 1;
+    return times[rank - 1];
+}
+
+// Send messages messages of depth commands each, cycling through commands.
+// A command's latency is its message's round trip, since the response to
+// every command in a message comes back together
+static int Bench(const char** commands, size_t count, long messages, long depth){
+    static const char* empty = "";
+    TimingType timings[MAX_BENCH_COMMANDS];
+    ReplyType replies[SNOOZE_MAX_COMMANDS];
+    const char* batch[SNOOZE_MAX_COMMANDS];
+    size_t next = 0, bad = 0;
+    if (count == 0){
+        commands = &empty;
+        count = 1;
+        depth = 0;
+    }
+    if (depth < 0 || depth > SNOOZE_MAX_COMMANDS) depth = (count < SNOOZE_MAX_COMMANDS) ? count : SNOOZE_MAX_COMMANDS;
+    for (size_t i = 0; i < count; i++) timings[i] = (TimingType) {commands[i], calloc(messages * SNOOZE_MAX_COMMANDS, sizeof(double)), 0};
+
+    double start = Milliseconds();
+    for (long m = 0; m < messages; m++){
+        size_t picked[SNOOZE_MAX_COMMANDS];
+        for (long d = 0; d < depth; d++){
+            picked[d] = next;
+            batch[d] = commands[next];
+            next = (next + 1) % count;
+        }
+        double ms = Exchange(batch, depth);
+        if (ms < 0){
+            fprintf(stderr, "No response within %d ms\n", Timeout_MS);
+            return 1;
+        }
+        size_t replied = ParseResponse(replies, SNOOZE_MAX_COMMANDS);
+        for (size_t r = 0; r < replied; r++){
+            if (replies[r].Status != 0) bad++;
+            free(replies[r].Name);
+        }
+        if (depth == 0) timings[0].MS[timings[0].Count++] = ms;
+        for (long d = 0; d < depth; d++) timings[picked[d]].MS[timings[picked[d]].Count++] = ms;
+    }
+    double elapsed = Milliseconds() - start;
+
+    printf("command,runs,p50_ms,p90_ms,p99_ms,max_ms\n");
+    for (size_t i = 0; i < count; i++){
+        TimingType* timing = &timings[i];
+        if (timing->Count == 0) continue;
+        qsort(timing->MS, timing->Count, sizeof(double), CompareDoubles);
+        printf("%s,%zu,%.2f,%.2f,%.2f,%.2f\n", depth ? timing->Command : "(empty)", timing->Count, Percentile(timing->MS, timing->Count, 50),
+               Percentile(timing->MS, timing->Count, 90), Percentile(timing->MS, timing->Count, 99), timing->MS[timing->Count - 1]);
+        free(timing->MS);
+    }
+    printf("messages,depth,messages_per_s,commands_per_s,not_ok\n");
+    printf("%ld,%ld,%.1f,%.1f,%zu\n", messages, depth, messages * 1000 / elapsed, messages * depth * 1000 / elapsed, bad);
+    return bad ? 1 : 0;
+}
+
+// ======================= Sync ======================= //
+
+// Each SyncTime carries the time it went out and the time the last one's
+// response started coming back, the clock works out the rest. One last
+// SyncTime end finishes the burst, then the status is printed
+static int Sync(long exchanges){
+    char command[96];
+    const char* commands[] = {command};
+    ReplyType replies[SNOOZE_MAX_COMMANDS];
+    int64_t replied = 0;
+    for (long n = 0; n <= exchanges; n++){
+        // The send time has to be known before it's written, so it's a hair early
+        // and the round trip looks that much longer, never shorter
+        if (n < exchanges) snprintf(command, sizeof(command), "SyncTime %lld %lld", (long long) WallUs(), (long long) replied);
+        else snprintf(command, sizeof(command), "SyncTime end %lld", (long long) replied);
+        if (Exchange(commands, 1) < 0){
+            fprintf(stderr, "No response within %d ms\n", Timeout_MS);
+            return 1;
+        }
+        replied = Replied_Wall_US;
+        size_t count = ParseResponse(replies, SNOOZE_MAX_COMMANDS);
+        int failed = PrintReplies(replies, count);
+        if (failed || count != 1) return 1;
+    }
+    const char* status[] = {"SyncTime"};
+    return Send(status, 1);
+}
+
+// ======================= Main ======================= //
+
+static int Usage(const char* name){
+    fprintf(stderr, "Usage: %s [-p port] [-b baud] [-t timeout ms] [-v] <action> ...\n"
+                    "  send <command>...\n"
+                    "  clock [when]\n"
+                    "  alarm <start> <end|+duration>\n"
+                    "  trace <file>\n"
+                    "  bench [-n messages] [-d depth] [command]...\n"
+                    "  sync [-n exchanges]\n", name);
+    return 2;
+}
+
+int main(int argc, char** argv){
+    const char* path = getenv("SNOOZE_PORT") ? getenv("SNOOZE_PORT") : SNOOZE_DEFAULT_PORT;
+    long baud = 9600;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++){
+        if (strcmp(argv[i], "-v") == 0) Verbose = true;
+        else if (i + 1 >= argc) return Usage(argv[0]);
+        else if (strcmp(argv[i], "-p") == 0) path = argv[++i];
+        else if (strcmp(argv[i], "-b") == 0) baud = atol(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0) Timeout_MS = atoi(argv[++i]);
+        else return Usage(argv[0]);
+    }
+    if (i >= argc || BaudConstant(baud) == 0 || Timeout_MS <= 0) return Usage(argv[0]);
+    const char* action = argv[i++];
+    if (!OpenPort(path, baud)) return 2;
+
+    if (strcmp(action, "send") == 0 && i < argc) return Send((const char**) argv + i, argc - i);
+    if (strcmp(action, "clock") == 0) return SetClock((i < argc) ? argv[i] : NULL);
+    if (strcmp(action, "alarm") == 0 && i + 1 < argc) return SetAlarm(argv[i], argv[i + 1]);
+    if (strcmp(action, "trace") == 0 && i < argc) return SaveTrace(argv[i]);
+    if (strcmp(action, "bench") == 0){
+        long messages = SNOOZE_DEFAULT_BENCH, depth = -1;
+        for (; i + 1 < argc && argv[i][0] == '-'; i += 2){
+            if (strcmp(argv[i], "-n") == 0) messages = atol(argv[i + 1]);
+            else if (strcmp(argv[i], "-d") == 0) depth = atol(argv[i + 1]);
+            else return Usage(argv[0]);
+        }
+        if (messages <= 0 || argc - i > MAX_BENCH_COMMANDS) return Usage(argv[0]);
+        return Bench((const char**) argv + i, argc - i, messages, depth);
+    }
+    if (strcmp(action, "sync") == 0){
+        long exchanges = SNOOZE_DEFAULT_SYNC;
+        if (i + 1 < argc && strcmp(argv[i], "-n") == 0) exchanges = atol(argv[i + 1]);
+        else if (i < argc) return Usage(argv[0]);
+        if (exchanges <= 0) return Usage(argv[0]);
+        return Sync(exchanges);
+    }
+    return Usage(argv[0]);
+}